@@ -1,9 +1,11 @@
 # api.py
+import json
 import os
 import sys
-from fastapi import FastAPI, HTTPException
+from fastapi import FastAPI, HTTPException, Request, Response
+from fastapi.responses import StreamingResponse
 from pydantic import BaseModel
-from typing import List
+from typing import List, Optional
 
 # Use absolute path to ensure consistent DB location
 PROJECT_ROOT = os.path.dirname(os.path.abspath(__file__))
@@ -15,9 +17,12 @@ DB_PATH = os.path.join(DATA_DIR, "data.pesa")
 sys.path.insert(0, os.path.join(PROJECT_ROOT, "src", "python"))
 
 from executor import Database, Column, DataType
+from coalesce import WriteCoalescer
+from aio import AsyncDatabase, Overloaded
+from planner import LogicalScan, LogicalSort, LogicalLimit, Predicate
 
-# Initialize DB with absolute path
-db = Database(DB_PATH)
+# Initialize DB with absolute path; polled reads are served from the result cache
+db = Database(DB_PATH, result_cache=256)
 
 # Create tables if missing
 if "users" not in db.tables:
@@ -35,6 +40,20 @@ if "orders" not in db.tables:
 
 app = FastAPI(title="PesaDB Web API")
 
+# PESADB_WRITE_BATCH=N group-commits concurrent inserts, up to N rows per
+# transaction; unset or 0 commits each request on its own
+WRITE_BATCH = int(os.environ.get("PESADB_WRITE_BATCH", "0"))
+writes = WriteCoalescer(db, max_batch=WRITE_BATCH) if WRITE_BATCH > 0 else None
+
+# Endpoints are async and reach storage only through this facade: blocking
+# calls run on its threads, never on the event loop. PESADB_MAX_IN_FLIGHT
+# caps concurrent storage calls; requests that cannot get a slot within a
+# second are answered 503.
+adb = AsyncDatabase(db, writes, max_in_flight=int(os.environ.get("PESADB_MAX_IN_FLIGHT", "64")),
+                    admit_timeout=1.0)
+
+EXPORT_CHUNK = 500  # rows per keyset page while streaming an export
+
 # Models WITHOUT id fields
 class UserCreate(BaseModel):
     name: str  # ← no id
@@ -52,62 +71,93 @@ class OrderResponse(BaseModel):
     user_id: int
     item: str
 
-def get_next_user_id():
-    """Get next available user ID (max + 1)"""
-    users = db.get_table("users")
-    rows = users.select()
-    if not rows:
-        return 1
-    return max(row["id"] for row in rows) + 1
-
-def get_next_order_id():
-    """Get next available order ID (max + 1)"""
-    orders = db.get_table("orders")
-    rows = orders.select()
-    if not rows:
-        return 1
-    return max(row["order_id"] for row in rows) + 1
+def busy() -> HTTPException:
+    return HTTPException(status_code=503, detail="Server busy, retry later",
+                         headers={"Retry-After": "1"})
 
 @app.post("/users/", response_model=UserResponse)
-def create_user(user: UserCreate):
+async def create_user(user: UserCreate):
     try:
-        user_id = get_next_user_id()
-        users = db.get_table("users")
-        users.insert({"id": user_id, "name": user.name})
-        return {"id": user_id, "name": user.name}
+        return await adb.insert("users", {"name": user.name}, id_col="id")
     except ValueError as e:
         raise HTTPException(status_code=400, detail=str(e))
+    except Overloaded:
+        raise busy()
     except Exception as e:
         print(f"[ERROR] User creation failed: {e}")
         raise HTTPException(status_code=500, detail="Internal error")
 
+def users_after(after: Optional[int], limit: Optional[int], offset: int = 0):
+    """Logical plan for users in id order with id > after (keyset cursor)."""
+    preds = [] if after is None else [Predicate("id", ">", after)]
+    plan = LogicalSort(LogicalScan("users", preds), [("id", False)])
+    if limit is not None:
+        plan = LogicalLimit(plan, limit, offset)
+    elif offset:
+        plan = LogicalLimit(plan, db.get_table("users").stats.row_count, offset)
+    return plan
+
+def not_modified(request: Request, response: Response, plan) -> Optional[Response]:
+    """Set the result's ETag; a 304 response if the client already has it."""
+    tag = db.etag(plan)
+    if request.headers.get("if-none-match") == tag:
+        return Response(status_code=304, headers={"ETag": tag})
+    response.headers["ETag"] = tag
+    return None
+
 @app.get("/users/", response_model=List[UserResponse])
-def get_users():
+async def get_users(request: Request, response: Response, limit: Optional[int] = None, offset: int = 0,
+              after: Optional[int] = None):
+    """Users in id order. Page with limit and after=<last id seen>: each page
+    is a primary key index range walk, so it costs O(limit) however deep it
+    is. A full page sets X-Next-Cursor to pass as the next `after`."""
+    if (limit is not None and limit < 0) or offset < 0:
+        raise HTTPException(status_code=400, detail="limit and offset must be non-negative")
     try:
-        users = db.get_table("users")
-        return users.select()
+        plan = users_after(after, limit, offset)
+        cached = not_modified(request, response, plan)
+        if cached is not None:
+            return cached
+        rows = await adb.query(plan)
+        if limit and len(rows) == limit:
+            response.headers["X-Next-Cursor"] = str(rows[-1]["id"])
+        return rows
+    except Overloaded:
+        raise busy()
     except Exception as e:
         print(f"[ERROR] Fetch users failed: {e}")
         raise HTTPException(status_code=500, detail="Internal error")
 
+@app.get("/users/export")
+async def export_users():
+    """All users as NDJSON, streamed in keyset chunks: the first bytes go out
+    after one chunk and memory stays at one chunk whatever the table size."""
+    async def chunks():
+        after = None
+        while True:
+            plan = users_after(after, EXPORT_CHUNK)
+            rows = await adb.read(lambda: list(db.planner.run(plan)))
+            if not rows:
+                return
+            yield "".join(json.dumps(row) + "\n" for row in rows)
+            if len(rows) < EXPORT_CHUNK:
+                return
+            after = rows[-1]["id"]
+    return StreamingResponse(chunks(), media_type="application/x-ndjson")
+
 @app.post("/orders/", response_model=OrderResponse)
-def create_order(order: OrderCreate):
+async def create_order(order: OrderCreate):
     try:
         # Validate user exists
-        users = db.get_table("users")
-        if not users.select(where_col="id", where_val=order.user_id):
+        if not await adb.select("users", where_col="id", where_val=order.user_id):
             raise HTTPException(status_code=400, detail="User not found")
 
-        order_id = get_next_order_id()
-        orders = db.get_table("orders")
-        orders.insert({
-            "order_id": order_id,
-            "user_id": order.user_id,
-            "item": order.item
-        })
-        return {"order_id": order_id, "user_id": order.user_id, "item": order.item}
+        return await adb.insert("orders", {"user_id": order.user_id, "item": order.item},
+                                id_col="order_id")
     except ValueError as e:
         raise HTTPException(status_code=400, detail=str(e))
+    except Overloaded:
+        raise busy()
     except HTTPException:
         raise
     except Exception as e:
@@ -115,10 +165,35 @@ def create_order(order: OrderCreate):
         raise HTTPException(status_code=500, detail="Internal error")
 
 @app.get("/users/{user_id}/orders", response_model=List[OrderResponse])
-def get_user_orders(user_id: int):
+async def get_user_orders(user_id: int, request: Request, response: Response):
     try:
-        orders = db.get_table("orders")
-        return orders.select(where_col="user_id", where_val=user_id)
+        plan = LogicalScan("orders", [Predicate("user_id", "=", user_id)])
+        cached = not_modified(request, response, plan)
+        if cached is not None:
+            return cached
+        return await adb.query(plan)
+    except Overloaded:
+        raise busy()
     except Exception as e:
         print(f"[ERROR] Fetch orders failed: {e}")
-        raise HTTPException(status_code=500, detail="Internal error")
\ No newline at end of file
+        raise HTTPException(status_code=500, detail="Internal error")
+
+@app.get("/stats/")
+def get_stats():
+    return db.table_stats()
+
+@app.get("/stats/pool")
+def get_pool_stats():
+    return db.pool_stats()
+
+@app.get("/stats/cache")
+def get_cache_stats():
+    return db.cache.stats()
+
+@app.get("/stats/writes")
+def get_write_stats():
+    return writes.stats() if writes is not None else {"batches": 0, "rows": 0, "avg_batch": 0.0}
+
+@app.get("/stats/io")
+def get_io_stats():
+    return adb.stats()
@@ -0,0 +1,188 @@
+"""pesadbd — PesaDB server.
+
+Owns the storage engine and serves the binary protocol in src/python/wire.py
+over a Unix domain socket, so several processes (e.g. uvicorn workers) can
+share one database instead of each opening data.pesa themselves.
+
+    python pesadbd.py [--db data/data.pesa] [--socket data/pesadb.sock]
+                      [--follow PRIMARY]
+
+With --follow, the server is a read replica: it replays the WAL of PRIMARY
+(a pesadbd socket, or the primary's db path on this host) into --db and
+serves reads from it.
+"""
+import argparse
+import os
+import socketserver
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "src", "python"))
+
+import wire
+from executor import Database, commit_lsn
+from replica import Replica
+from rwlock import RWLock
+from statements import PreparedSelect, parse_select
+from vacuum import Vacuum
+
+
+class Engine:
+    """Executes decoded requests against the database.
+
+    Connection threads read in parallel under the read side of lock: each
+    thread reads pages into its own buffer (executor.read_page) and a query
+    only walks the in-memory indexes. Writes hold the write side."""
+
+    def __init__(self, db: Database, replica: Replica = None):
+        self.db = db
+        self.replica = replica
+        # A replica refreshes its tables under the write side of its lock
+        self.lock = replica.lock if replica is not None else RWLock()
+
+    def read(self, fn, *args):
+        return self.lock.read(fn, *args)
+
+    def write(self, fn, *args):
+        return self.lock.write(fn, *args)
+
+    def query(self, logical):
+        return self.read(self.db.query, logical)
+
+    def insert(self, table: str, rows):
+        # One transaction for all rows of the request; errors per row
+        errors = self.write(self.db.insert_batch, [(table, row) for row in rows])
+        return [None if e is None else str(e) for e in errors]
+
+    def delete(self, table: str, key_col: str, key_val):
+        self.write(self.db.get_table(table).delete, key_col, key_val)
+
+    def update(self, table: str, key_col: str, key_val, updates):
+        self.write(self.db.get_table(table).update, key_col, key_val, updates)
+
+    def wal_read(self, offset: int, size: int):
+        """Committed WAL bytes from offset, for replicas following this server."""
+        end = commit_lsn()
+        size = max(0, min(size, end - offset))
+        with open(self.db.path + "-wal", "rb") as f:
+            f.seek(offset)
+            return [f.read(size), end]
+
+    def vacuum(self):
+        """One VACUUM pass; each batch takes the write lock on its own, so
+        queries and writes carry on in between."""
+        if self.replica is not None:
+            raise PermissionError("A replica is vacuumed by its primary")
+        return Vacuum(self.db, run=self.write).run()
+
+    def status(self):
+        if self.replica is not None:
+            return self.replica.status()
+        return {"role": "primary", "commit_lsn": commit_lsn(), "page_size": self.db.page_size}
+
+
+class Connection(socketserver.StreamRequestHandler):
+    """One client. Requests are read and answered in order, so a client may
+    pipeline any number of them; prepared statements live per connection."""
+
+    def setup(self):
+        super().setup()
+        self.statements = {}
+        self.next_stmt = 1
+
+    def handle(self):
+        engine: Engine = self.server.engine
+        while True:
+            try:
+                req_id, op, arg = wire.read_frame(self.rfile)
+            except (EOFError, ConnectionError):
+                return
+            except wire.ProtocolError as e:
+                self.wfile.write(wire.frame(0, wire.STATUS_ERR, ["ProtocolError", str(e)]))
+                return
+            try:
+                reply = self.dispatch(engine, op, arg)
+                out = wire.frame(req_id, wire.STATUS_OK, reply)
+            except Exception as e:
+                out = wire.frame(req_id, wire.STATUS_ERR, [type(e).__name__, str(e)])
+            self.wfile.write(out)
+
+    def dispatch(self, engine: Engine, op: int, arg):
+        if op == wire.OP_PING:
+            return "pong"
+        if op == wire.OP_QUERY:
+            return engine.query(parse_select(arg))
+        if op == wire.OP_PREPARE:
+            stmt = PreparedSelect(arg)
+            stmt_id = self.next_stmt
+            self.next_stmt += 1
+            self.statements[stmt_id] = stmt
+            return [stmt_id, len(stmt.params)]
+        if op == wire.OP_EXECUTE:
+            stmt_id, values = arg
+            if stmt_id not in self.statements:
+                raise KeyError(f"No prepared statement {stmt_id}")
+            return engine.query(self.statements[stmt_id].bind(values))
+        if op == wire.OP_CLOSE:
+            self.statements.pop(arg, None)
+            return None
+        if op == wire.OP_INSERT:
+            table, rows = arg
+            return engine.insert(table, rows)
+        if op == wire.OP_DELETE:
+            engine.delete(*arg)
+            return None
+        if op == wire.OP_UPDATE:
+            engine.update(*arg)
+            return None
+        if op == wire.OP_EXPLAIN:
+            return engine.read(engine.db.planner.explain, parse_select(arg))
+        if op == wire.OP_WAL_READ:
+            return engine.wal_read(*arg)
+        if op == wire.OP_STATUS:
+            return engine.status()
+        if op == wire.OP_VACUUM:
+            return engine.vacuum()
+        raise ValueError(f"Unknown opcode {op}")
+
+
+class Server(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    daemon_threads = True
+
+    def __init__(self, socket_path: str, engine: Engine):
+        if os.path.exists(socket_path):
+            os.unlink(socket_path)  # left behind by a previous run
+        super().__init__(socket_path, Connection)
+        self.engine = engine
+
+
+def main():
+    parser = argparse.ArgumentParser(description="PesaDB server")
+    parser.add_argument("--db", default=os.path.join("data", "data.pesa"))
+    parser.add_argument("--socket", default=os.path.join("data", "pesadb.sock"))
+    parser.add_argument("--follow", metavar="PRIMARY",
+                        help="replicate from a primary (pesadbd socket or db path)")
+    parser.add_argument("--page-size", type=int,
+                        help="bytes per page if the database is new (4096-65536, a power of two)")
+    args = parser.parse_args()
+
+    os.makedirs(os.path.dirname(os.path.abspath(args.db)), exist_ok=True)
+    if args.follow:
+        replica = Replica(args.db, args.follow)
+        replica.start()
+        engine = Engine(replica.db, replica)
+    else:
+        engine = Engine(Database(args.db, page_size=args.page_size))
+    server = Server(args.socket, engine)
+    role = f"replica of {args.follow}" if args.follow else "primary"
+    print(f"pesadbd serving {args.db} ({role}) on {args.socket}")
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.server_close()
+        os.unlink(args.socket)
+
+
+if __name__ == "__main__":
+    main()
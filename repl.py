@@ -5,10 +5,14 @@ import os
 sys.path.insert(0, os.path.join(os.path.dirname(__file__), "src", "python"))
 
 from executor import Database, Column, DataType
+from planner import LogicalScan, LogicalJoin
+from statements import build_select, parse_create_view
+from vacuum import vacuum
+
 
 def main():
     print("PesaDB REPL v2.1 — Safe, persistent, with C hash join!")
-    print("Commands: INS <table> ..., SEL <table> [WHERE col=val], DEL <table> <pk>, UPD <table> SET ... WHERE ..., JOIN t1 t2 ON k1 k2, exit")
+    print("Commands: INS <table> ..., SEL <table> [WHERE col [op] val [AND ...]] [ORDER BY col [DESC]] [LIMIT n [OFFSET m]], DEL <table> <pk>, UPD <table> SET ... WHERE ..., JOIN t1 t2 ON k1 k2, COUNT <table>, STATS <table>, ANALYZE <table>, INDEX <table> <col>, CREATE MATERIALIZED VIEW <name> AS ..., VACUUM, EXPLAIN ..., exit")
     
     # Use 'data/' subdirectory for database files
     db_path = os.path.join("data", "data.pesa")
@@ -68,30 +72,12 @@ def main():
                     print("Insert error:", e)
 
             elif verb in ("SEL", "SELECT"):
-                if len(parts) < 2:
-                    print("Usage: SEL <table> [WHERE col=value]")
-                    continue
-                table = parts[1]
-                where_col, where_val = None, None
-                if len(parts) >= 5 and parts[2].upper() == "WHERE":
-                    where_col = parts[3]
-                    where_val_str = parts[4]
-                    try:
-                        where_val = int(where_val_str)
-                    except ValueError:
-                        where_val = where_val_str
-
                 try:
-                    if table == "users":
-                        rows = users.select(where_col, where_val)
-                    elif table == "orders":
-                        rows = orders.select(where_col, where_val)
-                    else:
-                        print("Unknown table")
-                        continue
-                    for r in rows:
+                    empty = True
+                    for r in db.planner.run(build_select(parts[1:])):
                         print(r)
-                    if not rows:
+                        empty = False
+                    if empty:
                         print("(empty)")
                 except Exception as e:
                     print("Select error:", e)
@@ -171,13 +157,81 @@ def main():
                 except Exception as e:
                     print("Update error:", e)
 
+            elif verb == "COUNT":
+                if len(parts) != 2:
+                    print("Usage: COUNT <table>")
+                    continue
+                try:
+                    print(db.get_table(parts[1]).count())
+                except Exception as e:
+                    print("Count error:", e)
+
+            elif verb == "STATS":
+                if len(parts) != 2:
+                    print("Usage: STATS <table>")
+                    continue
+                try:
+                    print(db.get_table(parts[1]).stats.to_dict())
+                except Exception as e:
+                    print("Stats error:", e)
+
+            elif verb == "ANALYZE":
+                if len(parts) != 2:
+                    print("Usage: ANALYZE <table>")
+                    continue
+                try:
+                    table = db.get_table(parts[1])
+                    for col, a in table.analyze().items():
+                        print(f"{col}: ndv~{a.ndv():.0f} mcv={a.mcv} hist={a.histogram}")
+                except Exception as e:
+                    print("Analyze error:", e)
+
+            elif verb == "INDEX":
+                if len(parts) != 3:
+                    print("Usage: INDEX <table> <col>")
+                    continue
+                try:
+                    db.get_table(parts[1]).create_index(parts[2])
+                    print(f"✓ Indexed {parts[1]}.{parts[2]}")
+                except Exception as e:
+                    print("Index error:", e)
+
+            elif verb == "CREATE":
+                # CREATE MATERIALIZED VIEW <name> AS SELECT ... GROUP BY ... | AS JOIN t1 t2 ON k1 k2
+                try:
+                    name, query = parse_create_view(line)
+                    view = db.create_materialized_view(name, query)
+                    print(f"✓ Created materialized view {name} ({view.count()} rows)")
+                except Exception as e:
+                    print("Create error:", e)
+
+            elif verb == "VACUUM":
+                try:
+                    r = vacuum(db, rate=0)
+                    print(f"✓ Vacuumed: {r['moved']} pages moved, {r['repacked']} freed by repacking, "
+                          f"{r['pages_before']} -> {r['pages_after']} pages")
+                except Exception as e:
+                    print("Vacuum error:", e)
+
+            elif verb == "EXPLAIN":
+                # EXPLAIN SEL <table> [WHERE ...] [ORDER BY ...] [LIMIT ...] | EXPLAIN JOIN t1 t2 ON k1 k2
+                rest = parts[1:]
+                try:
+                    if len(rest) >= 2 and rest[0].upper() in ("SEL", "SELECT"):
+                        print(db.planner.explain(build_select(rest[1:])))
+                    elif len(rest) == 6 and rest[0].upper() == "JOIN" and rest[3] == "ON":
+                        print(db.planner.explain(LogicalJoin(
+                            LogicalScan(rest[1]), LogicalScan(rest[2]), rest[4], rest[5])))
+                    else:
+                        print("Usage: EXPLAIN SEL <table> [WHERE ...] [ORDER BY col [DESC]] [LIMIT n] | EXPLAIN JOIN <t1> <t2> ON <k1> <k2>")
+                except Exception as e:
+                    print("Explain error:", e)
+
             elif verb == "JOIN":
                 if len(parts) == 6 and parts[3] == "ON":
                     t1, t2, k1, k2 = parts[1], parts[2], parts[4], parts[5]
                     try:
-                        table1 = db.get_table(t1)
-                        table2 = db.get_table(t2)
-                        results = table1.hash_join(table2, k1, k2)
+                        results = db.planner.join(t1, t2, k1, k2)
                         for r in results:
                             print(r)
                         if not results:
@@ -188,7 +242,7 @@ def main():
                     print("Usage: JOIN <t1> <t2> ON <key1> <key2>")
 
             else:
-                print(f"Unknown command: '{parts[0]}'. Try: INS, SEL, DEL, UPD, JOIN, exit")
+                print(f"Unknown command: '{parts[0]}'. Try: INS, SEL, DEL, UPD, JOIN, COUNT, STATS, ANALYZE, INDEX, CREATE, VACUUM, EXPLAIN, exit")
 
         except KeyboardInterrupt:
             print("\nBye!")
@@ -0,0 +1,591 @@
+// extsort.c — external merge sort with a bounded memory budget
+//
+// The caller adds records as (normalized key, payload) byte strings: keys
+// are built so that memcmp order is the requested sort order, so the sort
+// never has to understand column types. Records collect in a run buffer
+// sized to a share of the memory budget; a full buffer is handed to the
+// shared task pool (taskpool.c), which sorts it and spills it to an
+// unlinked temp file while the caller keeps filling the next buffer.
+// xs_finish sorts whatever is left; if nothing was spilled the result is
+// served from memory, otherwise the runs are merged with a loser tree
+// through small per-run read buffers. Fan-in is capped so each reader
+// gets XS_MIN_READ_BUF of the budget and open runs stay within the fd
+// limit; more runs than that are first merged in intermediate passes,
+// consecutive runs at a time so ties keep insertion order.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "waldb.h"
+
+#define XS_MAX_INFLIGHT 4          /* sealed buffers being sorted/spilled at once */
+#define XS_MIN_READ_BUF (16 * 1024)
+#define XS_WRITE_BUF (256 * 1024)
+#define XS_HDR 8                   /* u32 klen | u32 plen before each spilled record */
+#define XS_MAX_FDS 1024            /* open runs when the fd limit is unlimited */
+
+/* ================= TYPES ================= */
+typedef struct {
+    uint64_t prefix;     /* first 8 key bytes, big-endian: most compares stop here */
+    uint64_t seq;        /* insertion order, for stable ties */
+    uint32_t off;        /* record start in the buffer's data */
+    uint32_t klen;
+    uint32_t plen;
+} XsRec;
+
+typedef struct XsRun {
+    char* data;          /* key bytes followed by payload bytes, per record */
+    size_t data_len;
+    size_t data_cap;
+    XsRec* recs;
+    size_t nrecs;
+    size_t rec_cap;
+    int fd;              /* spilled run, -1 while in memory */
+    bool failed;
+    struct XsSort* owner;
+} XsRun;
+
+/* Buffered reader over one spilled run. */
+typedef struct {
+    int fd;
+    off_t file_off;
+    char* buf;
+    size_t cap;
+    size_t pos;
+    size_t len;
+    const char* key;     /* current record, NULL once the run is exhausted */
+    uint32_t klen;
+    uint32_t plen;
+    bool failed;         /* a record did not fit memory: the run was cut short */
+} XsReader;
+
+typedef struct XsSort {
+    size_t budget;
+    size_t run_budget;
+    char tmpdir[512];
+
+    XsRun* cur;          /* buffer being filled */
+    uint64_t seq;
+
+    XsRun** runs;        /* sealed runs in creation order */
+    size_t nruns;
+    size_t runs_cap;
+    size_t spilled;      /* runs sealed over the sort's life */
+    size_t fan_in;       /* runs one merge may read at once */
+    size_t max_open;     /* spilled runs kept open before merging some */
+
+    WaldbTaskGroup* group;
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    int inflight;
+    int max_inflight;
+    bool failed;
+
+    /* output */
+    bool finished;
+    bool in_memory;      /* single run never spilled: iterate cur->recs */
+    size_t emit;
+    XsReader* readers;
+    int* tree;           /* loser tree: tree[0] winner, tree[1..k-1] losers */
+    int k;
+    int advance;         /* run whose record was last returned, -1 if none */
+} XsSort;
+
+/* ================= RUN BUFFERS ================= */
+static XsRun* run_new(XsSort* s) {
+    XsRun* r = calloc(1, sizeof(XsRun));
+    if (!r) return NULL;
+    r->fd = -1;
+    r->owner = s;
+    return r;
+}
+
+static size_t run_bytes(const XsRun* r) {
+    return r->data_len + r->nrecs * sizeof(XsRec);
+}
+
+static void run_free(XsRun* r) {
+    if (!r) return;
+    if (r->fd >= 0) close(r->fd);
+    free(r->data);
+    free(r->recs);
+    free(r);
+}
+
+static uint64_t key_prefix(const char* key, size_t klen) {
+    uint64_t p = 0;
+    for (size_t i = 0; i < 8; i++) {
+        p = (p << 8) | (i < klen ? (uint8_t)key[i] : 0);
+    }
+    return p;
+}
+
+static int cmp_keys(const char* a, size_t alen, const char* b, size_t blen) {
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    if (c) return c;
+    return alen < blen ? -1 : alen > blen;
+}
+
+static int cmp_recs(const void* pa, const void* pb, void* ctx) {
+    const char* run_data_base = ctx;
+    const XsRec* a = pa;
+    const XsRec* b = pb;
+    if (a->prefix != b->prefix) return a->prefix < b->prefix ? -1 : 1;
+    if (a->klen > 8 || b->klen > 8) {
+        int c = cmp_keys(run_data_base + a->off, a->klen, run_data_base + b->off, b->klen);
+        if (c) return c;
+    } else if (a->klen != b->klen) {
+        return a->klen < b->klen ? -1 : 1;
+    }
+    return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+static void run_sort(XsRun* r) {
+    qsort_r(r->recs, r->nrecs, sizeof(XsRec), cmp_recs, r->data);
+}
+
+static bool write_all(int fd, const char* p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
+
+static int open_spill(const char* tmpdir) {
+    char path[600];
+    snprintf(path, sizeof(path), "%s/pesadb-sort-XXXXXX", tmpdir);
+    int fd = mkstemp(path);
+    if (fd >= 0) unlink(path);  /* the file lives only as long as the fd */
+    return fd;
+}
+
+/* Buffered writer of spilled records. */
+typedef struct {
+    int fd;
+    char* buf;
+    size_t n;
+    bool ok;
+} XsWriter;
+
+static bool writer_open(XsWriter* w, const char* tmpdir) {
+    w->n = 0;
+    w->buf = malloc(XS_WRITE_BUF);
+    w->fd = w->buf ? open_spill(tmpdir) : -1;
+    w->ok = w->fd >= 0;
+    return w->ok;
+}
+
+/* rec holds the key followed by the payload. */
+static void writer_put(XsWriter* w, const char* rec, uint32_t klen, uint32_t plen) {
+    size_t len = (size_t)klen + plen;
+    if (w->n + XS_HDR + len > XS_WRITE_BUF) {
+        w->ok = w->ok && write_all(w->fd, w->buf, w->n);
+        w->n = 0;
+    }
+    uint32_t hdr[2] = { klen, plen };
+    if (XS_HDR + len > XS_WRITE_BUF) {
+        /* oversized record: write it straight through */
+        w->ok = w->ok && write_all(w->fd, (const char*)hdr, XS_HDR) &&
+                write_all(w->fd, rec, len);
+        return;
+    }
+    memcpy(w->buf + w->n, hdr, XS_HDR);
+    memcpy(w->buf + w->n + XS_HDR, rec, len);
+    w->n += XS_HDR + len;
+}
+
+/* Flush and free the buffer; returns the fd, or -1 (closed) on failure. */
+static int writer_close(XsWriter* w) {
+    if (w->ok && w->n) w->ok = write_all(w->fd, w->buf, w->n);
+    free(w->buf);
+    w->buf = NULL;
+    if (!w->ok && w->fd >= 0) {
+        close(w->fd);
+        w->fd = -1;
+    }
+    return w->fd;
+}
+
+/* Sort a sealed run and write it out; frees its memory. */
+static bool run_spill(XsRun* r, const char* tmpdir) {
+    run_sort(r);
+    XsWriter w;
+    if (writer_open(&w, tmpdir)) {
+        for (size_t i = 0; i < r->nrecs && w.ok; i++) {
+            XsRec* rec = &r->recs[i];
+            writer_put(&w, r->data + rec->off, rec->klen, rec->plen);
+        }
+    }
+    r->fd = writer_close(&w);
+    free(r->data);
+    free(r->recs);
+    r->data = NULL;
+    r->recs = NULL;
+    r->data_len = r->data_cap = 0;
+    r->rec_cap = 0;
+    return r->fd >= 0;
+}
+
+static void spill_task(void* arg) {
+    XsRun* r = arg;
+    XsSort* s = r->owner;
+    r->failed = !run_spill(r, s->tmpdir);
+    pthread_mutex_lock(&s->mu);
+    if (r->failed) s->failed = true;
+    s->inflight--;
+    pthread_cond_signal(&s->cv);
+    pthread_mutex_unlock(&s->mu);
+}
+
+static bool push_run(XsSort* s, XsRun* r) {
+    if (s->nruns == s->runs_cap) {
+        size_t cap = s->runs_cap ? s->runs_cap * 2 : 16;
+        XsRun** grown = realloc(s->runs, sizeof(XsRun*) * cap);
+        if (!grown) return false;
+        s->runs = grown;
+        s->runs_cap = cap;
+    }
+    s->runs[s->nruns++] = r;
+    return true;
+}
+
+static bool reduce_runs(XsSort* s, size_t limit);
+
+/* Hand the full buffer to the pool and start a new one. Blocks while
+ * max_inflight buffers are still being sorted, which bounds memory, and
+ * merges runs down once max_open of them hold a descriptor. */
+static bool seal_run(XsSort* s) {
+    XsRun* next = run_new(s);
+    if (!next) return false;
+    if (s->nruns >= s->max_open) {
+        waldb_group_wait(s->group);
+        if (s->failed || !reduce_runs(s, s->max_open / 2)) {
+            free(next);
+            return false;
+        }
+    }
+    if (!push_run(s, s->cur)) {
+        free(next);
+        return false;
+    }
+    pthread_mutex_lock(&s->mu);
+    while (s->inflight >= s->max_inflight) pthread_cond_wait(&s->cv, &s->mu);
+    s->inflight++;
+    pthread_mutex_unlock(&s->mu);
+    s->spilled++;
+    waldb_spawn(s->group, WALDB_PRIO_NORMAL, spill_task, s->cur);
+    s->cur = next;
+    return true;
+}
+
+/* ================= MERGE ================= */
+static void reader_next(XsReader* rd) {
+    for (;;) {
+        size_t avail = rd->len - rd->pos;
+        if (avail >= XS_HDR) {
+            uint32_t hdr[2];
+            memcpy(hdr, rd->buf + rd->pos, XS_HDR);
+            size_t need = XS_HDR + (size_t)hdr[0] + hdr[1];
+            if (avail >= need) {
+                rd->key = rd->buf + rd->pos + XS_HDR;
+                rd->klen = hdr[0];
+                rd->plen = hdr[1];
+                rd->pos += need;
+                return;
+            }
+            if (need > rd->cap) {
+                char* nb = malloc(need);
+                if (!nb) {
+                    rd->failed = true;
+                    rd->key = NULL;
+                    return;
+                }
+                rd->cap = need;
+                memcpy(nb, rd->buf + rd->pos, avail);
+                free(rd->buf);
+                rd->buf = nb;
+                rd->pos = 0;
+                rd->len = avail;
+            }
+        }
+        /* refill: keep the partial record, read behind it */
+        memmove(rd->buf, rd->buf + rd->pos, avail);
+        rd->pos = 0;
+        rd->len = avail;
+        ssize_t got = pread(rd->fd, rd->buf + rd->len, rd->cap - rd->len, rd->file_off);
+        if (got <= 0) {
+            rd->key = NULL;
+            return;
+        }
+        rd->file_off += got;
+        rd->len += (size_t)got;
+    }
+}
+
+/* Does run a's current record sort before run b's? Exhausted runs lose;
+ * ties go to the earlier run, which holds the earlier records. */
+static bool run_less(XsSort* s, int a, int b) {
+    XsReader* ra = &s->readers[a];
+    XsReader* rb = &s->readers[b];
+    if (!ra->key) return false;
+    if (!rb->key) return true;
+    int c = cmp_keys(ra->key, ra->klen, rb->key, rb->klen);
+    return c < 0 || (c == 0 && a < b);
+}
+
+/* Leaves are nodes k..2k-1 (run = node - k); returns the subtree winner. */
+static int tree_build(XsSort* s, int node) {
+    if (node >= s->k) return node - s->k;
+    int l = tree_build(s, 2 * node);
+    int r = tree_build(s, 2 * node + 1);
+    if (run_less(s, r, l)) {
+        s->tree[node] = l;
+        return r;
+    }
+    s->tree[node] = r;
+    return l;
+}
+
+/* The winner's run advanced: replay its path to the root. */
+static void tree_replay(XsSort* s, int run) {
+    int winner = run;
+    for (int node = (run + s->k) >> 1; node >= 1; node >>= 1) {
+        if (run_less(s, s->tree[node], winner)) {
+            int t = s->tree[node];
+            s->tree[node] = winner;
+            winner = t;
+        }
+    }
+    s->tree[0] = winner;
+}
+
+/* Open readers over runs[first..first+count) and build the tree. */
+static bool start_merge(XsSort* s, size_t first, size_t count) {
+    s->k = (int)count;
+    s->readers = calloc(count, sizeof(XsReader));
+    s->tree = calloc(count + 1, sizeof(int));
+    if (!s->readers || !s->tree) return false;
+    size_t share = s->budget / count;
+    if (share < XS_MIN_READ_BUF) share = XS_MIN_READ_BUF;
+    for (int i = 0; i < s->k; i++) {
+        XsReader* rd = &s->readers[i];
+        rd->fd = s->runs[first + (size_t)i]->fd;
+        rd->cap = share;
+        rd->buf = malloc(share);
+        if (!rd->buf) return false;
+        reader_next(rd);
+        if (rd->failed) return false;
+    }
+    s->tree[0] = s->k == 1 ? 0 : tree_build(s, 1);
+    s->advance = -1;
+    return true;
+}
+
+static void end_merge(XsSort* s) {
+    if (s->readers) {
+        for (int i = 0; i < s->k; i++) free(s->readers[i].buf);
+        free(s->readers);
+    }
+    free(s->tree);
+    s->readers = NULL;
+    s->tree = NULL;
+    s->k = 0;
+}
+
+/* Merge runs[first..first+count) into one spilled run; returns its fd or -1. */
+static int merge_pass(XsSort* s, size_t first, size_t count) {
+    XsWriter w;
+    if (!writer_open(&w, s->tmpdir)) return writer_close(&w);
+    if (start_merge(s, first, count)) {
+        for (int win = s->tree[0]; s->readers[win].key && w.ok; win = s->tree[0]) {
+            XsReader* rd = &s->readers[win];
+            writer_put(&w, rd->key, rd->klen, rd->plen);
+            reader_next(rd);
+            w.ok = w.ok && !rd->failed;
+            tree_replay(s, win);
+        }
+    } else {
+        w.ok = false;
+    }
+    end_merge(s);
+    return writer_close(&w);
+}
+
+/* Merge consecutive groups of up to fan_in runs until at most limit remain. */
+static bool reduce_runs(XsSort* s, size_t limit) {
+    if (limit < 1) limit = 1;
+    while (s->nruns > limit) {
+        size_t kept = 0;
+        for (size_t first = 0; first < s->nruns; first += s->fan_in) {
+            size_t count = s->nruns - first < s->fan_in ? s->nruns - first : s->fan_in;
+            if (count > 1) {
+                int fd = merge_pass(s, first, count);
+                if (fd < 0) return false;
+                for (size_t i = 1; i < count; i++) run_free(s->runs[first + i]);
+                close(s->runs[first]->fd);
+                s->runs[first]->fd = fd;
+            }
+            s->runs[kept++] = s->runs[first];
+        }
+        s->nruns = kept;
+    }
+    return true;
+}
+
+/* ================= PUBLIC API ================= */
+void* xs_new(size_t mem_budget, const char* tmpdir) {
+    XsSort* s = calloc(1, sizeof(XsSort));
+    if (!s) return NULL;
+    const char* dir = tmpdir && *tmpdir ? tmpdir : getenv("TMPDIR");
+    snprintf(s->tmpdir, sizeof(s->tmpdir), "%s", dir && *dir ? dir : "/tmp");
+    s->budget = mem_budget ? mem_budget : (64u << 20);
+    int pool = waldb_pool_size();
+    s->max_inflight = pool < 1 ? 1 : pool > XS_MAX_INFLIGHT ? XS_MAX_INFLIGHT : pool;
+    /* the buffer being filled plus every sealed one in flight fit the budget */
+    s->run_budget = s->budget / (size_t)(s->max_inflight + 1);
+    /* every reader of a merge gets at least XS_MIN_READ_BUF of the budget */
+    s->fan_in = s->budget / XS_MIN_READ_BUF;
+    /* open runs leave half the descriptors to the database and the caller */
+    struct rlimit rl;
+    s->max_open = XS_MAX_FDS;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY &&
+        rl.rlim_cur / 2 < s->max_open)
+        s->max_open = (size_t)rl.rlim_cur / 2;
+    if (s->max_open < 4) s->max_open = 4;
+    if (s->fan_in > s->max_open / 2) s->fan_in = s->max_open / 2;
+    if (s->fan_in < 2) s->fan_in = 2;
+    s->cur = run_new(s);
+    s->group = waldb_group_new();
+    pthread_mutex_init(&s->mu, NULL);
+    pthread_cond_init(&s->cv, NULL);
+    if (!s->cur || !s->group) {
+        xs_free(s);
+        return NULL;
+    }
+    return s;
+}
+
+int xs_add(void* sort, const void* key, size_t klen, const void* payload, size_t plen) {
+    XsSort* s = sort;
+    if (s->finished || klen > UINT32_MAX || plen > UINT32_MAX) return -1;
+    XsRun* r = s->cur;
+    size_t len = klen + plen;
+    if (r->nrecs && run_bytes(r) + len + sizeof(XsRec) > s->run_budget) {
+        if (!seal_run(s)) return -1;
+        r = s->cur;
+    }
+    if (r->data_len + len > UINT32_MAX) return -1;
+    if (r->data_len + len > r->data_cap) {
+        size_t cap = r->data_cap ? r->data_cap * 2 : 64 * 1024;
+        while (cap < r->data_len + len) cap *= 2;
+        char* grown = realloc(r->data, cap);
+        if (!grown) return -1;
+        r->data = grown;
+        r->data_cap = cap;
+    }
+    if (r->nrecs == r->rec_cap) {
+        size_t cap = r->rec_cap ? r->rec_cap * 2 : 1024;
+        XsRec* grown = realloc(r->recs, sizeof(XsRec) * cap);
+        if (!grown) return -1;
+        r->recs = grown;
+        r->rec_cap = cap;
+    }
+    memcpy(r->data + r->data_len, key, klen);
+    memcpy(r->data + r->data_len + klen, payload, plen);
+    r->recs[r->nrecs++] = (XsRec){
+        .prefix = key_prefix(key, klen), .seq = s->seq++,
+        .off = (uint32_t)r->data_len, .klen = (uint32_t)klen, .plen = (uint32_t)plen,
+    };
+    r->data_len += len;
+    return 0;
+}
+
+/* Stop accepting records and prepare the output. Returns -1 if a spill or
+ * an intermediate merge failed, or memory ran out. */
+int xs_finish(void* sort) {
+    XsSort* s = sort;
+    if (s->finished) return s->failed ? -1 : 0;
+    s->finished = true;
+    if (s->nruns == 0) {
+        run_sort(s->cur);
+        s->in_memory = true;
+        return 0;
+    }
+    if (s->cur->nrecs && !seal_run(s)) {
+        s->failed = true;
+        return -1;
+    }
+    waldb_group_wait(s->group);
+    if (s->failed || !reduce_runs(s, s->fan_in) || !start_merge(s, 0, s->nruns)) {
+        s->failed = true;
+        return -1;
+    }
+    return 0;
+}
+
+/* Next record's payload in sort order; valid until the next call.
+ * Returns 0 at the end, -1 if a record could not be read back. */
+int xs_next(void* sort, const char** payload, size_t* plen) {
+    XsSort* s = sort;
+    if (!s->finished) return 0;
+    if (s->failed) return -1;
+    if (s->in_memory) {
+        if (s->emit >= s->cur->nrecs) return 0;
+        XsRec* rec = &s->cur->recs[s->emit++];
+        *payload = s->cur->data + rec->off + rec->klen;
+        *plen = rec->plen;
+        return 1;
+    }
+    /* advance lazily so the returned payload stays in the read buffer */
+    if (s->advance >= 0) {
+        reader_next(&s->readers[s->advance]);
+        if (s->readers[s->advance].failed) {
+            s->failed = true;
+            return -1;
+        }
+        tree_replay(s, s->advance);
+    }
+    int w = s->tree[0];
+    XsReader* rd = &s->readers[w];
+    s->advance = w;
+    if (!rd->key) {
+        s->advance = -1;
+        return 0;
+    }
+    *payload = rd->key + rd->klen;
+    *plen = rd->plen;
+    return 1;
+}
+
+size_t xs_runs(void* sort) {
+    return ((XsSort*)sort)->spilled;
+}
+
+void xs_free(void* sort) {
+    XsSort* s = sort;
+    if (!s) return;
+    if (s->group) {
+        waldb_group_wait(s->group);
+        waldb_group_free(s->group);
+    }
+    for (size_t i = 0; i < s->nruns; i++) run_free(s->runs[i]);
+    free(s->runs);
+    run_free(s->cur);
+    end_merge(s);
+    pthread_cond_destroy(&s->cv);
+    pthread_mutex_destroy(&s->mu);
+    free(s);
+}
@@ -5,7 +5,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 
-#define HASH_SIZE 4096
+#define MIN_SLOTS 16
 #define INIT_CAP 4
 
 /* =========================
@@ -13,11 +13,19 @@
    ========================= */
 typedef struct {
     char* key;
-    char** rows;
+    PyObject** rows;    /* parsed build rows (dicts) with this key */
     size_t count;
     size_t cap;
 } HashEntry;
 
+/* The build side of a join: hashed once, then probed batch by batch. */
+typedef struct {
+    HashEntry* slots;
+    size_t nslots;      /* a power of two */
+    PyObject* loads;
+    PyObject* dumps;
+} HashJoin;
+
 /* =========================
    Utilities
    ========================= */
@@ -29,6 +37,15 @@ static unsigned long hash_str(const char* s) {
     return h;
 }
 
+/* Open addressing needs a free slot per distinct key: at least twice the
+ * build rows, rounded up to a power of two so the probe can mask. */
+static size_t slots_for(size_t rows) {
+    size_t n = MIN_SLOTS;
+    while (n < rows * 2)
+        n <<= 1;
+    return n;
+}
+
 static char* strdup_safe(const char* s) {
     if (!s) return NULL;
     size_t len = strlen(s) + 1;
@@ -37,203 +54,255 @@ static char* strdup_safe(const char* s) {
     return d;
 }
 
-/* =========================
-   Hash Join
-   ========================= */
-int hash_join(
-    const char** inner_rows,
-    size_t inner_count,
-    const char** outer_rows,
-    size_t outer_count,
-    const char* inner_key,
-    const char* outer_key,
-    char* output_buf,
-    size_t output_buf_size
-) {
-    size_t result_count = 0;
-    size_t out_pos = 0;
-    PyObject* json = NULL;
-    PyObject* loads = NULL;
-    PyObject* dumps = NULL;
-
-    /* ---------- Python setup ---------- */
-    PyGILState_STATE gstate = PyGILState_Ensure();
-
-    json = PyImport_ImportModule("json");
-    if (!json) goto cleanup;
-
-    loads = PyObject_GetAttrString(json, "loads");
-    dumps = PyObject_GetAttrString(json, "dumps");
-
-    if (!loads || !dumps) goto cleanup;
+/* Parse a JSON row; NULL (error cleared) if it does not parse. */
+static PyObject* parse_row(HashJoin* hj, const char* row) {
+    PyObject* py_row = PyUnicode_DecodeUTF8(row, strlen(row), NULL);
+    PyObject* dict = py_row ? PyObject_CallOneArg(hj->loads, py_row) : NULL;
+    Py_XDECREF(py_row);
+    if (!dict || !PyDict_Check(dict)) {
+        PyErr_Clear();
+        Py_XDECREF(dict);
+        return NULL;
+    }
+    return dict;
+}
 
-    /* ---------- Build hash table ---------- */
-    HashEntry table[HASH_SIZE];
-    memset(table, 0, sizeof(table));
+/* str() of the row's key, new reference; NULL if the row has no such key. */
+static PyObject* row_key(PyObject* dict, const char* key) {
+    PyObject* key_obj = PyDict_GetItemString(dict, key);
+    if (!key_obj) return NULL;
+    PyObject* key_str = PyObject_Str(key_obj);
+    if (!key_str) PyErr_Clear();
+    return key_str;
+}
 
-    for (size_t i = 0; i < inner_count; i++) {
-        PyObject* py_row = PyUnicode_DecodeUTF8(inner_rows[i], strlen(inner_rows[i]), NULL);
-        PyObject* row_dict = PyObject_CallOneArg(loads, py_row);
-        Py_DECREF(py_row);
+static HashEntry* find_slot(HashJoin* hj, const char* key) {
+    size_t mask = hj->nslots - 1;
+    size_t idx = hash_str(key) & mask;
+    while (hj->slots[idx].key != NULL && strcmp(hj->slots[idx].key, key) != 0)
+        idx = (idx + 1) & mask;
+    return &hj->slots[idx];
+}
 
-        if (!row_dict) {
-            fprintf(stderr, "[BUILD] Failed to parse inner row: %s\n", inner_rows[i]);
-            continue;
-        }
+static void free_join(HashJoin* hj) {
+    for (size_t i = 0; hj->slots && i < hj->nslots; i++) {
+        free(hj->slots[i].key);
+        for (size_t j = 0; j < hj->slots[i].count; j++)
+            Py_DECREF(hj->slots[i].rows[j]);
+        free(hj->slots[i].rows);
+    }
+    free(hj->slots);
+    Py_XDECREF(hj->loads);
+    Py_XDECREF(hj->dumps);
+    free(hj);
+}
 
-        PyObject* key_obj = PyDict_GetItemString(row_dict, inner_key);
-        if (!key_obj) {
-            fprintf(stderr, "[BUILD] Key '%s' not found in row: %s\n", inner_key, inner_rows[i]);
-            Py_DECREF(row_dict);
-            continue;
+/* =========================
+   Build
+   Returns the join handle, or NULL if a build row does not parse or
+   memory runs out. Rows without the key cannot match and are skipped.
+   ========================= */
+void* hj_build(const char** rows, size_t count, const char* key) {
+    PyGILState_STATE gstate = PyGILState_Ensure();
+    HashJoin* hj = calloc(1, sizeof(HashJoin));
+    PyObject* json = PyImport_ImportModule("json");
+    if (!hj || !json) goto fail;
+    hj->loads = PyObject_GetAttrString(json, "loads");
+    hj->dumps = PyObject_GetAttrString(json, "dumps");
+    hj->nslots = slots_for(count);
+    hj->slots = calloc(hj->nslots, sizeof(HashEntry));
+    if (!hj->loads || !hj->dumps || !hj->slots) goto fail;
+
+    for (size_t i = 0; i < count; i++) {
+        PyObject* dict = parse_row(hj, rows[i]);
+        if (!dict) {
+            fprintf(stderr, "[BUILD] Failed to parse inner row: %s\n", rows[i]);
+            goto fail;
         }
-
-        PyObject* key_str = PyObject_Str(key_obj);
-        const char* key_cstr = PyUnicode_AsUTF8(key_str);
+        PyObject* key_str = row_key(dict, key);
+        const char* key_cstr = key_str ? PyUnicode_AsUTF8(key_str) : NULL;
         if (!key_cstr) {
-            fprintf(stderr, "[BUILD] Failed to convert key to string\n");
-            Py_DECREF(key_str);
-            Py_DECREF(row_dict);
+            Py_XDECREF(key_str);
+            Py_DECREF(dict);
             continue;
         }
 
-        unsigned long idx = hash_str(key_cstr) % HASH_SIZE;
-        unsigned long start = idx;
-
-        // Linear probing to find slot
-        while (table[idx].key != NULL) {
-            if (strcmp(table[idx].key, key_cstr) == 0) {
-                break;
-            }
-            idx = (idx + 1) % HASH_SIZE;
-            if (idx == start) {
-                fprintf(stderr, "[BUILD] Hash table full!\n");
-                Py_DECREF(key_str);
-                Py_DECREF(row_dict);
-                goto cleanup;
-            }
+        HashEntry* e = find_slot(hj, key_cstr);
+        if (e->key == NULL) {
+            e->rows = malloc(sizeof(PyObject*) * INIT_CAP);
+            e->key = e->rows ? strdup_safe(key_cstr) : NULL;
+            e->cap = INIT_CAP;
+            e->count = 0;
         }
-
-        if (table[idx].key == NULL) {
-            table[idx].key = strdup_safe(key_cstr);
-            table[idx].rows = malloc(sizeof(char*) * INIT_CAP);
-            table[idx].cap = INIT_CAP;
-            table[idx].count = 0;
+        Py_DECREF(key_str);
+        if (e->key && e->count == e->cap) {
+            PyObject** grown = realloc(e->rows, sizeof(PyObject*) * e->cap * 2);
+            if (grown) {
+                e->rows = grown;
+                e->cap *= 2;
+            }
         }
-
-        if (table[idx].count == table[idx].cap) {
-            table[idx].cap *= 2;
-            table[idx].rows = realloc(
-                table[idx].rows,
-                sizeof(char*) * table[idx].cap
-            );
+        if (!e->key || e->count == e->cap) {
+            Py_DECREF(dict);
+            goto fail;
         }
+        e->rows[e->count++] = dict;
+    }
+    Py_DECREF(json);
+    PyGILState_Release(gstate);
+    return hj;
 
-        table[idx].rows[table[idx].count++] =
-            strdup_safe(inner_rows[i]);
-
-        fprintf(stderr, "[BUILD] Stored key='%s' (row: %s)\n", key_cstr, inner_rows[i]);
+fail:
+    PyErr_Clear();
+    if (hj) free_join(hj);
+    Py_XDECREF(json);
+    PyGILState_Release(gstate);
+    return NULL;
+}
 
-        Py_DECREF(key_str);
-        Py_DECREF(row_dict);
-    }
+void hj_free(void* handle) {
+    if (!handle) return;
+    PyGILState_STATE gstate = PyGILState_Ensure();
+    free_join((HashJoin*)handle);
+    PyGILState_Release(gstate);
+}
 
-    /* ---------- Probe phase ---------- */
-    for (size_t i = 0; i < outer_count; i++) {
-        PyObject* py_row = PyUnicode_DecodeUTF8(outer_rows[i], strlen(outer_rows[i]), NULL);
-        PyObject* outer_dict = PyObject_CallOneArg(loads, py_row);
-        Py_DECREF(py_row);
+/* =========================
+   Probe
+   Writes the merged rows of outer rows, NUL-terminated, to out and
+   returns the bytes used, or -1 on error. It stops before an outer row
+   whose matches do not fit: *consumed is the outer rows done, and *need
+   the bytes that row's matches take, so the caller can hand the rest to
+   a large enough buffer. Nothing is dropped.
+   build_overrides: on column clashes keep the inner (build) row's value
+   instead of the outer's, so callers can pick either build side.
+   ========================= */
+long long hj_probe(void* handle, const char** rows, size_t count, const char* key,
+                   int build_overrides, char* out, size_t out_size,
+                   size_t* consumed, size_t* need) {
+    HashJoin* hj = (HashJoin*)handle;
+    long long result = -1;
+    size_t out_pos = 0;
+    size_t i = 0;
+    PyObject* matches = NULL;
+    *need = 0;
 
+    PyGILState_STATE gstate = PyGILState_Ensure();
+    for (; i < count; i++) {
+        PyObject* outer_dict = parse_row(hj, rows[i]);
         if (!outer_dict) {
-            fprintf(stderr, "[PROBE] Failed to parse outer row: %s\n", outer_rows[i]);
-            continue;
-        }
-
-        PyObject* key_obj = PyDict_GetItemString(outer_dict, outer_key);
-        if (!key_obj) {
-            fprintf(stderr, "[PROBE] Key '%s' not found in row: %s\n", outer_key, outer_rows[i]);
-            Py_DECREF(outer_dict);
-            continue;
+            fprintf(stderr, "[PROBE] Failed to parse outer row: %s\n", rows[i]);
+            goto done;
         }
-
-        PyObject* key_str = PyObject_Str(key_obj);
-        const char* key_cstr = PyUnicode_AsUTF8(key_str);
-        if (!key_cstr) {
-            fprintf(stderr, "[PROBE] Failed to convert key to string\n");
-            Py_DECREF(key_str);
+        PyObject* key_str = row_key(outer_dict, key);
+        const char* key_cstr = key_str ? PyUnicode_AsUTF8(key_str) : NULL;
+        HashEntry* e = key_cstr ? find_slot(hj, key_cstr) : NULL;
+        Py_XDECREF(key_str);
+        if (!e || !e->key) {
             Py_DECREF(outer_dict);
             continue;
         }
 
-        unsigned long idx = hash_str(key_cstr) % HASH_SIZE;
-        unsigned long start = idx;
-
-        fprintf(stderr, "[PROBE] Looking for key='%s' (hash=%lu)\n", key_cstr, idx);
-
-        // Linear probing to find matching key
-        bool found = false;
-        while (table[idx].key != NULL) {
-            if (strcmp(table[idx].key, key_cstr) == 0) {
-                fprintf(stderr, "[MATCH] Found %zu rows for key='%s'\n", table[idx].count, key_cstr);
-                for (size_t j = 0; j < table[idx].count; j++) {
-                    PyObject* inner_py = PyUnicode_DecodeUTF8(table[idx].rows[j], strlen(table[idx].rows[j]), NULL);
-                    PyObject* inner_dict = PyObject_CallOneArg(loads, inner_py);
-                    Py_DECREF(inner_py);
-
-                    if (!inner_dict) continue;
-
-                    PyObject* merged = PyDict_Copy(inner_dict);
-                    PyDict_Update(merged, outer_dict);
-
-                    PyObject* dumped = PyObject_CallOneArg(dumps, merged);
-                    if (dumped) {
-                        const char* out = PyUnicode_AsUTF8(dumped);
-                        if (out) {
-                            size_t len = strlen(out) + 1;
-                            if (out_pos + len <= output_buf_size) {
-                                memcpy(output_buf + out_pos, out, len);
-                                out_pos += len;
-                                result_count++;
-                                fprintf(stderr, "[OUTPUT] Wrote: %s\n", out);
-                            }
-                        }
-                        Py_DECREF(dumped);
-                    }
-
-                    Py_DECREF(merged);
-                    Py_DECREF(inner_dict);
-                }
-                found = true;
+        /* All of this row's output first, so it goes out whole or not at all */
+        matches = PyList_New(0);
+        size_t bytes = 0;
+        for (size_t j = 0; matches && j < e->count; j++) {
+            PyObject* merged = PyDict_Copy(build_overrides ? outer_dict : e->rows[j]);
+            if (!merged || PyDict_Update(merged, build_overrides ? e->rows[j] : outer_dict) < 0) {
+                Py_XDECREF(merged);
+                Py_CLEAR(matches);
                 break;
             }
-            idx = (idx + 1) % HASH_SIZE;
-            if (idx == start) break;
-        }
-
-        if (!found) {
-            fprintf(stderr, "[PROBE] No match for key='%s'\n", key_cstr);
+            PyObject* dumped = PyObject_CallOneArg(hj->dumps, merged);
+            Py_DECREF(merged);
+            Py_ssize_t len = 0;
+            if (!dumped || !PyUnicode_AsUTF8AndSize(dumped, &len) || PyList_Append(matches, dumped) < 0) {
+                Py_XDECREF(dumped);
+                Py_CLEAR(matches);
+                break;
+            }
+            Py_DECREF(dumped);
+            bytes += (size_t)len + 1;
         }
-
-        Py_DECREF(key_str);
         Py_DECREF(outer_dict);
-    }
+        if (!matches) goto done;
 
-cleanup:
-    /* ---------- Cleanup hash table ---------- */
-    for (int i = 0; i < HASH_SIZE; i++) {
-        if (table[i].key) {
-            free(table[i].key);
-            for (size_t j = 0; j < table[i].count; j++) {
-                free(table[i].rows[j]);
-            }
-            free(table[i].rows);
+        if (out_pos + bytes > out_size) {
+            *need = bytes;
+            Py_CLEAR(matches);
+            break;
+        }
+        for (Py_ssize_t j = 0; j < PyList_GET_SIZE(matches); j++) {
+            Py_ssize_t len;
+            const char* s = PyUnicode_AsUTF8AndSize(PyList_GET_ITEM(matches, j), &len);
+            memcpy(out + out_pos, s, (size_t)len + 1);
+            out_pos += (size_t)len + 1;
         }
+        Py_CLEAR(matches);
     }
+    result = (long long)out_pos;
 
-    Py_XDECREF(loads);
-    Py_XDECREF(dumps);
-    Py_XDECREF(json);
-
+done:
+    PyErr_Clear();
+    *consumed = i;
     PyGILState_Release(gstate);
-    return (int)result_count;
+    return result;
+}
+
+/* =========================
+   One-shot Hash Join
+   Returns the rows written, or -1 if the join could not run or its
+   output does not fit output_buf.
+   ========================= */
+static int hash_join_impl(
+    const char** inner_rows,
+    size_t inner_count,
+    const char** outer_rows,
+    size_t outer_count,
+    const char* inner_key,
+    const char* outer_key,
+    char* output_buf,
+    size_t output_buf_size,
+    bool build_overrides
+) {
+    void* hj = hj_build(inner_rows, inner_count, inner_key);
+    if (!hj) return -1;
+    size_t consumed, need;
+    long long used = hj_probe(hj, outer_rows, outer_count, outer_key, build_overrides,
+                              output_buf, output_buf_size, &consumed, &need);
+    hj_free(hj);
+    if (used < 0 || consumed < outer_count) return -1;
+
+    int result_count = 0;
+    for (long long pos = 0; pos < used; pos++)
+        if (output_buf[pos] == '\0') result_count++;
+    return result_count;
+}
+
+int hash_join(
+    const char** inner_rows,
+    size_t inner_count,
+    const char** outer_rows,
+    size_t outer_count,
+    const char* inner_key,
+    const char* outer_key,
+    char* output_buf,
+    size_t output_buf_size
+) {
+    return hash_join_impl(inner_rows, inner_count, outer_rows, outer_count,
+                          inner_key, outer_key, output_buf, output_buf_size, false);
+}
+
+int hash_join_build_overrides(
+    const char** inner_rows,
+    size_t inner_count,
+    const char** outer_rows,
+    size_t outer_count,
+    const char* inner_key,
+    const char* outer_key,
+    char* output_buf,
+    size_t output_buf_size
+) {
+    return hash_join_impl(inner_rows, inner_count, outer_rows, outer_count,
+                          inner_key, outer_key, output_buf, output_buf_size, true);
 }
@@ -0,0 +1,375 @@
+// taskpool.c — shared work-stealing thread pool
+//
+// Everything in libwaldb that runs in parallel (vectorized scan and
+// aggregate workers, background checkpoints) is submitted here as a task
+// instead of spawning its own threads. Each pool worker owns one deque per
+// priority level: it pushes and pops its own tasks at the bottom (LIFO,
+// cache-warm) while idle workers steal from the top of other workers'
+// deques (FIFO, oldest first). Tasks submitted from outside the pool go
+// to a shared injection queue. A worker always looks for higher-priority
+// work first, so foreground query tasks overtake queued checkpoints.
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "waldb.h"
+
+#define POOL_MAX_WORKERS 64
+#define DEQUE_INIT_CAP 64
+
+/* ================= TYPES ================= */
+typedef struct {
+    waldb_task_fn fn;
+    void* arg;
+    WaldbTaskGroup* group;
+    int priority;
+    uint64_t enqueued_ns;
+} Task;
+
+/* Ring buffer: live tasks are [head, tail). Owners push/pop at the tail,
+ * thieves and the injection queue take from the head. */
+typedef struct {
+    pthread_mutex_t mu;
+    Task* buf;
+    size_t cap;
+    size_t head;
+    size_t tail;
+} Deque;
+
+struct WaldbTaskGroup {
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    size_t pending;
+};
+
+typedef struct {
+    int id;
+    pthread_t thread;
+    Deque deques[WALDB_PRIO_LEVELS];
+    unsigned rng;
+} PoolWorker;
+
+static struct {
+    PoolWorker workers[POOL_MAX_WORKERS];
+    int nworkers;
+    Deque inject[WALDB_PRIO_LEVELS];
+    atomic_bool running;
+    bool stopping;
+
+    /* idle workers sleep here until something is queued */
+    pthread_mutex_t idle_mu;
+    pthread_cond_t idle_cv;
+    atomic_size_t queued;
+
+    /* stats */
+    atomic_uint_fast64_t submitted[WALDB_PRIO_LEVELS];
+    atomic_uint_fast64_t executed[WALDB_PRIO_LEVELS];
+    atomic_uint_fast64_t wait_ns[WALDB_PRIO_LEVELS];
+    atomic_uint_fast64_t max_wait_ns;
+    atomic_uint_fast64_t steals;
+    atomic_uint_fast64_t steal_attempts;
+} pool = {
+    .idle_mu = PTHREAD_MUTEX_INITIALIZER,
+    .idle_cv = PTHREAD_COND_INITIALIZER,
+};
+
+/* Serializes start/stop. */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local PoolWorker* current_worker = NULL;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* ================= DEQUE ================= */
+static void deque_init(Deque* d) {
+    pthread_mutex_init(&d->mu, NULL);
+    d->buf = malloc(sizeof(Task) * DEQUE_INIT_CAP);
+    d->cap = DEQUE_INIT_CAP;
+    d->head = d->tail = 0;
+}
+
+static void deque_destroy(Deque* d) {
+    free(d->buf);
+    d->buf = NULL;
+    pthread_mutex_destroy(&d->mu);
+}
+
+static void deque_push(Deque* d, const Task* t) {
+    pthread_mutex_lock(&d->mu);
+    if (d->tail - d->head == d->cap) {
+        Task* nb = malloc(sizeof(Task) * d->cap * 2);
+        for (size_t i = d->head; i < d->tail; i++) nb[i - d->head] = d->buf[i % d->cap];
+        free(d->buf);
+        d->buf = nb;
+        d->tail -= d->head;
+        d->head = 0;
+        d->cap *= 2;
+    }
+    d->buf[d->tail % d->cap] = *t;
+    d->tail++;
+    pthread_mutex_unlock(&d->mu);
+}
+
+static bool deque_pop_bottom(Deque* d, Task* out) {
+    bool ok = false;
+    pthread_mutex_lock(&d->mu);
+    if (d->tail > d->head) {
+        d->tail--;
+        *out = d->buf[d->tail % d->cap];
+        ok = true;
+    }
+    pthread_mutex_unlock(&d->mu);
+    return ok;
+}
+
+static bool deque_take_top(Deque* d, Task* out) {
+    bool ok = false;
+    pthread_mutex_lock(&d->mu);
+    if (d->tail > d->head) {
+        *out = d->buf[d->head % d->cap];
+        d->head++;
+        ok = true;
+    }
+    pthread_mutex_unlock(&d->mu);
+    return ok;
+}
+
+/* ================= SCHEDULING ================= */
+static bool find_task(PoolWorker* self, Task* out) {
+    for (int p = 0; p < WALDB_PRIO_LEVELS; p++) {
+        if (self && deque_pop_bottom(&self->deques[p], out)) goto found;
+        if (deque_take_top(&pool.inject[p], out)) goto found;
+
+        int n = pool.nworkers;
+        if (n == 0) continue;
+        int start = self ? (int)(rand_r(&self->rng) % (unsigned)n) : 0;
+        for (int k = 0; k < n; k++) {
+            PoolWorker* victim = &pool.workers[(start + k) % n];
+            if (victim == self) continue;
+            atomic_fetch_add(&pool.steal_attempts, 1);
+            if (deque_take_top(&victim->deques[p], out)) {
+                atomic_fetch_add(&pool.steals, 1);
+                goto found;
+            }
+        }
+    }
+    return false;
+
+found:
+    atomic_fetch_sub(&pool.queued, 1);
+    return true;
+}
+
+static void run_task(Task* t) {
+    uint64_t waited = now_ns() - t->enqueued_ns;
+    atomic_fetch_add(&pool.wait_ns[t->priority], waited);
+    uint64_t prev = atomic_load(&pool.max_wait_ns);
+    while (waited > prev && !atomic_compare_exchange_weak(&pool.max_wait_ns, &prev, waited)) {}
+
+    t->fn(t->arg);
+    atomic_fetch_add(&pool.executed[t->priority], 1);
+
+    WaldbTaskGroup* g = t->group;
+    if (g) {
+        pthread_mutex_lock(&g->mu);
+        if (--g->pending == 0) pthread_cond_broadcast(&g->cv);
+        pthread_mutex_unlock(&g->mu);
+    }
+}
+
+static void* worker_main(void* arg) {
+    PoolWorker* self = arg;
+    current_worker = self;
+    for (;;) {
+        Task t;
+        if (find_task(self, &t)) {
+            run_task(&t);
+            continue;
+        }
+        pthread_mutex_lock(&pool.idle_mu);
+        while (atomic_load(&pool.queued) == 0 && !pool.stopping) {
+            pthread_cond_wait(&pool.idle_cv, &pool.idle_mu);
+        }
+        bool exit_now = pool.stopping && atomic_load(&pool.queued) == 0;
+        pthread_mutex_unlock(&pool.idle_mu);
+        if (exit_now) break;
+    }
+    current_worker = NULL;
+    return NULL;
+}
+
+/* ================= LIFECYCLE ================= */
+static int default_workers(void) {
+    const char* env = getenv("WALDB_WORKERS");
+    long n = env ? strtol(env, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static void pool_start_locked(int nworkers) {
+    if (nworkers <= 0) nworkers = default_workers();
+    if (nworkers > POOL_MAX_WORKERS) nworkers = POOL_MAX_WORKERS;
+
+    for (int p = 0; p < WALDB_PRIO_LEVELS; p++) deque_init(&pool.inject[p]);
+    pool.stopping = false;
+    pool.nworkers = nworkers;
+    for (int i = 0; i < nworkers; i++) {
+        PoolWorker* w = &pool.workers[i];
+        w->id = i;
+        w->rng = 0x9E3779B9u * (unsigned)(i + 1);
+        for (int p = 0; p < WALDB_PRIO_LEVELS; p++) deque_init(&w->deques[p]);
+    }
+    /* deques exist before any worker can try to steal from them */
+    for (int i = 0; i < nworkers; i++) {
+        pthread_create(&pool.workers[i].thread, NULL, worker_main, &pool.workers[i]);
+    }
+    pool.running = true;
+}
+
+/* Drains every queued task, then joins the workers. */
+static void pool_stop_locked(void) {
+    if (!pool.running) return;
+    pthread_mutex_lock(&pool.idle_mu);
+    pool.stopping = true;
+    pthread_cond_broadcast(&pool.idle_cv);
+    pthread_mutex_unlock(&pool.idle_mu);
+    for (int i = 0; i < pool.nworkers; i++) pthread_join(pool.workers[i].thread, NULL);
+    for (int i = 0; i < pool.nworkers; i++) {
+        for (int p = 0; p < WALDB_PRIO_LEVELS; p++) deque_destroy(&pool.workers[i].deques[p]);
+    }
+    for (int p = 0; p < WALDB_PRIO_LEVELS; p++) deque_destroy(&pool.inject[p]);
+    pool.nworkers = 0;
+    pool.running = false;
+}
+
+static void ensure_started(void) {
+    if (pool.running) return;
+    pthread_mutex_lock(&pool_lock);
+    if (!pool.running) pool_start_locked(0);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/* ================= PUBLIC API ================= */
+int waldb_pool_start(int nworkers) {
+    if (current_worker) return pool.nworkers;  /* cannot resize from inside */
+    pthread_mutex_lock(&pool_lock);
+    int want = nworkers > 0 ? nworkers : default_workers();
+    if (want > POOL_MAX_WORKERS) want = POOL_MAX_WORKERS;
+    if (pool.running && pool.nworkers != want) pool_stop_locked();
+    if (!pool.running) pool_start_locked(want);
+    int n = pool.nworkers;
+    pthread_mutex_unlock(&pool_lock);
+    return n;
+}
+
+void waldb_pool_stop(void) {
+    if (current_worker) return;
+    pthread_mutex_lock(&pool_lock);
+    pool_stop_locked();
+    pthread_mutex_unlock(&pool_lock);
+}
+
+int waldb_pool_size(void) {
+    ensure_started();
+    return pool.nworkers;
+}
+
+WaldbTaskGroup* waldb_group_new(void) {
+    WaldbTaskGroup* g = calloc(1, sizeof(WaldbTaskGroup));
+    pthread_mutex_init(&g->mu, NULL);
+    pthread_cond_init(&g->cv, NULL);
+    return g;
+}
+
+void waldb_spawn(WaldbTaskGroup* group, int priority, waldb_task_fn fn, void* arg) {
+    ensure_started();
+    if (priority < 0) priority = 0;
+    if (priority >= WALDB_PRIO_LEVELS) priority = WALDB_PRIO_LEVELS - 1;
+
+    if (group) {
+        pthread_mutex_lock(&group->mu);
+        group->pending++;
+        pthread_mutex_unlock(&group->mu);
+    }
+    Task t = { fn, arg, group, priority, now_ns() };
+    PoolWorker* self = current_worker;
+    /* Count it before publishing it: a worker may take it and decrement
+     * queued as soon as it is in a deque. */
+    atomic_fetch_add(&pool.queued, 1);
+    deque_push(self ? &self->deques[priority] : &pool.inject[priority], &t);
+    atomic_fetch_add(&pool.submitted[priority], 1);
+
+    pthread_mutex_lock(&pool.idle_mu);
+    pthread_cond_signal(&pool.idle_cv);
+    pthread_mutex_unlock(&pool.idle_mu);
+}
+
+/* Waits for every task spawned in the group. A pool worker keeps running
+ * other tasks while it waits, so nested parallelism cannot deadlock. */
+void waldb_group_wait(WaldbTaskGroup* group) {
+    PoolWorker* self = current_worker;
+    pthread_mutex_lock(&group->mu);
+    while (group->pending > 0) {
+        if (self) {
+            pthread_mutex_unlock(&group->mu);
+            Task t;
+            if (find_task(self, &t)) {
+                run_task(&t);
+            } else {
+                sched_yield();
+            }
+            pthread_mutex_lock(&group->mu);
+        } else {
+            pthread_cond_wait(&group->cv, &group->mu);
+        }
+    }
+    pthread_mutex_unlock(&group->mu);
+}
+
+void waldb_group_free(WaldbTaskGroup* group) {
+    if (!group) return;
+    pthread_cond_destroy(&group->cv);
+    pthread_mutex_destroy(&group->mu);
+    free(group);
+}
+
+void waldb_pool_stats(WaldbPoolStats* out) {
+    memset(out, 0, sizeof(*out));
+    out->workers = (uint64_t)pool.nworkers;
+    out->queued = atomic_load(&pool.queued);
+    for (int p = 0; p < WALDB_PRIO_LEVELS; p++) {
+        out->submitted[p] = atomic_load(&pool.submitted[p]);
+        out->executed[p] = atomic_load(&pool.executed[p]);
+        out->wait_ns[p] = atomic_load(&pool.wait_ns[p]);
+    }
+    out->max_wait_ns = atomic_load(&pool.max_wait_ns);
+    out->steals = atomic_load(&pool.steals);
+    out->steal_attempts = atomic_load(&pool.steal_attempts);
+}
+
+static void checkpoint_task(void* arg) {
+    (void)arg;
+    waldb_checkpoint();
+}
+
+void waldb_checkpoint_async(void) {
+    waldb_spawn(NULL, WALDB_PRIO_BACKGROUND, checkpoint_task, NULL);
+}
+
+/* =============== PYTHON-FRIENDLY EXPORTS =============== */
+int pool_start(int nworkers) {
+    return waldb_pool_start(nworkers);
+}
+
+void pool_stats(WaldbPoolStats* out) {
+    if (out) waldb_pool_stats(out);
+}
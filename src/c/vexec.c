@@ -0,0 +1,1173 @@
+// vexec.c — vectorized batch execution engine
+//
+// Python submits a small plan (table, needed columns, filters, projection
+// or grouped aggregates, page list) and pulls result batches back. Inside,
+// rows are decoded from their JSON pages into column vectors of up to
+// VX_BATCH values; filters, gathers and hashing then run as flat loops
+// over those vectors that the compiler can auto-vectorize. Columnar (PAX)
+// pages are decoded straight from their per-column arrays instead.
+//
+// A plan can also be split across the shared task pool (taskpool.c): each
+// worker task gets a contiguous slice of the page list and a private copy
+// of the plan that shares the parent's read snapshot. Scan workers hand
+// finished batches back through small per-worker queues (consumed in page
+// order or as they arrive) and park instead of blocking a pool thread when
+// their queue is full; aggregate workers build partial group tables that
+// the parent merges.
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "waldb.h"
+
+#define VX_BATCH 1024
+#define VX_MAX_COLS 16
+#define VX_MAX_FILTERS 16
+#define VX_MAX_AGGS 8
+#define VX_NAME_MAX 64
+#define VX_QUEUE_DEPTH 4   /* batches a scan worker may run ahead */
+
+/* PAX pages: see src/python/columnar.py for the layout */
+#define PAX_MAGIC "PAX1"
+#define PAX_MAX_ROWS 256
+#define PAX_NO_ROOM ((size_t)-1)
+#define PAX_CODE 2  /* u32 codes into a table-wide dictionary */
+
+enum { VX_INT = 0, VX_TEXT = 1 };
+enum { VX_EQ = 0, VX_LT = 1, VX_LE = 2, VX_GT = 3, VX_GE = 4 };
+enum { VX_COUNT = 0, VX_SUM = 1, VX_MIN = 2, VX_MAX = 3 };
+
+/* ================= TYPES ================= */
+typedef struct {
+    char name[VX_NAME_MAX];
+    int type;
+    /* decoded values for the current input batch */
+    int64_t ints[VX_BATCH];
+    uint8_t nulls[VX_BATCH];
+    uint32_t off[VX_BATCH];
+    uint32_t len[VX_BATCH];
+    /* table-wide dictionary: the column stores codes, ints[] holds the
+     * code and off/len point at the entry in the arena prefix */
+    bool dict;
+    uint32_t* dict_off;
+    uint32_t* dict_len;
+    size_t dict_n;
+} VxColumn;
+
+typedef struct {
+    int col;
+    int op;
+    int64_t ival;
+    char* sval;
+    size_t slen;
+    bool on_codes;  /* EQ on a dictionary column: compare codes */
+} VxFilter;
+
+typedef struct {
+    int func;
+    int col;  /* -1 for COUNT(*) */
+} VxAgg;
+
+typedef struct {
+    uint64_t hash;
+    int64_t ikey;
+    char* skey;
+    uint32_t slen;
+    bool key_null;
+    int64_t acc[VX_MAX_AGGS];
+    int64_t cnt[VX_MAX_AGGS];
+    bool used;
+} VxGroup;
+
+/* A result batch copied out of a worker plan. */
+typedef struct VxOutBatch {
+    size_t n;
+    int64_t* ints;        /* nout * n */
+    uint8_t* nulls;       /* nout * n */
+    uint32_t* off;        /* nout * n, TEXT outputs only */
+    uint32_t* len;
+    char* arena;
+    struct VxOutBatch* next;
+} VxOutBatch;
+
+struct VxPlan;
+
+typedef struct {
+    struct VxPlan* plan;  /* private plan over this worker's page slice */
+    VxOutBatch* head;
+    VxOutBatch* tail;
+    size_t queued;
+    bool parked;          /* queue was full; consumer re-spawns the task */
+    bool done;
+} VxWorker;
+
+typedef struct VxPlan {
+    char table[VX_NAME_MAX];
+    ReaderTxn snap;
+    bool owns_snap;       /* false in worker clones, which borrow the parent's */
+
+    VxColumn cols[VX_MAX_COLS];
+    int ncols;
+    VxFilter filters[VX_MAX_FILTERS];
+    int nfilters;
+    int outputs[VX_MAX_COLS];
+    int nout;
+
+    /* aggregation */
+    int group_col;  /* -1: no GROUP BY */
+    VxAgg aggs[VX_MAX_AGGS];
+    int naggs;
+    VxGroup* groups;
+    size_t group_cap;
+    size_t group_count;
+    bool agg_done;
+
+    /* input */
+    uint32_t* pages;
+    size_t npages;
+    size_t next_page;
+    uint32_t page_size;           /* of the open database */
+    uint8_t* page;                /* page_size bytes, read into by load_batch */
+
+    /* current batch */
+    size_t nrows;                 /* decoded rows */
+    uint32_t sel[VX_BATCH];       /* selected row positions */
+    size_t nsel;
+    uint8_t mask[VX_BATCH];
+    char* arena;                  /* text bytes for the batch */
+    size_t arena_base;            /* dictionary entries, kept across batches */
+    size_t arena_len;
+    size_t arena_cap;
+
+    /* output batch */
+    int64_t out_ints[VX_MAX_COLS + VX_MAX_AGGS][VX_BATCH];
+    uint8_t out_nulls[VX_MAX_COLS + VX_MAX_AGGS][VX_BATCH];
+    size_t out_rows;
+    size_t emit_pos;              /* next group to emit */
+
+    /* parallel execution (parent side) */
+    int nworkers;
+    bool ordered;
+    bool started;
+    atomic_bool cancel;
+    VxWorker* workers;
+    WaldbTaskGroup* group;        /* the worker tasks on the shared pool */
+    int cur_worker;
+    VxOutBatch* cur;              /* batch currently exposed to the caller */
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    struct VxPlan* parent;        /* set on worker plans */
+} VxPlan;
+
+/* ================= JSON ROW DECODER =================
+ * Rows are flat JSON objects written by json.dumps: string keys, values
+ * that are strings, integers, true/false/null. Anything nested is skipped.
+ */
+static const char* skip_ws(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    return p;
+}
+
+static void arena_put(VxPlan* pl, const char* s, size_t n) {
+    if (pl->arena_len + n > pl->arena_cap) {
+        size_t cap = pl->arena_cap ? pl->arena_cap : 64 * 1024;
+        while (cap < pl->arena_len + n) cap *= 2;
+        pl->arena = realloc(pl->arena, cap);
+        pl->arena_cap = cap;
+    }
+    memcpy(pl->arena + pl->arena_len, s, n);
+    pl->arena_len += n;
+}
+
+static void put_utf8(VxPlan* pl, uint32_t cp) {
+    char b[4];
+    size_t n;
+    if (cp < 0x80) { b[0] = (char)cp; n = 1; }
+    else if (cp < 0x800) { b[0] = (char)(0xC0 | (cp >> 6)); b[1] = (char)(0x80 | (cp & 0x3F)); n = 2; }
+    else if (cp < 0x10000) {
+        b[0] = (char)(0xE0 | (cp >> 12)); b[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        b[2] = (char)(0x80 | (cp & 0x3F)); n = 3;
+    } else {
+        b[0] = (char)(0xF0 | (cp >> 18)); b[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        b[2] = (char)(0x80 | ((cp >> 6) & 0x3F)); b[3] = (char)(0x80 | (cp & 0x3F)); n = 4;
+    }
+    arena_put(pl, b, n);
+}
+
+static uint32_t hex4(const char* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9') v |= (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f') v |= (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') v |= (uint32_t)(c - 'A' + 10);
+    }
+    return v;
+}
+
+/* Decode a JSON string starting after the opening quote into the arena.
+ * Returns the position after the closing quote, or NULL on error. */
+static const char* decode_string(VxPlan* pl, const char* p, const char* end) {
+    while (p < end && *p != '"') {
+        const char* run = p;
+        while (p < end && *p != '"' && *p != '\\') p++;
+        if (p > run) arena_put(pl, run, (size_t)(p - run));
+        if (p < end && *p == '\\') {
+            if (p + 1 >= end) return NULL;
+            char e = p[1];
+            p += 2;
+            switch (e) {
+                case 'n': arena_put(pl, "\n", 1); break;
+                case 't': arena_put(pl, "\t", 1); break;
+                case 'r': arena_put(pl, "\r", 1); break;
+                case 'b': arena_put(pl, "\b", 1); break;
+                case 'f': arena_put(pl, "\f", 1); break;
+                case 'u': {
+                    if (p + 4 > end) return NULL;
+                    uint32_t cp = hex4(p);
+                    p += 4;
+                    if (cp >= 0xD800 && cp < 0xDC00 && p + 6 <= end && p[0] == '\\' && p[1] == 'u') {
+                        uint32_t lo = hex4(p + 2);
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                        p += 6;
+                    }
+                    put_utf8(pl, cp);
+                    break;
+                }
+                default: arena_put(pl, &e, 1); break;
+            }
+        }
+    }
+    return p < end ? p + 1 : NULL;
+}
+
+static const char* skip_value(const char* p, const char* end) {
+    int depth = 0;
+    bool in_str = false;
+    for (; p < end; p++) {
+        char c = *p;
+        if (in_str) {
+            if (c == '\\') p++;
+            else if (c == '"') in_str = false;
+            continue;
+        }
+        if (c == '"') in_str = true;
+        else if (c == '{' || c == '[') depth++;
+        else if (c == '}' || c == ']') {
+            if (depth == 0) return p;
+            depth--;
+            if (depth == 0) return p + 1;
+        } else if (c == ',' && depth == 0) return p;
+    }
+    return p;
+}
+
+/* Decode one page into row slot r. Returns false if the page is not a
+ * live row of the plan's table. */
+static bool decode_row(VxPlan* pl, const char* page, size_t r) {
+    const char* end = memchr(page, 0, pl->page_size);
+    if (!end) end = page + pl->page_size;
+    const char* p = skip_ws(page, end);
+    if (p >= end || *p != '{') return false;
+    p++;
+
+    size_t arena_mark = pl->arena_len;
+    bool table_ok = false;
+    for (int c = 0; c < pl->ncols; c++) pl->cols[c].nulls[r] = 1;
+
+    while (p < end) {
+        p = skip_ws(p, end);
+        if (p < end && *p == '}') break;
+        if (p >= end || *p != '"') goto bad;
+
+        /* key: column names are plain ASCII, compare in place */
+        const char* k = ++p;
+        while (p < end && *p != '"') { if (*p == '\\') p++; p++; }
+        if (p >= end) goto bad;
+        size_t klen = (size_t)(p - k);
+        p = skip_ws(p + 1, end);
+        if (p >= end || *p != ':') goto bad;
+        p = skip_ws(p + 1, end);
+        if (p >= end) goto bad;
+
+        if (klen == 9 && memcmp(k, "__table__", 9) == 0 && *p == '"') {
+            size_t mark = pl->arena_len;
+            p = decode_string(pl, p + 1, end);
+            if (!p) goto bad;
+            size_t n = pl->arena_len - mark;
+            table_ok = n == strlen(pl->table) && memcmp(pl->arena + mark, pl->table, n) == 0;
+            pl->arena_len = mark;
+        } else if (klen == 11 && memcmp(k, "__deleted__", 11) == 0) {
+            goto bad;
+        } else {
+            int col = -1;
+            for (int c = 0; c < pl->ncols; c++) {
+                if (strlen(pl->cols[c].name) == klen && memcmp(pl->cols[c].name, k, klen) == 0) {
+                    col = c;
+                    break;
+                }
+            }
+            if (col >= 0 && *p == '"' && pl->cols[col].type == VX_TEXT) {
+                size_t mark = pl->arena_len;
+                p = decode_string(pl, p + 1, end);
+                if (!p) goto bad;
+                pl->cols[col].off[r] = (uint32_t)mark;
+                pl->cols[col].len[r] = (uint32_t)(pl->arena_len - mark);
+                pl->cols[col].ints[r] = INT64_MIN;  /* no code: never matches */
+                pl->cols[col].nulls[r] = 0;
+            } else if (col >= 0 && *p >= '0' && *p <= '9' && pl->cols[col].dict) {
+                char* q;
+                VxColumn* vc = &pl->cols[col];
+                unsigned long long code = strtoull(p, &q, 10);
+                if (code < vc->dict_n) {
+                    vc->ints[r] = (int64_t)code;
+                    vc->off[r] = vc->dict_off[code];
+                    vc->len[r] = vc->dict_len[code];
+                    vc->nulls[r] = 0;
+                }
+                p = skip_value(q, end);
+            } else if (col >= 0 && (*p == '-' || (*p >= '0' && *p <= '9')) && pl->cols[col].type == VX_INT) {
+                char* q;
+                pl->cols[col].ints[r] = strtoll(p, &q, 10);
+                pl->cols[col].nulls[r] = 0;
+                p = skip_value(q, end);
+            } else {
+                p = skip_value(p, end);
+            }
+        }
+        p = skip_ws(p, end);
+        if (p < end && *p == ',') p++;
+    }
+    if (table_ok) return true;
+
+bad:
+    pl->arena_len = arena_mark;
+    return false;
+}
+
+/* ================= PAX PAGE DECODER =================
+ * Fills rows [base, base + live rows) from a columnar page. Only the plan's
+ * columns are touched; INT arrays of a page without deleted or NULL slots
+ * are copied straight into the column vector. Values are little-endian,
+ * like every supported host. Returns PAX_NO_ROOM if the page does not fit
+ * in the rest of the batch.
+ */
+static uint16_t rd16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static bool bit_at(const uint8_t* bm, size_t i) {
+    return (bm[i >> 3] >> (i & 7)) & 1;
+}
+
+static bool all_clear(const uint8_t* bm, size_t bytes) {
+    uint8_t any = 0;
+    for (size_t i = 0; i < bytes; i++) any |= bm[i];
+    return any == 0;
+}
+
+static size_t decode_pax(VxPlan* pl, const uint8_t* page, size_t base) {
+    const uint8_t* end = page + pl->page_size;
+    const uint8_t* p = page + 4;
+    size_t nlen = *p++;
+    if (nlen != strlen(pl->table) || memcmp(p, pl->table, nlen) != 0) return 0;
+    p += nlen;
+    size_t nrows = rd16(p), ncols = rd16(p + 2);
+    p += 4;
+    if (nrows > PAX_MAX_ROWS || p + 2 * ncols >= end) return 0;
+    if (base + nrows > VX_BATCH) return PAX_NO_ROOM;
+
+    const uint8_t* offsets = p;
+    const uint8_t* deleted = p + 2 * ncols;
+    size_t bm = (nrows + 7) / 8;
+
+    uint16_t slot[PAX_MAX_ROWS];
+    size_t nlive = 0;
+    for (size_t i = 0; i < nrows; i++) {
+        slot[nlive] = (uint16_t)i;
+        nlive += !bit_at(deleted, i);
+    }
+    bool dense = nlive == nrows;
+    for (int c = 0; c < pl->ncols; c++) memset(&pl->cols[c].nulls[base], 1, nlive);
+
+    for (size_t k = 0; k < ncols; k++) {
+        const uint8_t* b = page + rd16(offsets + 2 * k);
+        if (b >= end) return 0;
+        size_t clen = *b++;
+        int col = -1;
+        for (int c = 0; c < pl->ncols; c++) {
+            if (strlen(pl->cols[c].name) == clen && memcmp(pl->cols[c].name, b, clen) == 0) {
+                col = c;
+                break;
+            }
+        }
+        b += clen;
+        int type = *b++;
+        if (col < 0) continue;
+        if (type == PAX_CODE ? !pl->cols[col].dict : type != pl->cols[col].type) continue;
+
+        VxColumn* vc = &pl->cols[col];
+        const uint8_t* nulls = b;
+        b += bm;
+        if (type == PAX_CODE) {
+            if (b + 4 * nrows > end) return 0;
+            for (size_t i = 0; i < nlive; i++) {
+                uint32_t code;
+                memcpy(&code, b + 4 * (size_t)slot[i], 4);
+                bool null = bit_at(nulls, slot[i]) || code >= vc->dict_n;
+                vc->ints[base + i] = code;
+                vc->off[base + i] = null ? 0 : vc->dict_off[code];
+                vc->len[base + i] = null ? 0 : vc->dict_len[code];
+                vc->nulls[base + i] = null;
+            }
+        } else if (type == VX_INT) {
+            if (b + 8 * nrows > end) return 0;
+            if (dense && all_clear(nulls, bm)) {
+                memcpy(&vc->ints[base], b, 8 * nrows);
+                memset(&vc->nulls[base], 0, nrows);
+                continue;
+            }
+            for (size_t i = 0; i < nlive; i++) {
+                memcpy(&vc->ints[base + i], b + 8 * (size_t)slot[i], 8);
+                vc->nulls[base + i] = bit_at(nulls, slot[i]);
+            }
+        } else {
+            /* page-local dictionary: each entry lands in the arena once */
+            size_t ndict = rd16(b);
+            b += 2;
+            if (ndict > PAX_MAX_ROWS) return 0;
+            uint32_t doff[PAX_MAX_ROWS], dlen[PAX_MAX_ROWS];
+            for (size_t d = 0; d < ndict; d++) {
+                size_t n = rd16(b);
+                if (b + 2 + n > end) return 0;
+                doff[d] = (uint32_t)pl->arena_len;
+                dlen[d] = (uint32_t)n;
+                arena_put(pl, (const char*)b + 2, n);
+                b += 2 + n;
+            }
+            if (b + 2 * nrows > end) return 0;
+            for (size_t i = 0; i < nlive; i++) {
+                size_t code = rd16(b + 2 * (size_t)slot[i]);
+                bool null = bit_at(nulls, slot[i]) || code >= ndict;
+                vc->off[base + i] = null ? 0 : doff[code];
+                vc->len[base + i] = null ? 0 : dlen[code];
+                vc->nulls[base + i] = null;
+            }
+        }
+    }
+    return nlive;
+}
+
+/* ================= VECTOR KERNELS ================= */
+/* mask[i] = (v[i] op k); written as separate loops so each one is a
+ * straight compare over a dense array that the compiler vectorizes. */
+static void kernel_cmp_int(const int64_t* restrict v, size_t n, int op, int64_t k, uint8_t* restrict mask) {
+    switch (op) {
+        case VX_EQ: for (size_t i = 0; i < n; i++) mask[i] = v[i] == k; break;
+        case VX_LT: for (size_t i = 0; i < n; i++) mask[i] = v[i] < k; break;
+        case VX_LE: for (size_t i = 0; i < n; i++) mask[i] = v[i] <= k; break;
+        case VX_GT: for (size_t i = 0; i < n; i++) mask[i] = v[i] > k; break;
+        default:    for (size_t i = 0; i < n; i++) mask[i] = v[i] >= k; break;
+    }
+}
+
+static int cmp_bytes(const char* a, size_t alen, const char* b, size_t blen) {
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    if (c) return c;
+    return alen < blen ? -1 : alen > blen;
+}
+
+/* Branch-free compaction of the selection vector through a mask. */
+static size_t compact_sel(uint32_t* restrict sel, size_t nsel, const uint8_t* restrict mask,
+                          const uint8_t* restrict nulls) {
+    size_t k = 0;
+    for (size_t i = 0; i < nsel; i++) {
+        uint32_t r = sel[i];
+        sel[k] = r;
+        k += mask[r] & (uint8_t)!nulls[r];
+    }
+    return k;
+}
+
+static void apply_filters(VxPlan* pl) {
+    for (int f = 0; f < pl->nfilters && pl->nsel; f++) {
+        VxFilter* flt = &pl->filters[f];
+        VxColumn* col = &pl->cols[flt->col];
+        if (col->type == VX_INT || flt->on_codes) {
+            kernel_cmp_int(col->ints, pl->nrows, flt->op, flt->ival, pl->mask);
+        } else {
+            for (size_t i = 0; i < pl->nsel; i++) {
+                uint32_t r = pl->sel[i];
+                int c = col->nulls[r] ? 0 : cmp_bytes(pl->arena + col->off[r], col->len[r], flt->sval, flt->slen);
+                switch (flt->op) {
+                    case VX_EQ: pl->mask[r] = c == 0; break;
+                    case VX_LT: pl->mask[r] = c < 0; break;
+                    case VX_LE: pl->mask[r] = c <= 0; break;
+                    case VX_GT: pl->mask[r] = c > 0; break;
+                    default:    pl->mask[r] = c >= 0; break;
+                }
+            }
+        }
+        pl->nsel = compact_sel(pl->sel, pl->nsel, pl->mask, col->nulls);
+    }
+}
+
+/* 64-bit hashes for a batch: multiply-shift for ints (vectorizable),
+ * FNV-1a for text. */
+static void kernel_hash_int(const int64_t* restrict v, size_t n, uint64_t* restrict out) {
+    for (size_t i = 0; i < n; i++) {
+        uint64_t x = (uint64_t)v[i] * 0x9E3779B97F4A7C15ULL;
+        out[i] = x ^ (x >> 29);
+    }
+}
+
+static uint64_t hash_bytes(const char* s, size_t n) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; i++) {
+        h ^= (uint8_t)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* ================= BATCH PIPELINE ================= */
+static size_t load_batch(VxPlan* pl) {
+    if (!pl->page && !(pl->page = malloc(pl->page_size))) return 0;
+    uint8_t* page = pl->page;
+    pl->nrows = 0;
+    pl->arena_len = pl->arena_base;
+    while (pl->nrows < VX_BATCH && pl->next_page < pl->npages) {
+        waldb_read_page(&pl->snap, pl->pages[pl->next_page], page);
+        if (memcmp(page, PAX_MAGIC, 4) == 0) {
+            size_t n = decode_pax(pl, page, pl->nrows);
+            if (n == PAX_NO_ROOM) break;  /* starts the next batch */
+            pl->nrows += n;
+        } else if (decode_row(pl, (const char*)page, pl->nrows)) {
+            pl->nrows++;
+        }
+        pl->next_page++;
+    }
+    pl->nsel = pl->nrows;
+    for (size_t i = 0; i < pl->nrows; i++) pl->sel[i] = (uint32_t)i;
+    return pl->nrows;
+}
+
+static VxGroup* find_group_key(VxPlan* pl, uint64_t h, bool null, bool text,
+                               int64_t ikey, const char* skey, uint32_t slen) {
+    if ((pl->group_count + 1) * 2 > pl->group_cap) {
+        size_t cap = pl->group_cap ? pl->group_cap * 2 : 1024;
+        VxGroup* g = calloc(cap, sizeof(VxGroup));
+        for (size_t i = 0; i < pl->group_cap; i++) {
+            if (!pl->groups[i].used) continue;
+            size_t j = pl->groups[i].hash & (cap - 1);
+            while (g[j].used) j = (j + 1) & (cap - 1);
+            g[j] = pl->groups[i];
+        }
+        free(pl->groups);
+        pl->groups = g;
+        pl->group_cap = cap;
+    }
+
+    size_t j = h & (pl->group_cap - 1);
+    while (pl->groups[j].used) {
+        VxGroup* g = &pl->groups[j];
+        if (g->hash == h && g->key_null == null) {
+            if (null) return g;
+            if (!text && g->ikey == ikey) return g;
+            if (text && g->slen == slen && memcmp(g->skey, skey, slen) == 0) return g;
+        }
+        j = (j + 1) & (pl->group_cap - 1);
+    }
+
+    VxGroup* g = &pl->groups[j];
+    memset(g, 0, sizeof(*g));
+    g->used = true;
+    g->hash = h;
+    g->key_null = null;
+    if (!null) {
+        if (!text) {
+            g->ikey = ikey;
+        } else {
+            g->slen = slen;
+            g->skey = malloc(slen + 1);
+            memcpy(g->skey, skey, slen);
+            g->skey[slen] = 0;
+        }
+    }
+    for (int a = 0; a < pl->naggs; a++) {
+        if (pl->aggs[a].func == VX_MIN) g->acc[a] = INT64_MAX;
+        else if (pl->aggs[a].func == VX_MAX) g->acc[a] = INT64_MIN;
+    }
+    pl->group_count++;
+    return g;
+}
+
+static VxGroup* find_group(VxPlan* pl, uint64_t h, VxColumn* gc, uint32_t r) {
+    if (!gc || gc->nulls[r]) return find_group_key(pl, h, true, false, 0, NULL, 0);
+    if (gc->type == VX_INT || gc->dict) return find_group_key(pl, h, false, false, gc->ints[r], NULL, 0);
+    return find_group_key(pl, h, false, true, 0, pl->arena + gc->off[r], gc->len[r]);
+}
+
+/* Fold a worker's partial group table into the parent's. */
+static void merge_groups(VxPlan* pl, VxPlan* w) {
+    bool text = pl->group_col >= 0 && pl->cols[pl->group_col].type == VX_TEXT &&
+                !pl->cols[pl->group_col].dict;
+    for (size_t i = 0; i < w->group_cap; i++) {
+        VxGroup* src = &w->groups[i];
+        if (!src->used) continue;
+        VxGroup* dst = find_group_key(pl, src->hash, src->key_null, text,
+                                      src->ikey, src->skey, src->slen);
+        for (int a = 0; a < pl->naggs; a++) {
+            if (src->cnt[a] == 0) continue;
+            switch (pl->aggs[a].func) {
+                case VX_SUM: dst->acc[a] += src->acc[a]; break;
+                case VX_MIN: if (src->acc[a] < dst->acc[a]) dst->acc[a] = src->acc[a]; break;
+                case VX_MAX: if (src->acc[a] > dst->acc[a]) dst->acc[a] = src->acc[a]; break;
+                default: break;
+            }
+            dst->cnt[a] += src->cnt[a];
+        }
+    }
+}
+
+static void consume_aggregate(VxPlan* pl) {
+    uint64_t hashes[VX_BATCH];
+    VxColumn* gc = pl->group_col >= 0 ? &pl->cols[pl->group_col] : NULL;
+
+    if (!gc) {
+        memset(hashes, 0, sizeof(uint64_t) * pl->nrows);
+    } else if (gc->type == VX_INT || gc->dict) {
+        kernel_hash_int(gc->ints, pl->nrows, hashes);
+    } else {
+        for (size_t i = 0; i < pl->nsel; i++) {
+            uint32_t r = pl->sel[i];
+            hashes[r] = hash_bytes(pl->arena + gc->off[r], gc->len[r]);
+        }
+    }
+
+    for (size_t i = 0; i < pl->nsel; i++) {
+        uint32_t r = pl->sel[i];
+        uint64_t h = gc && gc->nulls[r] ? 0 : hashes[r];
+        VxGroup* g = find_group(pl, h, gc, r);
+        for (int a = 0; a < pl->naggs; a++) {
+            VxAgg* ag = &pl->aggs[a];
+            if (ag->col < 0) { g->cnt[a]++; continue; }
+            VxColumn* c = &pl->cols[ag->col];
+            if (c->nulls[r]) continue;
+            int64_t v = c->type == VX_INT ? c->ints[r] : 0;
+            g->cnt[a]++;
+            switch (ag->func) {
+                case VX_SUM: g->acc[a] += v; break;
+                case VX_MIN: if (v < g->acc[a]) g->acc[a] = v; break;
+                case VX_MAX: if (v > g->acc[a]) g->acc[a] = v; break;
+                default: break;
+            }
+        }
+    }
+}
+
+/* ================= PUBLIC API ================= */
+void* vx_plan_new(const char* table) {
+    VxPlan* pl = calloc(1, sizeof(VxPlan));
+    if (!pl) return NULL;
+    snprintf(pl->table, sizeof(pl->table), "%s", table);
+    pl->snap = waldb_begin_read();
+    pl->owns_snap = true;
+    pl->page_size = waldb_page_size();
+    pl->group_col = -1;
+    return pl;
+}
+
+int vx_plan_column(void* plan, const char* name, int type) {
+    VxPlan* pl = plan;
+    for (int c = 0; c < pl->ncols; c++) {
+        if (strcmp(pl->cols[c].name, name) == 0) return c;
+    }
+    if (pl->ncols >= VX_MAX_COLS) return -1;
+    VxColumn* col = &pl->cols[pl->ncols];
+    snprintf(col->name, sizeof(col->name), "%s", name);
+    col->type = type;
+    return pl->ncols++;
+}
+
+int vx_plan_filter_int(void* plan, int col, int op, int64_t value) {
+    VxPlan* pl = plan;
+    if (pl->nfilters >= VX_MAX_FILTERS || col < 0 || col >= pl->ncols) return -1;
+    if (pl->cols[col].type != VX_INT) return -1;
+    pl->filters[pl->nfilters++] = (VxFilter){ .col = col, .op = op, .ival = value };
+    return 0;
+}
+
+int vx_plan_filter_text(void* plan, int col, int op, const char* value) {
+    VxPlan* pl = plan;
+    if (pl->nfilters >= VX_MAX_FILTERS || col < 0 || col >= pl->ncols) return -1;
+    if (pl->cols[col].type != VX_TEXT) return -1;
+    size_t n = strlen(value);
+    char* s = malloc(n + 1);
+    memcpy(s, value, n + 1);
+    VxFilter flt = { .col = col, .op = op, .sval = s, .slen = n };
+    VxColumn* c = &pl->cols[col];
+    if (c->dict && op == VX_EQ) {
+        /* codes are unique per value; a value not in the dictionary
+         * matches nothing */
+        flt.on_codes = true;
+        flt.ival = -1;
+        for (size_t d = 0; d < c->dict_n; d++) {
+            if (c->dict_len[d] == n && memcmp(pl->arena + c->dict_off[d], value, n) == 0) {
+                flt.ival = (int64_t)d;
+                break;
+            }
+        }
+    }
+    pl->filters[pl->nfilters++] = flt;
+    return 0;
+}
+
+/* Mark a TEXT column as dictionary-encoded: stored values are codes into
+ * values[0..n). Must be called before filters on the column are added. */
+int vx_plan_dictionary(void* plan, int col, const char* const* values, size_t n) {
+    VxPlan* pl = plan;
+    if (col < 0 || col >= pl->ncols || pl->cols[col].type != VX_TEXT) return -1;
+    VxColumn* c = &pl->cols[col];
+    if (c->dict && c->dict_n == n) return 0;  /* same column added twice */
+    free(c->dict_off);
+    free(c->dict_len);
+    c->dict = true;
+    c->dict_n = n;
+    c->dict_off = malloc(sizeof(uint32_t) * (n ? n : 1));
+    c->dict_len = malloc(sizeof(uint32_t) * (n ? n : 1));
+    pl->arena_len = pl->arena_base;
+    for (size_t d = 0; d < n; d++) {
+        size_t len = strlen(values[d]);
+        c->dict_off[d] = (uint32_t)pl->arena_len;
+        c->dict_len[d] = (uint32_t)len;
+        arena_put(pl, values[d], len);
+    }
+    pl->arena_base = pl->arena_len;
+    return 0;
+}
+
+int vx_plan_output(void* plan, int col) {
+    VxPlan* pl = plan;
+    if (pl->nout >= VX_MAX_COLS || col < 0 || col >= pl->ncols) return -1;
+    pl->outputs[pl->nout] = col;
+    return pl->nout++;
+}
+
+int vx_plan_group_by(void* plan, int col) {
+    VxPlan* pl = plan;
+    if (col < 0 || col >= pl->ncols) return -1;
+    pl->group_col = col;
+    return 0;
+}
+
+int vx_plan_aggregate(void* plan, int func, int col) {
+    VxPlan* pl = plan;
+    if (pl->naggs >= VX_MAX_AGGS || col >= pl->ncols) return -1;
+    if (col >= 0 && pl->cols[col].type != VX_INT && func != VX_COUNT) return -1;
+    pl->aggs[pl->naggs] = (VxAgg){ .func = func, .col = col };
+    return pl->naggs++;
+}
+
+void vx_plan_pages(void* plan, const uint32_t* pages, size_t n) {
+    VxPlan* pl = plan;
+    free(pl->pages);
+    pl->pages = malloc(sizeof(uint32_t) * (n ? n : 1));
+    memcpy(pl->pages, pages, sizeof(uint32_t) * n);
+    pl->npages = n;
+    pl->next_page = 0;
+}
+
+/* Emit up to VX_BATCH finished groups: group key (if any), then one value
+ * per aggregate. COUNT columns carry the count, others the accumulator. */
+static size_t emit_groups(VxPlan* pl) {
+    size_t n = 0;
+    int key_slot = pl->group_col >= 0 ? 1 : 0;
+    while (pl->emit_pos < pl->group_cap && n < VX_BATCH) {
+        VxGroup* g = &pl->groups[pl->emit_pos++];
+        if (!g->used) continue;
+        if (key_slot) {
+            pl->out_ints[0][n] = g->ikey;
+            pl->out_nulls[0][n] = g->key_null;
+        }
+        for (int a = 0; a < pl->naggs; a++) {
+            bool count = pl->aggs[a].func == VX_COUNT;
+            pl->out_ints[key_slot + a][n] = count ? g->cnt[a] : g->acc[a];
+            pl->out_nulls[key_slot + a][n] = !count && g->cnt[a] == 0;
+        }
+        pl->sel[n] = (uint32_t)(pl->emit_pos - 1);  /* group slot, for text keys */
+        n++;
+    }
+    return n;
+}
+
+static void run_aggregate(VxPlan* pl) {
+    while (load_batch(pl) > 0) {
+        apply_filters(pl);
+        consume_aggregate(pl);
+    }
+}
+
+static size_t parallel_next_batch(VxPlan* pl);
+
+static size_t serial_next_batch(VxPlan* pl) {
+    pl->out_rows = 0;
+
+    if (pl->naggs > 0) {
+        if (!pl->agg_done) {
+            run_aggregate(pl);
+            /* a global aggregate over no rows still yields one row */
+            if (pl->group_col < 0 && pl->group_count == 0) {
+                find_group(pl, 0, NULL, 0);
+            }
+            pl->agg_done = true;
+            pl->emit_pos = 0;
+        }
+        pl->out_rows = emit_groups(pl);
+        return pl->out_rows;
+    }
+
+    while (pl->out_rows == 0) {
+        if (load_batch(pl) == 0) return 0;
+        apply_filters(pl);
+        /* gather: dense output vectors in selection order */
+        for (int o = 0; o < pl->nout; o++) {
+            VxColumn* c = &pl->cols[pl->outputs[o]];
+            int64_t* restrict dst = pl->out_ints[o];
+            uint8_t* restrict dn = pl->out_nulls[o];
+            for (size_t i = 0; i < pl->nsel; i++) {
+                dst[i] = c->ints[pl->sel[i]];
+                dn[i] = c->nulls[pl->sel[i]];
+            }
+        }
+        pl->out_rows = pl->nsel;
+    }
+    return pl->out_rows;
+}
+
+size_t vx_next_batch(void* plan) {
+    VxPlan* pl = plan;
+    if (pl->nworkers > 1) return parallel_next_batch(pl);
+    return serial_next_batch(pl);
+}
+
+const int64_t* vx_batch_ints(void* plan, int out) {
+    return ((VxPlan*)plan)->out_ints[out];
+}
+
+const uint8_t* vx_batch_nulls(void* plan, int out) {
+    return ((VxPlan*)plan)->out_nulls[out];
+}
+
+/* TEXT output value at row of the current batch (NULL if null). */
+const char* vx_batch_text(void* plan, int out, size_t row, size_t* len) {
+    VxPlan* pl = plan;
+    if (pl->naggs > 0) {
+        VxGroup* g = &pl->groups[pl->sel[row]];
+        if (out != 0 || g->key_null) return NULL;
+        VxColumn* gc = &pl->cols[pl->group_col];
+        if (gc->dict) {
+            if (g->ikey < 0 || (size_t)g->ikey >= gc->dict_n) return NULL;
+            *len = gc->dict_len[g->ikey];
+            return pl->arena + gc->dict_off[g->ikey];
+        }
+        *len = g->slen;
+        return g->skey;
+    }
+    if (pl->cur) {
+        size_t i = (size_t)out * pl->cur->n + row;
+        if (pl->cur->nulls[i]) return NULL;
+        *len = pl->cur->len[i];
+        return pl->cur->arena + pl->cur->off[i];
+    }
+    VxColumn* c = &pl->cols[pl->outputs[out]];
+    uint32_t r = pl->sel[row];
+    if (c->nulls[r]) return NULL;
+    *len = c->len[r];
+    return pl->arena + c->off[r];
+}
+
+static void stop_workers(VxPlan* pl);
+
+void vx_plan_free(void* plan) {
+    VxPlan* pl = plan;
+    if (!pl) return;
+    if (pl->workers) stop_workers(pl);
+    if (pl->owns_snap) waldb_end_read(&pl->snap);
+    for (int f = 0; f < pl->nfilters; f++) free(pl->filters[f].sval);
+    for (int c = 0; c < pl->ncols; c++) {
+        free(pl->cols[c].dict_off);
+        free(pl->cols[c].dict_len);
+    }
+    for (size_t i = 0; i < pl->group_cap; i++) {
+        if (pl->groups[i].used) free(pl->groups[i].skey);
+    }
+    free(pl->groups);
+    free(pl->pages);
+    free(pl->arena);
+    free(pl->page);
+    free(pl);
+}
+
+/* ================= PARALLEL EXECUTION ================= */
+static void free_out_batch(VxOutBatch* b) {
+    if (!b) return;
+    free(b->ints);
+    free(b->nulls);
+    free(b->off);
+    free(b->len);
+    free(b->arena);
+    free(b);
+}
+
+static VxPlan* clone_plan(VxPlan* pl, size_t first, size_t count) {
+    VxPlan* w = calloc(1, sizeof(VxPlan));
+    memcpy(w->table, pl->table, sizeof(w->table));
+    w->snap = pl->snap;  /* same snapshot: workers see one consistent view */
+    w->page_size = pl->page_size;
+    w->ncols = pl->ncols;
+    for (int c = 0; c < pl->ncols; c++) {
+        memcpy(w->cols[c].name, pl->cols[c].name, sizeof(w->cols[c].name));
+        w->cols[c].type = pl->cols[c].type;
+        if (pl->cols[c].dict) {
+            size_t n = pl->cols[c].dict_n ? pl->cols[c].dict_n : 1;
+            w->cols[c].dict = true;
+            w->cols[c].dict_n = pl->cols[c].dict_n;
+            w->cols[c].dict_off = malloc(sizeof(uint32_t) * n);
+            w->cols[c].dict_len = malloc(sizeof(uint32_t) * n);
+            memcpy(w->cols[c].dict_off, pl->cols[c].dict_off, sizeof(uint32_t) * n);
+            memcpy(w->cols[c].dict_len, pl->cols[c].dict_len, sizeof(uint32_t) * n);
+        }
+    }
+    if (pl->arena_base) {
+        /* dictionary entries sit at the same offsets in every worker */
+        arena_put(w, pl->arena, pl->arena_base);
+        w->arena_base = pl->arena_base;
+    }
+    w->nfilters = pl->nfilters;
+    for (int f = 0; f < pl->nfilters; f++) {
+        w->filters[f] = pl->filters[f];
+        if (pl->filters[f].sval) {
+            w->filters[f].sval = malloc(pl->filters[f].slen + 1);
+            memcpy(w->filters[f].sval, pl->filters[f].sval, pl->filters[f].slen + 1);
+        }
+    }
+    w->nout = pl->nout;
+    memcpy(w->outputs, pl->outputs, sizeof(w->outputs));
+    w->group_col = pl->group_col;
+    w->naggs = pl->naggs;
+    memcpy(w->aggs, pl->aggs, sizeof(w->aggs));
+    w->pages = malloc(sizeof(uint32_t) * (count ? count : 1));
+    memcpy(w->pages, pl->pages + first, sizeof(uint32_t) * count);
+    w->npages = count;
+    w->parent = pl;
+    return w;
+}
+
+/* Copy the worker's current output batch so it can move on. */
+static VxOutBatch* capture_batch(VxPlan* w) {
+    size_t n = w->out_rows;
+    VxOutBatch* b = calloc(1, sizeof(VxOutBatch));
+    size_t cells = (size_t)w->nout * n;
+    b->n = n;
+    b->ints = malloc(sizeof(int64_t) * (cells ? cells : 1));
+    b->nulls = malloc(cells ? cells : 1);
+    b->off = calloc(cells ? cells : 1, sizeof(uint32_t));
+    b->len = calloc(cells ? cells : 1, sizeof(uint32_t));
+    size_t text_bytes = 0;
+    for (int o = 0; o < w->nout; o++) {
+        memcpy(b->ints + (size_t)o * n, w->out_ints[o], sizeof(int64_t) * n);
+        memcpy(b->nulls + (size_t)o * n, w->out_nulls[o], n);
+        if (w->cols[w->outputs[o]].type == VX_TEXT) text_bytes = w->arena_len;
+    }
+    if (text_bytes) {
+        /* offsets into the worker arena stay valid in the copy */
+        b->arena = malloc(text_bytes);
+        memcpy(b->arena, w->arena, text_bytes);
+        for (int o = 0; o < w->nout; o++) {
+            VxColumn* c = &w->cols[w->outputs[o]];
+            if (c->type != VX_TEXT) continue;
+            for (size_t i = 0; i < n; i++) {
+                b->off[(size_t)o * n + i] = c->off[w->sel[i]];
+                b->len[(size_t)o * n + i] = c->len[w->sel[i]];
+            }
+        }
+    }
+    return b;
+}
+
+static void scan_worker(void* arg) {
+    VxWorker* wk = arg;
+    VxPlan* w = wk->plan;
+    VxPlan* pl = w->parent;
+
+    for (;;) {
+        pthread_mutex_lock(&pl->mu);
+        if (pl->cancel) break;
+        if (wk->queued >= VX_QUEUE_DEPTH) {
+            /* never block a pool thread on the consumer */
+            wk->parked = true;
+            pthread_mutex_unlock(&pl->mu);
+            return;
+        }
+        pthread_mutex_unlock(&pl->mu);
+
+        if (serial_next_batch(w) == 0) {
+            pthread_mutex_lock(&pl->mu);
+            break;
+        }
+        VxOutBatch* b = capture_batch(w);
+        pthread_mutex_lock(&pl->mu);
+        if (wk->tail) wk->tail->next = b; else wk->head = b;
+        wk->tail = b;
+        wk->queued++;
+        pthread_cond_broadcast(&pl->cv);
+        pthread_mutex_unlock(&pl->mu);
+    }
+
+    wk->done = true;
+    pthread_cond_broadcast(&pl->cv);
+    pthread_mutex_unlock(&pl->mu);
+}
+
+static void agg_worker(void* arg) {
+    VxWorker* wk = arg;
+    if (!wk->plan->parent->cancel) run_aggregate(wk->plan);
+}
+
+static void start_workers(VxPlan* pl) {
+    int n = pl->nworkers;
+    pthread_mutex_init(&pl->mu, NULL);
+    pthread_cond_init(&pl->cv, NULL);
+    pl->workers = calloc((size_t)n, sizeof(VxWorker));
+    pl->group = waldb_group_new();
+    size_t per = pl->npages / (size_t)n, extra = pl->npages % (size_t)n, first = 0;
+    for (int i = 0; i < n; i++) {
+        size_t count = per + ((size_t)i < extra ? 1 : 0);
+        pl->workers[i].plan = clone_plan(pl, first, count);
+        first += count;
+        waldb_spawn(pl->group, WALDB_PRIO_HIGH,
+                    pl->naggs > 0 ? agg_worker : scan_worker, &pl->workers[i]);
+    }
+    pl->started = true;
+}
+
+static void stop_workers(VxPlan* pl) {
+    pthread_mutex_lock(&pl->mu);
+    pl->cancel = true;
+    pthread_cond_broadcast(&pl->cv);
+    pthread_mutex_unlock(&pl->mu);
+    waldb_group_wait(pl->group);
+    waldb_group_free(pl->group);
+    pl->group = NULL;
+    for (int i = 0; i < pl->nworkers; i++) {
+        VxWorker* wk = &pl->workers[i];
+        while (wk->head) {
+            VxOutBatch* next = wk->head->next;
+            free_out_batch(wk->head);
+            wk->head = next;
+        }
+        wk->plan->nworkers = 0;
+        vx_plan_free(wk->plan);
+    }
+    free(pl->workers);
+    pl->workers = NULL;
+    free_out_batch(pl->cur);
+    pl->cur = NULL;
+    pthread_cond_destroy(&pl->cv);
+    pthread_mutex_destroy(&pl->mu);
+}
+
+static size_t parallel_next_batch(VxPlan* pl) {
+    if (!pl->started) start_workers(pl);
+
+    if (pl->naggs > 0) {
+        if (!pl->agg_done) {
+            waldb_group_wait(pl->group);
+            waldb_group_free(pl->group);
+            pl->group = NULL;
+            for (int i = 0; i < pl->nworkers; i++) merge_groups(pl, pl->workers[i].plan);
+            if (pl->group_col < 0 && pl->group_count == 0) {
+                find_group(pl, 0, NULL, 0);
+            }
+            for (int i = 0; i < pl->nworkers; i++) {
+                vx_plan_free(pl->workers[i].plan);
+                pl->workers[i].plan = NULL;
+            }
+            free(pl->workers);
+            pl->workers = NULL;
+            pthread_cond_destroy(&pl->cv);
+            pthread_mutex_destroy(&pl->mu);
+            pl->agg_done = true;
+            pl->emit_pos = 0;
+        }
+        pl->out_rows = emit_groups(pl);
+        return pl->out_rows;
+    }
+
+    free_out_batch(pl->cur);
+    pl->cur = NULL;
+    pl->out_rows = 0;
+    if (!pl->workers) return 0;
+
+    VxOutBatch* b = NULL;
+    VxWorker* from = NULL;
+    pthread_mutex_lock(&pl->mu);
+    while (!b) {
+        bool all_done = true;
+        for (int k = 0; k < pl->nworkers && !b; k++) {
+            int i = pl->ordered ? pl->cur_worker : (pl->cur_worker + k) % pl->nworkers;
+            if (i >= pl->nworkers) break;
+            VxWorker* wk = &pl->workers[i];
+            if (wk->head) {
+                b = wk->head;
+                from = wk;
+                if (!pl->ordered) pl->cur_worker = (i + 1) % pl->nworkers;
+            } else if (wk->done && pl->ordered) {
+                /* page order: drain worker i completely before i + 1 */
+                pl->cur_worker++;
+                k = -1;
+                continue;
+            }
+            if (!wk->done) all_done = false;
+            if (pl->ordered) break;
+        }
+        if (b) break;
+        if (pl->ordered ? pl->cur_worker >= pl->nworkers : all_done) {
+            pthread_mutex_unlock(&pl->mu);
+            return 0;
+        }
+        pthread_cond_wait(&pl->cv, &pl->mu);
+    }
+    from->head = b->next;
+    if (!from->head) from->tail = NULL;
+    from->queued--;
+    if (from->parked) {
+        from->parked = false;
+        waldb_spawn(pl->group, WALDB_PRIO_HIGH, scan_worker, from);
+    }
+    pthread_mutex_unlock(&pl->mu);
+
+    for (int o = 0; o < pl->nout; o++) {
+        memcpy(pl->out_ints[o], b->ints + (size_t)o * b->n, sizeof(int64_t) * b->n);
+        memcpy(pl->out_nulls[o], b->nulls + (size_t)o * b->n, b->n);
+    }
+    pl->cur = b;
+    pl->out_rows = b->n;
+    return b->n;
+}
+
+/* Split execution over nworkers threads. ordered keeps page order for
+ * scans; aggregates ignore it. Call before the first vx_next_batch. */
+void vx_plan_parallel(void* plan, int nworkers, int ordered) {
+    VxPlan* pl = plan;
+    if (pl->started) return;
+    if ((size_t)nworkers > pl->npages) nworkers = (int)pl->npages;
+    pl->nworkers = nworkers > 1 ? nworkers : 0;
+    pl->ordered = ordered != 0;
+}
@@ -1,4 +1,5 @@
 // wal_db_upgraded.c
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -8,24 +9,54 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <limits.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <errno.h>
 
-#define PAGE_SIZE 4096
-#define MAX_TX 1024
-#define MAX_READERS 32
-#define CACHE_SIZE 64
+/* Page size: chosen when a database is created, kept in its file header */
+#define DEFAULT_PAGE_SIZE 4096
+#define MIN_PAGE_SIZE 4096
+#define MAX_PAGE_SIZE 65536
+#define DB_MAGIC "PESADB1"
+/* The db file grows by extents, each twice the last, between these sizes */
+#define MIN_EXTENT (1 << 20)
+#define MAX_EXTENT (64 << 20)
+#define CACHE_SIZE 64    /* initial slots; grows only while all are dirty */
 #define WAL_MAGIC_COMMIT 0xC0DECAFE
+/* Queue a background checkpoint each time the WAL grows by this much. */
+#define CHECKPOINT_WAL_BYTES (4u << 20)
+
+/* taskpool.c */
+void waldb_checkpoint_async(void);
+void waldb_pool_stop(void);
+
+/* walshm.c */
+#define WALSHM_UNKNOWN (-2)
+int walshm_open(const char *db_path, bool writer);
+void walshm_reset(uint64_t end);
+void walshm_close(void);
+void walshm_publish(const uint32_t *pages, const uint64_t *offsets, size_t n, uint64_t end);
+uint64_t walshm_end(void);
+int64_t walshm_lookup(uint32_t page_id, uint64_t snapshot);
+int walshm_reader_begin(uint64_t *snapshot);
+void walshm_reader_end(int slot);
+uint64_t walshm_checkpoint_target(uint64_t done);
+void walshm_checkpoint_done(uint64_t done);
 
 /* ================= WAL TYPES ================= */
 typedef enum {
-    WAL_PAGE   = 1,
-    WAL_COMMIT = 2
+    WAL_PAGE     = 1,
+    WAL_COMMIT   = 2,
+    WAL_TRUNCATE = 3
 } WalRecordType;
 
+/* Followed by page_size bytes of page image; see PAGE_RECORD */
 typedef struct {
     uint32_t type;
     uint32_t tx_id;
     uint32_t page_id;
-    uint8_t  data[PAGE_SIZE];
+    uint8_t  data[];
 } WalPageRecord;
 
 typedef struct {
@@ -34,34 +65,161 @@ typedef struct {
     uint32_t magic;
 } WalCommitRecord;
 
+/* Cuts the db file to page_count pages once replayed or backfilled up to
+ * here. Frames after it may extend the file again. */
+typedef struct {
+    uint32_t type;
+    uint32_t tx_id;
+    uint32_t page_count;
+} WalTruncateRecord;
+
+/* Page id WalFrameFn receives for a truncate record */
+#define WAL_TRUNCATE_PAGE UINT32_MAX
+
+/* Start of the db file. Pages follow at page_base; databases created
+ * before the header existed have none and use 4 KB pages from offset 0. */
+typedef struct {
+    char magic[8];            /* DB_MAGIC */
+    uint32_t page_size;
+    uint32_t extent_size;     /* bytes of the last extent allocated; 0: none yet */
+    uint64_t extents;         /* extents allocated over the file's life */
+} DbHeader;
+
 /* ================== PAGE CACHE ================== */
 typedef struct {
     uint32_t page_id;
     uint32_t owner_tx;
     bool dirty;
-    uint8_t data[PAGE_SIZE];
+    uint64_t committed;       /* WAL end of the commit that wrote it */
+    uint8_t *data;            /* page_size bytes */
 } CachedPage;
 
 /* ============== GLOBAL STATE ============== */
 static int db_fd = -1;
 static int wal_fd = -1;
 
+static uint32_t page_size = DEFAULT_PAGE_SIZE;
+static uint32_t create_page_size = DEFAULT_PAGE_SIZE;  /* for a new database */
+static off_t page_base = 0;   /* db file offset of page 0 */
+static DbHeader header;       /* as last written; zeroed for a file without one */
+/* The db file's size: pages written so far plus the unused rest of the
+ * last extent. db_resized is set while a change of size or allocation
+ * has not been fsynced; until then fdatasync is not enough. */
+static off_t db_size = 0;
+static bool db_resized = false;
+static bool use_extents = true;  /* false once fallocate turns out unsupported */
+/* Bytes of one page frame in the WAL */
+#define PAGE_RECORD ((off_t)(sizeof(WalPageRecord) + page_size))
+
 static uint32_t next_tx_id = 1;
-static uint64_t reader_snapshots[MAX_READERS] = {0};
-static size_t reader_count = 0;
+/* The write transaction this thread is staging, 0 if none: its reads see
+ * the pages it staged, no one else's do. */
+static _Thread_local uint32_t staging_tx = 0;
+/* Opened with waldb_open_readonly: another process is the writer. */
+static bool read_only = false;
+/* Following a primary: only waldb_replica_apply may write. */
+static bool replica = false;
 
-static CachedPage cache[CACHE_SIZE];
+static CachedPage *cache = NULL;
 static size_t cache_count = 0;
+static size_t cache_cap = 0;
+static size_t cache_hand = 0;   /* clock hand for evicting clean pages */
+/* Guards the page cache: parallel scan workers read through it while the
+ * Python side may be staging or committing a write. */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+/* One checkpoint at a time; they may now run on pool workers. */
+static pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+static off_t checkpoint_requested_at = 0;
+/* Everything in the WAL below this has been copied into the db file. */
+static uint64_t backfilled = 0;
 
 /* ================= FILE HANDLING ================= */
+static bool valid_page_size(uint32_t size) {
+    return size >= MIN_PAGE_SIZE && size <= MAX_PAGE_SIZE && (size & (size - 1)) == 0;
+}
+
+/* Read an open db file's header into h; false if it has none. */
+static bool read_header(int fd, DbHeader *h) {
+    if (pread(fd, h, sizeof(*h), 0) != sizeof(*h) || memcmp(h->magic, DB_MAGIC, sizeof(DB_MAGIC)) != 0)
+        return false;
+    return valid_page_size(h->page_size);
+}
+
+static void write_header(void) {
+    if (pwrite(db_fd, &header, sizeof(header), 0) != sizeof(header)) {
+        perror("write db header");
+        exit(1);
+    }
+}
+
+/* Set page_size, page_base and db_size from the file, writing a header
+ * first if the database is new (empty db file and WAL). */
+static void load_header(bool create) {
+    struct stat db_st, wal_st;
+    if (fstat(db_fd, &db_st) != 0 || fstat(wal_fd, &wal_st) != 0) { perror("stat db"); exit(1); }
+    bool found = read_header(db_fd, &header);
+    if (!found && create && db_st.st_size == 0 && wal_st.st_size == 0) {
+        header = (DbHeader){ DB_MAGIC, create_page_size, 0, 0 };
+        write_header();
+        fsync(db_fd);
+        db_st.st_size = sizeof(header);
+        found = true;
+    }
+    if (!found)
+        memset(&header, 0, sizeof(header));
+    page_size = found ? header.page_size : DEFAULT_PAGE_SIZE;
+    page_base = found ? (off_t)page_size : 0;  /* the header fills the first page slot */
+    db_size = db_st.st_size;
+    db_resized = false;
+}
+
+/* Make the db file at least end bytes long. It grows by whole extents
+ * allocated with fallocate, so its pages lie in few large runs and a
+ * checkpoint that fills pages inside an extent changes no file metadata.
+ * Each extent is twice the last, from MIN_EXTENT up to MAX_EXTENT; the
+ * header keeps the last size so growth resumes there after a reopen. */
+static void grow_db(off_t end) {
+    while (use_extents && db_size < end) {
+        off_t extent = header.extent_size ? (off_t)header.extent_size * 2 : MIN_EXTENT;
+        if (extent > MAX_EXTENT) extent = MAX_EXTENT;
+        off_t len = (db_size + extent) / page_size * page_size - db_size;  /* end on a page */
+        if (fallocate(db_fd, 0, db_size, len) != 0) {
+            if (errno == EOPNOTSUPP || errno == ENOSYS)
+                use_extents = false;  /* grow page by page instead */
+            return;                   /* out of space: the write reports it */
+        }
+        db_size += len;
+        db_resized = true;
+        header.extent_size = (uint32_t)extent;
+        header.extents++;
+        if (page_base)
+            write_header();
+    }
+}
+
+/* Flush db file writes. fdatasync skips the inode's timestamps, which
+ * nothing here reads; it is only used while the file's size and
+ * allocation are already on disk. */
+static void sync_db(void) {
+    if (db_resized) {
+        fsync(db_fd);
+        db_resized = false;
+    } else {
+        fdatasync(db_fd);
+    }
+}
+
 static void open_database(const char *name) {
     db_fd = open(name, O_RDWR | O_CREAT, 0644);
     if (db_fd < 0) { perror("open db"); exit(1); }
 
     char wal_name[256];
     snprintf(wal_name, sizeof(wal_name), "%s-wal", name);
-    wal_fd = open(wal_name, O_RDWR | O_CREAT, 0644);
+    /* O_APPEND: checkpoint/recovery seek around the log while reading it,
+     * and appends must never land at wherever they left the offset. */
+    wal_fd = open(wal_name, O_RDWR | O_CREAT | O_APPEND, 0644);
     if (wal_fd < 0) { perror("open wal"); exit(1); }
+    load_header(true);
 }
 
 /* ================= TRANSACTIONS ================= */
@@ -77,17 +235,21 @@ static WriteTxn begin_write_txn() {
 
 typedef struct {
     uint64_t snapshot;
+    int32_t slot;   /* registration in the shared reader table */
 } ReaderTxn;
 
+/* The snapshot is the latest commit end, published in the shared index,
+ * so it sees exactly the committed transactions of every process. */
 static ReaderTxn begin_read_txn() {
     ReaderTxn r;
-    r.snapshot = lseek(wal_fd, 0, SEEK_END);
-    if (reader_count < MAX_READERS) {
-        reader_snapshots[reader_count++] = r.snapshot;
-    }
+    r.slot = walshm_reader_begin(&r.snapshot);
     return r;
 }
 
+static void end_read_txn(ReaderTxn *r) {
+    walshm_reader_end(r->slot);
+}
+
 /* ================= PAGE CACHE FUNCTIONS ================= */
 static CachedPage* find_cached_page(uint32_t page_id) {
     for (size_t i = 0; i < cache_count; i++) {
@@ -97,31 +259,49 @@ static CachedPage* find_cached_page(uint32_t page_id) {
     return NULL;
 }
 
+/* Committed pages are also in the WAL, so a clean slot can be recycled
+ * at any time. Dirty pages of open transactions cannot, so a transaction
+ * staging more pages than there are slots grows the cache instead. */
+static CachedPage* claim_cache_slot(void) {
+    if (cache_count < cache_cap)
+        goto fresh;
+
+    for (size_t n = 0; n < cache_count; n++) {
+        CachedPage *cp = &cache[cache_hand];
+        cache_hand = (cache_hand + 1) % cache_count;
+        if (!cp->dirty)
+            return cp;
+    }
+
+    size_t cap = cache_cap ? cache_cap * 2 : CACHE_SIZE;
+    CachedPage *grown = realloc(cache, cap * sizeof(CachedPage));
+    if (!grown) { perror("page cache"); exit(1); }
+    cache = grown;
+    cache_cap = cap;
+fresh:
+    cache[cache_count].data = malloc(page_size);
+    if (!cache[cache_count].data) { perror("page cache"); exit(1); }
+    return &cache[cache_count++];
+}
+
 static CachedPage* get_or_create_cached_page(uint32_t page_id, uint32_t tx_id) {
     CachedPage* cp = find_cached_page(page_id);
     if (cp) return cp;
 
-    if (cache_count >= CACHE_SIZE) {
-        fprintf(stderr, "Cache full!\n");
-        exit(1);
-    }
-
-    cp = &cache[cache_count++];
+    cp = claim_cache_slot();
     cp->page_id = page_id;
     cp->owner_tx = tx_id;
     cp->dirty = false;
-    memset(cp->data, 0, PAGE_SIZE);
+    cp->committed = 0;
+    memset(cp->data, 0, page_size);
     return cp;
 }
 
 /* ================= WAL FUNCTIONS ================= */
 static void wal_append_page(WriteTxn *tx, uint32_t page_id, void *data) {
-    WalPageRecord rec;
-    rec.type = WAL_PAGE;
-    rec.tx_id = tx->tx_id;
-    rec.page_id = page_id;
-    memcpy(rec.data, data, PAGE_SIZE);
-    if (write(wal_fd, &rec, sizeof(rec)) != sizeof(rec)) {
+    WalPageRecord rec = { WAL_PAGE, tx->tx_id, page_id };
+    struct iovec iov[2] = { { &rec, sizeof(rec) }, { data, page_size } };
+    if (writev(wal_fd, iov, 2) != PAGE_RECORD) {
         perror("write wal page");
         exit(1);
     }
@@ -140,163 +320,418 @@ static void wal_commit(WriteTxn *tx) {
 }
 
 /* ================= DB IO ================= */
+static off_t page_offset(uint32_t page_id) {
+    return page_base + (off_t)page_id * page_size;
+}
+
 static void read_page_from_db(uint32_t page_id, void *out) {
-    lseek(db_fd, (off_t)page_id * PAGE_SIZE, SEEK_SET);
-    ssize_t n = read(db_fd, out, PAGE_SIZE);
+    ssize_t n = pread(db_fd, out, page_size, page_offset(page_id));
     if (n <= 0) {
-        memset(out, 0, PAGE_SIZE);
+        memset(out, 0, page_size);
+    } else if (n < (ssize_t)page_size) {
+        memset((uint8_t *)out + n, 0, page_size - n);
     }
 }
 
 static void write_page_to_db(uint32_t page_id, void *data) {
-    lseek(db_fd, (off_t)page_id * PAGE_SIZE, SEEK_SET);
-    if (write(db_fd, data, PAGE_SIZE) != PAGE_SIZE) {
+    off_t end = page_offset(page_id) + page_size;
+    if (end > db_size)
+        grow_db(end);
+    if (pwrite(db_fd, data, page_size, page_offset(page_id)) != (ssize_t)page_size) {
         perror("write db page");
         exit(1);
     }
+    if (end > db_size) {  /* past the last extent: fallocate was unavailable */
+        db_size = end;
+        db_resized = true;
+    }
 }
 
-/* ================= WAL LOOKUP ================= */
-static bool wal_read_page(uint32_t page_id, uint64_t snapshot, void *out) {
-    off_t pos = 0;
-    bool committed[MAX_TX] = {false};
+/* ================= WAL REPLAY ================= */
+/* Reads n bytes at off of a WAL image; a short read is the end of the log. */
+typedef ssize_t (*WalReadFn)(void *src, void *buf, size_t n, off_t off);
+/* Receives each page frame of a committed transaction, in log order
+ * (page_id WAL_TRUNCATE_PAGE: a truncate record). */
+typedef void (*WalFrameFn)(void *ctx, uint32_t page_id, off_t at);
 
-    lseek(wal_fd, 0, SEEK_SET);
-    while (pos < (off_t)snapshot) {
-        uint32_t type;
-        ssize_t n = read(wal_fd, &type, sizeof(type));
-        if (n <= 0) break;
-
-        if (type == WAL_COMMIT) {
-            WalCommitRecord cr;
-            lseek(wal_fd, -(off_t)sizeof(uint32_t), SEEK_CUR);
-            read(wal_fd, &cr, sizeof(cr));
-            if (cr.magic == WAL_MAGIC_COMMIT && cr.tx_id < MAX_TX) {
-                committed[cr.tx_id] = true;
+/*
+ * Walks [pos, end) and hands apply the frames of every fully committed
+ * transaction. commit_tx appends a transaction's frames back to back and
+ * then its commit record, so only the current run of frames is ever
+ * pending. A frame from another transaction abandons the run. Unknown
+ * records and short records end the walk. Transaction ids restart with
+ * every process and are only compared between neighbours, so they may
+ * repeat across the log. Stops after max_tx commits (0: no limit).
+ * Returns the offset just past the last commit.
+ */
+static off_t wal_replay(WalReadFn rd, void *src, off_t pos, off_t end, size_t max_tx,
+                        WalFrameFn apply, void *ctx) {
+    off_t run = pos;          /* first frame of the pending transaction */
+    uint32_t run_tx = 0;
+    off_t committed = pos;
+    size_t commits = 0;
+
+    while (pos < end) {
+        uint32_t hdr[3];      /* type, tx_id, page_id / magic */
+        if (rd(src, hdr, sizeof(hdr), pos) != sizeof(hdr)) break;
+
+        if (hdr[0] == WAL_COMMIT) {
+            if (pos + (off_t)sizeof(WalCommitRecord) > end || hdr[2] != WAL_MAGIC_COMMIT) break;
+            if (run < pos && hdr[1] == run_tx) {
+                for (off_t at = run; at < pos; ) {
+                    uint32_t rec[3];
+                    if (rd(src, rec, sizeof(rec), at) != sizeof(rec))
+                        return committed;
+                    if (rec[0] == WAL_TRUNCATE) {
+                        apply(ctx, WAL_TRUNCATE_PAGE, at);
+                        at += sizeof(WalTruncateRecord);
+                    } else {
+                        apply(ctx, rec[2], at);
+                        at += PAGE_RECORD;
+                    }
+                }
             }
-            pos += sizeof(cr);
+            pos += sizeof(WalCommitRecord);
+            committed = run = pos;
+            if (max_tx && ++commits == max_tx) break;
+        } else if (hdr[0] == WAL_PAGE || hdr[0] == WAL_TRUNCATE) {
+            off_t size = hdr[0] == WAL_PAGE ? PAGE_RECORD : (off_t)sizeof(WalTruncateRecord);
+            if (pos + size > end) break;
+            if (run < pos && hdr[1] != run_tx) run = pos;  /* torn transaction */
+            run_tx = hdr[1];
+            pos += size;
         } else {
-            WalPageRecord pr;
-            lseek(wal_fd, -(off_t)sizeof(uint32_t), SEEK_CUR);
-            read(wal_fd, &pr, sizeof(pr));
-            pos += sizeof(pr);
+            break;
         }
     }
+    return committed;
+}
 
-    pos = snapshot;
-    while (pos > (off_t)sizeof(WalPageRecord)) {
-        pos -= sizeof(WalPageRecord);
-        lseek(wal_fd, pos, SEEK_SET);
+static ssize_t wal_pread(void *src, void *buf, size_t n, off_t off) {
+    return pread(*(int *)src, buf, n, off);
+}
 
-        WalPageRecord pr;
-        if (read(wal_fd, &pr, sizeof(pr)) <= 0) break;
+static uint32_t truncate_page_count(off_t at) {
+    WalTruncateRecord rec;
+    if (pread(wal_fd, &rec, sizeof(rec), at) != sizeof(rec)) return UINT32_MAX;
+    return rec.page_count;
+}
 
-        if (pr.type == WAL_PAGE &&
-            pr.page_id == page_id &&
-            pr.tx_id < MAX_TX &&
-            committed[pr.tx_id]) {
-            memcpy(out, pr.data, PAGE_SIZE);
-            return true;
-        }
+/* Also drops the unused rest of the last extent. The file has just been
+ * compacted, so growth starts over from MIN_EXTENT. */
+static void truncate_db(uint32_t page_count) {
+    if (ftruncate(db_fd, page_offset(page_count)) != 0) {
+        perror("truncate db");
+        exit(1);
     }
+    db_size = page_offset(page_count);
+    db_resized = true;
+    header.extent_size = 0;
+    if (page_base)
+        write_header();
+}
 
-    return false;
+/* ================= WAL LOOKUP ================= */
+/* Fallback for pages past the end of the shared index: walk the log and
+ * keep the last committed frame of page_id below the snapshot. */
+typedef struct {
+    uint32_t page_id;
+    off_t found;
+} WalFind;
+
+static void find_frame(void *ctx, uint32_t page_id, off_t at) {
+    WalFind *f = ctx;
+    if (page_id == WAL_TRUNCATE_PAGE) {
+        if (f->page_id >= truncate_page_count(at)) f->found = -1;
+    } else if (page_id == f->page_id) {
+        f->found = at;
+    }
+}
+
+static bool wal_read_page(uint32_t page_id, uint64_t snapshot, void *out) {
+    WalFind f = { page_id, -1 };
+    wal_replay(wal_pread, &wal_fd, 0, (off_t)snapshot, 0, find_frame, &f);
+    if (f.found < 0) return false;
+    return pread(wal_fd, out, page_size, f.found + sizeof(WalPageRecord)) == (ssize_t)page_size;
 }
 
 /* ================= HIGH-LEVEL API ================= */
 static void write_page_int(WriteTxn *tx, uint32_t page_id, void *data) {
+    pthread_mutex_lock(&cache_lock);
     CachedPage* cp = get_or_create_cached_page(page_id, tx->tx_id);
-    memcpy(cp->data, data, PAGE_SIZE);
+    memcpy(cp->data, data, page_size);
     cp->dirty = true;
     cp->owner_tx = tx->tx_id;
+    pthread_mutex_unlock(&cache_lock);
+    staging_tx = tx->tx_id;
 }
 
 static void commit_tx(WriteTxn *tx) {
+    uint32_t *pages = NULL;
+    uint64_t *offsets = NULL;
+    size_t n = 0;
+
+    pthread_mutex_lock(&cache_lock);
+    if (cache_count) {
+        pages = malloc(cache_count * sizeof(uint32_t));
+        offsets = malloc(cache_count * sizeof(uint64_t));
+        if (!pages || !offsets) { perror("commit"); exit(1); }
+    }
+    off_t pos = lseek(wal_fd, 0, SEEK_END);  /* single writer: appends land here */
     for (size_t i = 0; i < cache_count; i++) {
         if (cache[i].dirty && cache[i].owner_tx == tx->tx_id) {
             wal_append_page(tx, cache[i].page_id, cache[i].data);
-            cache[i].dirty = false;
+            pages[n] = cache[i].page_id;
+            offsets[n++] = (uint64_t)pos;
+            pos += PAGE_RECORD;
         }
     }
+    pthread_mutex_unlock(&cache_lock);
     wal_commit(tx);
+
+    /* Durable: make the frames findable, then visible to new snapshots */
+    off_t wal_size = lseek(wal_fd, 0, SEEK_END);
+    walshm_publish(pages, offsets, n, (uint64_t)wal_size);
+    free(pages);
+    free(offsets);
+
+    /* Only now are the pages readable from the WAL, so only now may they
+     * be evicted. */
+    pthread_mutex_lock(&cache_lock);
+    for (size_t i = 0; i < cache_count; i++) {
+        if (cache[i].dirty && cache[i].owner_tx == tx->tx_id) {
+            cache[i].dirty = false;
+            cache[i].committed = (uint64_t)wal_size;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    if (staging_tx == tx->tx_id)
+        staging_tx = 0;
+
+    if (wal_size - checkpoint_requested_at >= (off_t)CHECKPOINT_WAL_BYTES) {
+        checkpoint_requested_at = wal_size;
+        waldb_checkpoint_async();
+    }
+}
+
+/* A transaction that fails before commit drops what it staged; readers
+ * then find the pages' committed images again. */
+static void rollback_tx(WriteTxn *tx) {
+    pthread_mutex_lock(&cache_lock);
+    for (size_t i = 0; i < cache_count; i++) {
+        if (cache[i].dirty && cache[i].owner_tx == tx->tx_id) {
+            cache[i].dirty = false;
+            cache[i].page_id = UINT32_MAX;  /* matches no page: the slot is free */
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    if (staging_tx == tx->tx_id)
+        staging_tx = 0;
 }
 
 /* ================= READ API ================= */
+/* A cached page is only this reader's image if it is staged by the
+ * reader's own write, or committed no later than its snapshot. Otherwise
+ * the image it needs is in the WAL or the db file. */
 static void read_page_int(ReaderTxn *rx, uint32_t page_id, void *out) {
+    pthread_mutex_lock(&cache_lock);
     CachedPage* cp = find_cached_page(page_id);
-    if (cp) {
-        memcpy(out, cp->data, PAGE_SIZE);
+    if (cp && (cp->dirty ? cp->owner_tx == staging_tx && staging_tx != 0
+                         : cp->committed <= rx->snapshot)) {
+        memcpy(out, cp->data, page_size);
+        pthread_mutex_unlock(&cache_lock);
         return;
     }
+    pthread_mutex_unlock(&cache_lock);
 
-    if (!wal_read_page(page_id, rx->snapshot, out)) {
-        read_page_from_db(page_id, out);
+    int64_t at = walshm_lookup(page_id, rx->snapshot);
+    if (at >= 0) {
+        if (pread(wal_fd, out, page_size, (off_t)at + sizeof(WalPageRecord)) == (ssize_t)page_size)
+            return;
+        at = WALSHM_UNKNOWN;
     }
+    if (at == WALSHM_UNKNOWN && wal_read_page(page_id, rx->snapshot, out))
+        return;
+    read_page_from_db(page_id, out);
 }
 
 /* ================= CHECKPOINT ================= */
-static uint64_t oldest_reader_snapshot() {
-    if (reader_count == 0) return 0;
-    uint64_t min = ULLONG_MAX;
-    for (size_t i = 0; i < reader_count; i++) {
-        if (reader_snapshots[i] < min) min = reader_snapshots[i];
-    }
-    return min;
-}
-
+/* Copies committed frames into the db file, from where the last checkpoint
+ * stopped up to the oldest snapshot still registered by any process. */
 static void checkpoint_int() {
-    uint64_t safe = oldest_reader_snapshot();
-    off_t pos = 0;
-    lseek(wal_fd, 0, SEEK_SET);
+    if (read_only) return;
+    pthread_mutex_lock(&checkpoint_lock);
+    uint64_t safe = walshm_checkpoint_target(backfilled);
+    off_t pos = (off_t)backfilled;
 
+    /* pread only: a background checkpoint must not move the shared offset */
+    WalPageRecord *pr = malloc(PAGE_RECORD);
+    if (!pr) { perror("checkpoint"); exit(1); }
     while (pos < (off_t)safe) {
         uint32_t type;
-        if (read(wal_fd, &type, sizeof(type)) <= 0) break;
+        if (pread(wal_fd, &type, sizeof(type), pos) != sizeof(type)) break;
 
         if (type == WAL_PAGE) {
-            WalPageRecord pr;
-            lseek(wal_fd, -(off_t)sizeof(uint32_t), SEEK_CUR);
-            read(wal_fd, &pr, sizeof(pr));
-            write_page_to_db(pr.page_id, pr.data);
-            pos += sizeof(pr);
+            if (pread(wal_fd, pr, PAGE_RECORD, pos) != PAGE_RECORD) break;
+            write_page_to_db(pr->page_id, pr->data);
+            pos += PAGE_RECORD;
+        } else if (type == WAL_TRUNCATE) {
+            truncate_db(truncate_page_count(pos));
+            pos += sizeof(WalTruncateRecord);
         } else {
-            WalCommitRecord cr;
-            lseek(wal_fd, -(off_t)sizeof(uint32_t), SEEK_CUR);
-            read(wal_fd, &cr, sizeof(cr));
-            pos += sizeof(cr);
+            pos += sizeof(WalCommitRecord);
         }
     }
 
-    fsync(db_fd);
+    free(pr);
+    sync_db();
+    backfilled = safe;
+    walshm_checkpoint_done(safe);
+    pthread_mutex_unlock(&checkpoint_lock);
 }
 
 /* ================= RECOVERY ================= */
+static void recover_frame(void *ctx, uint32_t page_id, off_t at) {
+    (void)ctx;
+    if (page_id == WAL_TRUNCATE_PAGE) {
+        truncate_db(truncate_page_count(at));
+        return;
+    }
+    uint8_t *data = malloc(page_size);
+    if (!data) { perror("recover"); exit(1); }
+    if (pread(wal_fd, data, page_size, at + sizeof(WalPageRecord)) == (ssize_t)page_size)
+        write_page_to_db(page_id, data);
+    free(data);
+}
+
 static void wal_recover() {
-    bool committed[MAX_TX] = {false};
-    lseek(wal_fd, 0, SEEK_SET);
+    off_t end = lseek(wal_fd, 0, SEEK_END);
+    off_t good = wal_replay(wal_pread, &wal_fd, 0, end, 0, recover_frame, NULL);
+    sync_db();
 
-    while (true) {
-        uint32_t type;
-        if (read(wal_fd, &type, sizeof(type)) <= 0) break;
-
-        if (type == WAL_COMMIT) {
-            WalCommitRecord cr;
-            lseek(wal_fd, -(off_t)sizeof(uint32_t), SEEK_CUR);
-            read(wal_fd, &cr, sizeof(cr));
-            if (cr.magic == WAL_MAGIC_COMMIT && cr.tx_id < MAX_TX) {
-                committed[cr.tx_id] = true;
-            }
-        } else {
-            WalPageRecord pr;
-            lseek(wal_fd, -(off_t)sizeof(uint32_t), SEEK_CUR);
-            read(wal_fd, &pr, sizeof(pr));
-            if (pr.tx_id < MAX_TX && committed[pr.tx_id]) {
-                write_page_to_db(pr.page_id, pr.data);
-            }
+    /* A crash mid-commit leaves a torn tail. Cut it off, or the next
+     * appends would land behind bytes that no replay can get past. */
+    if (good < end) {
+        if (ftruncate(wal_fd, good) != 0) { perror("truncate wal"); exit(1); }
+        fsync(wal_fd);
+    }
+}
+
+/* ================= REPLICATION ================= */
+/* A follower replays the primary's WAL into its own database: each chunk
+ * of the primary's log becomes one local transaction, committed, indexed
+ * and checkpointed like any other. Frames are whole page images, so
+ * replaying a transaction twice (e.g. after a crash before the follower
+ * recorded its position) leaves the same pages. */
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+    WriteTxn tx;
+    size_t frames;
+} WalChunk;
+
+static ssize_t chunk_read(void *src, void *out, size_t n, off_t off) {
+    WalChunk *c = src;
+    if ((size_t)off >= c->len) return 0;
+    if (n > c->len - (size_t)off) n = c->len - (size_t)off;
+    memcpy(out, c->buf + off, n);
+    return (ssize_t)n;
+}
+
+static void replay_frame(void *ctx, uint32_t page_id, off_t at) {
+    WalChunk *c = ctx;
+    if (page_id == WAL_TRUNCATE_PAGE) return;  /* the follower's file keeps its size */
+    write_page_int(&c->tx, page_id, (void *)(c->buf + at + sizeof(WalPageRecord)));
+    c->frames++;
+}
+
+/* ================= CHANGE DATA CAPTURE ================= */
+/* A CDC cursor walks the committed WAL one transaction at a time, in
+ * commit order, from an LSN (a commit end). For every page a transaction
+ * wrote it reports the frame holding the new image and the frame holding
+ * the image before it, so a consumer can tell what changed. The cursor
+ * keeps the newest frame of every page it has passed in a hash map, built
+ * by one scan of the log below the starting LSN; it never reads the
+ * database file, so checkpoints do not disturb it. */
+typedef struct {
+    uint32_t page_id;
+    int64_t before;           /* frame with the previous image; -1 = none */
+    int64_t after;
+} CdcFrame;
+
+typedef struct WalCdc {
+    uint64_t lsn;             /* end of the last transaction returned */
+    uint32_t *pages;          /* page -> newest frame, open addressing */
+    uint64_t *frames;         /* offset + 1; 0 = empty slot */
+    size_t map_cap, map_count;
+    CdcFrame *tx;             /* the current transaction */
+    size_t tx_count, tx_cap;
+} WalCdc;
+
+static inline size_t page_hash(uint32_t page_id) {
+    return page_id * 2654435761u;
+}
+
+static int64_t cdc_get(WalCdc *c, uint32_t page_id) {
+    if (!c->map_cap) return -1;
+    for (size_t i = page_hash(page_id) & (c->map_cap - 1); c->frames[i];
+         i = (i + 1) & (c->map_cap - 1)) {
+        if (c->pages[i] == page_id) return (int64_t)c->frames[i] - 1;
+    }
+    return -1;
+}
+
+static void cdc_put(WalCdc *c, uint32_t page_id, off_t at) {
+    if ((c->map_count + 1) * 2 > c->map_cap) {
+        size_t cap = c->map_cap ? c->map_cap * 2 : 1024;
+        uint32_t *pages = calloc(cap, sizeof(uint32_t));
+        uint64_t *frames = calloc(cap, sizeof(uint64_t));
+        if (!pages || !frames) { perror("cdc map"); exit(1); }
+        for (size_t i = 0; i < c->map_cap; i++) {
+            if (!c->frames[i]) continue;
+            size_t j = page_hash(c->pages[i]) & (cap - 1);
+            while (frames[j]) j = (j + 1) & (cap - 1);
+            pages[j] = c->pages[i];
+            frames[j] = c->frames[i];
         }
+        free(c->pages);
+        free(c->frames);
+        c->pages = pages;
+        c->frames = frames;
+        c->map_cap = cap;
     }
+    size_t i = page_hash(page_id) & (c->map_cap - 1);
+    while (c->frames[i] && c->pages[i] != page_id) i = (i + 1) & (c->map_cap - 1);
+    if (!c->frames[i]) c->map_count++;
+    c->pages[i] = page_id;
+    c->frames[i] = (uint64_t)at + 1;
+}
+
+/* Truncate records are skipped: only free pages are cut off, and their
+ * last image (a tombstone) decodes to no rows, the same as no image. */
+static void cdc_track(void *ctx, uint32_t page_id, off_t at) {
+    if (page_id != WAL_TRUNCATE_PAGE) cdc_put(ctx, page_id, at);
+}
+
+static void cdc_collect(void *ctx, uint32_t page_id, off_t at) {
+    WalCdc *c = ctx;
+    if (page_id == WAL_TRUNCATE_PAGE) return;
+    for (size_t i = 0; i < c->tx_count; i++) {
+        if (c->tx[i].page_id == page_id) { c->tx[i].after = at; return; }
+    }
+    if (c->tx_count == c->tx_cap) {
+        size_t cap = c->tx_cap ? c->tx_cap * 2 : 64;
+        CdcFrame *grown = realloc(c->tx, cap * sizeof(CdcFrame));
+        if (!grown) { perror("cdc"); exit(1); }
+        c->tx = grown;
+        c->tx_cap = cap;
+    }
+    c->tx[c->tx_count++] = (CdcFrame){ page_id, cdc_get(c, page_id), at };
+}
 
-    fsync(db_fd);
+static void read_frame_image(int64_t at, void *out) {
+    if (at < 0 || pread(wal_fd, out, page_size, at + sizeof(WalPageRecord)) != (ssize_t)page_size)
+        memset(out, 0, page_size);
 }
 
 /* =============== PUBLIC API WRAPPERS =============== */
@@ -305,12 +740,49 @@ void waldb_open(const char* path) {
     if (opened) return;
     open_database(path);
     wal_recover();
+    /* Recovery left every committed frame in the db file */
+    backfilled = (uint64_t)lseek(wal_fd, 0, SEEK_END);
+    if (walshm_open(path, true) != 0) {
+        if (errno == EAGAIN || errno == EACCES)
+            fprintf(stderr, "%s is open for writing in another process\n", path);
+        else
+            perror("open shm");
+        exit(1);
+    }
+    walshm_reset(backfilled);
+    checkpoint_requested_at = (off_t)backfilled;
     opened = true;
 }
 
+/* Attach to a database whose writer is another process: no recovery, no
+ * writes, reads through the writer's shared WAL index. Returns -1 if the
+ * writer is not running (no -shm file, or none its writer still holds). */
+int waldb_open_readonly(const char* path) {
+    db_fd = open(path, O_RDONLY);
+    char wal_name[256];
+    snprintf(wal_name, sizeof(wal_name), "%s-wal", path);
+    wal_fd = open(wal_name, O_RDONLY);
+    if (db_fd < 0 || wal_fd < 0 || walshm_open(path, false) != 0) {
+        if (db_fd >= 0) close(db_fd);
+        if (wal_fd >= 0) close(wal_fd);
+        db_fd = wal_fd = -1;
+        return -1;
+    }
+    load_header(false);
+    read_only = true;
+    return 0;
+}
+
 void waldb_close(void) {
+    waldb_pool_stop();  /* let queued background checkpoints finish */
     if (db_fd >= 0) close(db_fd);
     if (wal_fd >= 0) close(wal_fd);
+    walshm_close();
+    /* Slots are page_size long; the next database may use another size */
+    for (size_t i = 0; i < cache_count; i++)
+        free(cache[i].data);
+    cache_count = 0;
+    cache_hand = 0;
 }
 
 WriteTxn waldb_begin_write(void) {
@@ -321,6 +793,10 @@ ReaderTxn waldb_begin_read(void) {
     return begin_read_txn();
 }
 
+void waldb_end_read(ReaderTxn* txn) {
+    end_read_txn(txn);
+}
+
 void waldb_write_page(WriteTxn* txn, uint32_t page_id, const void* data) {
     write_page_int(txn, page_id, (void*)data);
 }
@@ -329,6 +805,10 @@ void waldb_read_page(ReaderTxn* txn, uint32_t page_id, void* buffer) {
     read_page_int(txn, page_id, buffer);
 }
 
+void waldb_rollback(WriteTxn* txn) {
+    rollback_tx(txn);
+}
+
 void waldb_commit(WriteTxn* txn) {
     commit_tx(txn);
 }
@@ -337,6 +817,128 @@ void waldb_checkpoint(void) {
     checkpoint_int();
 }
 
+/* Shrink the db file to page_count pages, as a transaction of its own.
+ * The caller must no longer use any page at or past page_count. The cut
+ * happens when a checkpoint backfills past the record. By then no
+ * snapshot older than the record remains, because the checkpoint never
+ * passes a registered reader. Recovery replays it in order. */
+void waldb_truncate(uint32_t page_count) {
+    WriteTxn tx = begin_write_txn();
+    WalTruncateRecord rec = { WAL_TRUNCATE, tx.tx_id, page_count };
+    if (write(wal_fd, &rec, sizeof(rec)) != sizeof(rec)) {
+        perror("write wal truncate");
+        exit(1);
+    }
+    wal_commit(&tx);
+    walshm_publish(NULL, NULL, 0, (uint64_t)lseek(wal_fd, 0, SEEK_END));
+}
+
+/* Size of the db file in pages: what checkpoints have written so far and
+ * the unused rest of the last extent. */
+uint64_t waldb_db_pages(void) {
+    struct stat st;
+    if (fstat(db_fd, &st) != 0) return 0;
+    if (st.st_size <= page_base) return 0;
+    return (uint64_t)(st.st_size - page_base) / page_size;
+}
+
+/* Page size of databases created from now on; -1 if not a power of two
+ * between 4 KB and 64 KB. An existing database keeps its own. */
+int waldb_set_page_size(uint32_t size) {
+    if (!valid_page_size(size)) return -1;
+    create_page_size = size;
+    return 0;
+}
+
+/* Page size of the open database. */
+uint32_t waldb_page_size(void) {
+    return page_size;
+}
+
+/* Page size recorded in the db file at path, without opening it as the
+ * database: 4096 for a file without a header, 0 if there is no file. */
+uint32_t waldb_file_page_size(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    DbHeader h;
+    bool found = read_header(fd, &h);
+    close(fd);
+    return found ? h.page_size : DEFAULT_PAGE_SIZE;
+}
+
+/* The WAL only grows, so its end after the latest commit doubles as a
+ * monotonic commit LSN, shared by every process attached to the index. */
+uint64_t waldb_commit_lsn(void) {
+    return walshm_end();
+}
+
+void waldb_set_replica(bool on) {
+    replica = on;
+}
+
+/* Apply the committed transactions at the start of buf, a slice of the
+ * primary's WAL that begins on a record boundary. Returns how many bytes
+ * were consumed: everything up to the end of the last complete commit.
+ * The caller resumes there with more of the log. */
+size_t waldb_replica_apply(const void *buf, size_t len) {
+    WalChunk c = { buf, len, begin_write_txn(), 0 };
+    off_t used = wal_replay(chunk_read, &c, 0, (off_t)len, 0, replay_frame, &c);
+    if (c.frames) commit_tx(&c.tx);
+    return (size_t)used;
+}
+
+/* Start a change stream after the transaction ending at lsn (0: from the
+ * beginning). NULL if lsn is not a commit end at or below the commit LSN. */
+WalCdc *waldb_cdc_open(uint64_t lsn) {
+    if (lsn > walshm_end()) return NULL;
+    WalCdc *c = calloc(1, sizeof(WalCdc));
+    if (!c) return NULL;
+    c->lsn = lsn;
+    if ((uint64_t)wal_replay(wal_pread, &wal_fd, 0, (off_t)lsn, 0, cdc_track, c) != lsn) {
+        free(c->pages);
+        free(c->frames);
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+/* Move to the next committed transaction. Returns how many pages it wrote
+ * (0 for an empty one), or -1 if nothing newer has committed yet. */
+int64_t waldb_cdc_next(WalCdc *c) {
+    c->tx_count = 0;
+    off_t end = wal_replay(wal_pread, &wal_fd, (off_t)c->lsn, (off_t)walshm_end(), 1,
+                           cdc_collect, c);
+    if ((uint64_t)end == c->lsn) return -1;
+    for (size_t i = 0; i < c->tx_count; i++)
+        cdc_put(c, c->tx[i].page_id, (off_t)c->tx[i].after);
+    c->lsn = (uint64_t)end;
+    return (int64_t)c->tx_count;
+}
+
+/* Commit end of the current transaction: the LSN to resume from. */
+uint64_t waldb_cdc_lsn(WalCdc *c) {
+    return c->lsn;
+}
+
+/* The i-th page of the current transaction and its images before and after
+ * it (before is zeroed if the page had never been written). -1 if i is out
+ * of range. */
+int64_t waldb_cdc_page(WalCdc *c, size_t i, void *before, void *after) {
+    if (i >= c->tx_count) return -1;
+    read_frame_image(c->tx[i].before, before);
+    read_frame_image(c->tx[i].after, after);
+    return c->tx[i].page_id;
+}
+
+void waldb_cdc_close(WalCdc *c) {
+    if (!c) return;
+    free(c->pages);
+    free(c->frames);
+    free(c->tx);
+    free(c);
+}
+
 /* =============== PYTHON-FRIENDLY EXPORTS =============== */
 // These match the names used in executor.py
 
@@ -350,7 +952,26 @@ void* begin_read(void) {
     return txn;
 }
 
+int open_db_readonly(const char* path) {
+    return waldb_open_readonly(path);
+}
+
+void end_read(void* txn_ptr) {
+    if (!txn_ptr) return;
+    waldb_end_read((ReaderTxn*)txn_ptr);
+    free(txn_ptr);
+}
+
+void set_replica(int on) {
+    waldb_set_replica(on != 0);
+}
+
+size_t replica_apply(const void *buf, size_t len) {
+    return waldb_replica_apply(buf, len);
+}
+
 void* begin_write(void) {
+    if (read_only || replica) return NULL;
     WriteTxn* txn = malloc(sizeof(WriteTxn));
     *txn = waldb_begin_write();
     return txn;
@@ -363,23 +984,80 @@ void commit(void* txn_ptr) {
     free(txn);
 }
 
+void rollback(void* txn_ptr) {
+    if (!txn_ptr) return;
+    WriteTxn* txn = (WriteTxn*)txn_ptr;
+    waldb_rollback(txn);
+    free(txn);
+}
+
 void checkpoint(void) {
     waldb_checkpoint();
 }
 
-unsigned char (*read_page(void* txn_ptr, int page_id))[4096] {
-    static unsigned char buffer[4096];
-    memset(buffer, 0, sizeof(buffer));
+void checkpoint_async(void) {
+    waldb_checkpoint_async();
+}
+
+uint64_t commit_lsn(void) {
+    return waldb_commit_lsn();
+}
+
+void truncate_db_pages(uint32_t page_count) {
+    if (read_only || replica) return;
+    waldb_truncate(page_count);
+}
+
+uint64_t db_pages(void) {
+    return waldb_db_pages();
+}
+
+int set_page_size(uint32_t size) {
+    return waldb_set_page_size(size);
+}
+
+uint32_t page_size_of_db(void) {
+    return waldb_page_size();
+}
+
+uint32_t file_page_size(const char *path) {
+    return waldb_file_page_size(path);
+}
+
+void* cdc_open(uint64_t lsn) {
+    return waldb_cdc_open(lsn);
+}
+
+int64_t cdc_next(void* cdc) {
+    return waldb_cdc_next((WalCdc*)cdc);
+}
+
+uint64_t cdc_lsn(void* cdc) {
+    return waldb_cdc_lsn((WalCdc*)cdc);
+}
+
+int64_t cdc_page(void* cdc, size_t i, unsigned char* before, unsigned char* after) {
+    return waldb_cdc_page((WalCdc*)cdc, i, before, after);
+}
+
+void cdc_close(void* cdc) {
+    waldb_cdc_close((WalCdc*)cdc);
+}
+
+/* out and data hold page_size_of_db() bytes. out belongs to the caller,
+ * so threads reading at once never share a buffer. */
+void read_page(void* txn_ptr, int page_id, unsigned char *out) {
+    if (!out) return;
     if (!txn_ptr) {
-        return &buffer;
+        memset(out, 0, page_size);
+        return;
     }
     ReaderTxn* txn = (ReaderTxn*)txn_ptr;
-    waldb_read_page(txn, (uint32_t)page_id, buffer);
-    return &buffer;
+    waldb_read_page(txn, (uint32_t)page_id, out);
 }
 
-void write_page(void* txn_ptr, int page_id, unsigned char (*data)[4096]) {
+void write_page(void* txn_ptr, int page_id, unsigned char *data) {
     if (!txn_ptr || !data) return;
     WriteTxn* txn = (WriteTxn*)txn_ptr;
-    waldb_write_page(txn, (uint32_t)page_id, *data);
+    waldb_write_page(txn, (uint32_t)page_id, data);
 }
\ No newline at end of file
@@ -10,16 +10,80 @@ extern "C" {
 #endif
 
 typedef struct { uint32_t id; } WriteTxn;
-typedef struct { uint64_t snapshot; } ReaderTxn;
+typedef struct { uint64_t snapshot; int32_t slot; } ReaderTxn;
 
 void waldb_open(const char* path);
 void waldb_close(void);
 WriteTxn waldb_begin_write(void);
 ReaderTxn waldb_begin_read(void);
+/* Release a snapshot so checkpoints may move past it. */
+void waldb_end_read(ReaderTxn* txn);
+/* Attach read-only to a database another process has open for writing;
+ * -1 if that writer's shared WAL index (<path>-shm) is not there. */
+int waldb_open_readonly(const char* path);
+/* Follower mode: refuse ordinary writes and replay a primary's WAL instead.
+ * waldb_replica_apply takes a slice of that WAL starting at a record
+ * boundary and returns the bytes consumed (up to its last full commit). */
+void waldb_set_replica(bool on);
+size_t waldb_replica_apply(const void* buf, size_t len);
 void waldb_write_page(WriteTxn* txn, uint32_t page_id, const void* data);
 void waldb_read_page(ReaderTxn* txn, uint32_t page_id, void* buffer);
 void waldb_commit(WriteTxn* txn);
+/* Discard the pages txn has staged instead of committing them. */
+void waldb_rollback(WriteTxn* txn);
 void waldb_checkpoint(void);
+/* WAL offset just past the latest commit record; grows with every commit. */
+uint64_t waldb_commit_lsn(void);
+/* Log a cut of the db file to page_count pages; a later checkpoint applies
+ * it. waldb_db_pages is the file's current size in pages. */
+void waldb_truncate(uint32_t page_count);
+uint64_t waldb_db_pages(void);
+/* Page size, a power of two from 4 KB to 64 KB, is fixed when a database
+ * is created and kept in its file header. waldb_set_page_size picks it
+ * for databases created by later opens; waldb_page_size is the open
+ * database's; waldb_file_page_size reads it from a db file on disk. */
+int waldb_set_page_size(uint32_t size);
+uint32_t waldb_page_size(void);
+uint32_t waldb_file_page_size(const char* path);
+/* Change data capture: a cursor over committed transactions in commit
+ * order, resumable from any commit end. waldb_cdc_next returns the number
+ * of pages the next transaction wrote (-1: none yet); waldb_cdc_page
+ * copies the i-th page's images before and after it. */
+typedef struct WalCdc WalCdc;
+WalCdc* waldb_cdc_open(uint64_t lsn);
+int64_t waldb_cdc_next(WalCdc* cdc);
+uint64_t waldb_cdc_lsn(WalCdc* cdc);
+int64_t waldb_cdc_page(WalCdc* cdc, size_t i, void* before, void* after);
+void waldb_cdc_close(WalCdc* cdc);
+/* Queue a checkpoint on the task pool at background priority. */
+void waldb_checkpoint_async(void);
+
+/* Shared work-stealing task pool (taskpool.c). Lower priority values run
+ * first; the pool starts lazily with WALDB_WORKERS or one worker per CPU. */
+enum { WALDB_PRIO_HIGH = 0, WALDB_PRIO_NORMAL = 1, WALDB_PRIO_BACKGROUND = 2, WALDB_PRIO_LEVELS = 3 };
+
+typedef void (*waldb_task_fn)(void* arg);
+typedef struct WaldbTaskGroup WaldbTaskGroup;
+
+typedef struct {
+    uint64_t workers;
+    uint64_t queued;
+    uint64_t submitted[WALDB_PRIO_LEVELS];
+    uint64_t executed[WALDB_PRIO_LEVELS];
+    uint64_t wait_ns[WALDB_PRIO_LEVELS];  /* total submit-to-start latency */
+    uint64_t max_wait_ns;
+    uint64_t steals;
+    uint64_t steal_attempts;
+} WaldbPoolStats;
+
+int waldb_pool_start(int nworkers);
+void waldb_pool_stop(void);
+int waldb_pool_size(void);
+WaldbTaskGroup* waldb_group_new(void);
+void waldb_spawn(WaldbTaskGroup* group, int priority, waldb_task_fn fn, void* arg);
+void waldb_group_wait(WaldbTaskGroup* group);
+void waldb_group_free(WaldbTaskGroup* group);
+void waldb_pool_stats(WaldbPoolStats* out);
 
 int hash_join(
     const char* inner_pages[],
@@ -32,6 +96,63 @@ int hash_join(
     size_t max_output_size
 );
 
+/* Build once, probe many: hj_probe returns the output bytes used (-1 on
+ * error) and stops before an outer row whose matches do not fit, leaving
+ * *consumed at that row and *need at the bytes its matches take. */
+void* hj_build(const char* rows[], size_t count, const char* key_name);
+long long hj_probe(void* hj, const char* rows[], size_t count, const char* key_name,
+                   int build_overrides, char* output_buffer, size_t max_output_size,
+                   size_t* consumed, size_t* need);
+void hj_free(void* hj);
+
+/* Same as hash_join, but inner (build) columns win over outer ones. */
+int hash_join_build_overrides(
+    const char* inner_pages[],
+    size_t inner_count,
+    const char* outer_pages[],
+    size_t outer_count,
+    const char* inner_key_name,
+    const char* outer_key_name,
+    char* output_buffer,
+    size_t max_output_size
+);
+
+/* ---- Vectorized batch engine (vexec.c) ----
+ * Column types: 0 = INT, 1 = TEXT. Ops: 0 =, 1 <, 2 <=, 3 >, 4 >=.
+ * Aggregates: 0 COUNT, 1 SUM, 2 MIN, 3 MAX (col -1 = COUNT(*)).
+ */
+void* vx_plan_new(const char* table);
+int vx_plan_column(void* plan, const char* name, int type);
+int vx_plan_filter_int(void* plan, int col, int op, int64_t value);
+int vx_plan_filter_text(void* plan, int col, int op, const char* value);
+int vx_plan_dictionary(void* plan, int col, const char* const* values, size_t n);
+int vx_plan_output(void* plan, int col);
+int vx_plan_group_by(void* plan, int col);
+int vx_plan_aggregate(void* plan, int func, int col);
+void vx_plan_pages(void* plan, const uint32_t* pages, size_t n);
+void vx_plan_parallel(void* plan, int nworkers, int ordered);
+size_t vx_next_batch(void* plan);
+const int64_t* vx_batch_ints(void* plan, int out);
+const uint8_t* vx_batch_nulls(void* plan, int out);
+const char* vx_batch_text(void* plan, int out, size_t row, size_t* len);
+void vx_plan_free(void* plan);
+
+/* ---- External merge sort (extsort.c) ----
+ * Records are (normalized key, payload) byte strings ordered by memcmp on
+ * the key, ties in insertion order. Runs are sized to the memory budget
+ * (0: 64MB), sorted on the task pool and spilled under tmpdir (NULL:
+ * $TMPDIR or /tmp); xs_next merges them with a loser tree, after
+ * intermediate passes if there are more runs than the budget and the fd
+ * limit allow to read at once. xs_next returns -1 if a record cannot be
+ * read back.
+ */
+void* xs_new(size_t mem_budget, const char* tmpdir);
+int xs_add(void* sort, const void* key, size_t klen, const void* payload, size_t plen);
+int xs_finish(void* sort);
+int xs_next(void* sort, const char** payload, size_t* plen);
+size_t xs_runs(void* sort);
+void xs_free(void* sort);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,387 @@
+// walshm.c — shared-memory WAL index (<db>-shm)
+//
+// The writer publishes every committed WAL frame (page id + offset) into a
+// hash-chained frame table in a file mapped MAP_SHARED next to the WAL, plus
+// the commit end it covers. Any process mapping the file can then find the
+// newest frame of a page below its snapshot without scanning the log, and
+// registers that snapshot in a shared reader table so the checkpointer
+// never backfills the database file past what a live reader may still need.
+//
+// Frames the checkpoint has copied into the database file are no longer
+// needed: when the table fills, the writer compacts it down to the frames
+// at or past the completed backfill, so the index keeps up with a WAL of
+// any length. Only if a reader holds the checkpoint back until the table
+// is full of frames it may still need do frames go unindexed; that gap is
+// answered by scanning the WAL until the checkpoint has copied past it.
+//
+// Concurrency: one writer process publishes; readers never lock. A frame is
+// fully written before the release store that links it into its bucket, so
+// a reader either sees the complete frame or the previous chain head. The
+// compaction rewrites chains in place, so it runs inside a sequence lock:
+// a lookup that overlaps it retries. Reader
+// slots are claimed with CAS and record the owning pid. A process claims
+// up to SHM_OWN_SLOTS of them; its further readers share its newest one,
+// whose older snapshot protects them too. Slots of a process that died
+// without releasing them are reclaimed, so it cannot hold the checkpoint
+// back forever. A reader that registers while a checkpoint is choosing
+// its target runs a store-then-load handshake with it (both sides
+// seq_cst): either the checkpointer sees the slot, or the reader sees the
+// announced target and retries with a newer snapshot.
+//
+// The writer holds a write lock on the first byte of the file for as
+// long as it is open; a reader only attaches while that lock is held, so
+// it never follows an index a dead writer left behind.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHM_MAGIC   0x5045534dU   /* "PESM" */
+#define SHM_VERSION 3
+#define SHM_READERS 64
+#define SHM_OWN_SLOTS 8           /* slots one process claims before sharing */
+#define SHM_BUCKETS 8192          /* power of two */
+#define SHM_FRAMES  65536
+#define SHM_WRITER_LOCK 0         /* byte the writer keeps write-locked */
+
+#define WALSHM_ABSENT  (-1)       /* page has no frame below the snapshot */
+#define WALSHM_UNKNOWN (-2)       /* index does not cover it: scan the WAL */
+
+/* ================= LAYOUT ================= */
+typedef struct {
+    uint32_t page_id;
+    uint32_t prev;                /* older frame in this bucket, index + 1; 0 = end */
+    uint64_t offset;              /* of the WalPageRecord in the WAL */
+} ShmFrame;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    _Atomic uint64_t end;          /* WAL offset past the last published commit */
+    _Atomic uint64_t gap_from;     /* frames in [gap_from, gap_to) are not indexed; */
+    _Atomic uint64_t gap_to;       /*   UINT64_MAX: none */
+    _Atomic uint64_t backfill;     /* checkpoint target: the db file may hold frames below it */
+    _Atomic uint64_t backfilled;   /* the db file holds every frame below it */
+    _Atomic uint32_t seq;          /* odd while the writer compacts the table */
+    _Atomic uint32_t nframes;
+    _Atomic uint64_t readers[SHM_READERS];   /* snapshot + 1; 0 = free */
+    _Atomic int32_t owners[SHM_READERS];     /* pid holding the slot; 0 while claimed or free */
+    _Atomic uint32_t buckets[SHM_BUCKETS];   /* newest frame, index + 1 */
+    ShmFrame frames[SHM_FRAMES];
+} ShmIndex;
+
+static ShmIndex *shm = NULL;
+static int shm_fd = -1;
+static uint64_t compacted_at = UINT64_MAX;   /* backfilled as of the last compaction */
+/* Readers of this process using each slot; guarded by slots_lock. */
+static int slot_refs[SHM_READERS];
+static pthread_mutex_t slots_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint32_t bucket_of(uint32_t page_id) {
+    return (page_id * 2654435761u) & (SHM_BUCKETS - 1);
+}
+
+/* ================= OPEN / RESET ================= */
+/* Take (writer) or test for (reader) the writer's lock on the file. */
+static bool writer_lock(int fd, bool take) {
+    struct flock fl = { .l_type = F_WRLCK, .l_whence = SEEK_SET,
+                        .l_start = SHM_WRITER_LOCK, .l_len = 1 };
+    if (take) return fcntl(fd, F_SETLK, &fl) == 0;
+    fl.l_type = F_RDLCK;
+    return fcntl(fd, F_GETLK, &fl) == 0 && fl.l_type == F_WRLCK;
+}
+
+/* The writer creates and resets the index; readers attach to it as is,
+ * and only while its writer is alive. If no file can be mapped, a private
+ * anonymous mapping still gives the writer the same index, shared with
+ * nobody. Returns -1 if another writer has the file open. */
+int walshm_open(const char *db_path, bool writer) {
+    char name[512];
+    snprintf(name, sizeof(name), "%s-shm", db_path);
+
+    shm_fd = open(name, writer ? O_RDWR | O_CREAT : O_RDWR, 0644);
+    if (shm_fd >= 0 && writer && !writer_lock(shm_fd, true)) {
+        if (errno == EACCES || errno == EAGAIN) {
+            close(shm_fd);
+            shm_fd = -1;
+            return -1;
+        }
+    }
+    if (shm_fd >= 0 && !writer && !writer_lock(shm_fd, false)) {
+        close(shm_fd);
+        shm_fd = -1;
+        return -1;
+    }
+    if (shm_fd >= 0 && writer && ftruncate(shm_fd, sizeof(ShmIndex)) != 0) {
+        close(shm_fd);
+        shm_fd = -1;
+    }
+    if (shm_fd >= 0) {
+        struct stat st;
+        if (fstat(shm_fd, &st) == 0 && (size_t)st.st_size >= sizeof(ShmIndex))
+            shm = mmap(NULL, sizeof(ShmIndex), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+        if (shm == MAP_FAILED) shm = NULL;
+    }
+    if (!shm) {
+        if (!writer) return -1;
+        shm = mmap(NULL, sizeof(ShmIndex), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (shm == MAP_FAILED) { shm = NULL; return -1; }
+    }
+    if (!writer && (shm->magic != SHM_MAGIC || shm->version != SHM_VERSION))
+        return -1;
+    return 0;
+}
+
+/* Writer only, at open, once recovery has copied every committed frame into
+ * the database file: start from an empty index covering the whole WAL.
+ * Slots left by readers of a previous writer are dropped with it; reader
+ * processes attach (or reattach) after the writer has started. */
+void walshm_reset(uint64_t end) {
+    memset(shm->buckets, 0, sizeof(shm->buckets));
+    for (int i = 0; i < SHM_READERS; i++) {
+        atomic_store(&shm->readers[i], 0);
+        atomic_store(&shm->owners[i], 0);
+        slot_refs[i] = 0;
+    }
+    atomic_store(&shm->nframes, 0);
+    atomic_store(&shm->seq, 0);
+    atomic_store(&shm->gap_from, UINT64_MAX);
+    atomic_store(&shm->gap_to, UINT64_MAX);
+    atomic_store(&shm->backfill, end);
+    atomic_store(&shm->backfilled, end);
+    compacted_at = UINT64_MAX;
+    atomic_store(&shm->end, end);
+    shm->version = SHM_VERSION;
+    atomic_thread_fence(memory_order_release);
+    shm->magic = SHM_MAGIC;
+}
+
+void walshm_close(void) {
+    if (shm) munmap(shm, sizeof(ShmIndex));
+    if (shm_fd >= 0) close(shm_fd);
+    shm = NULL;
+    shm_fd = -1;
+}
+
+/* ================= WRITER ================= */
+
+/* Drop the frames below the completed backfill and relink the rest, in WAL
+ * order. Every registered snapshot is at or past the backfill, so a page
+ * whose newest frame below it was dropped reads the same image from the
+ * database file. A gap the checkpoint has copied past goes too. */
+static uint32_t compact(uint32_t count) {
+    uint64_t done = atomic_load(&shm->backfilled);
+    if (done == compacted_at) return count;
+    compacted_at = done;
+
+    atomic_fetch_add(&shm->seq, 1);
+    memset(shm->buckets, 0, sizeof(shm->buckets));
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (shm->frames[i].offset < done) continue;
+        _Atomic uint32_t *bucket = &shm->buckets[bucket_of(shm->frames[i].page_id)];
+        shm->frames[kept] = shm->frames[i];
+        shm->frames[kept].prev = atomic_load_explicit(bucket, memory_order_relaxed);
+        kept++;
+        atomic_store_explicit(bucket, kept, memory_order_relaxed);
+    }
+    if (atomic_load(&shm->gap_to) <= done) {
+        atomic_store(&shm->gap_from, UINT64_MAX);
+        atomic_store(&shm->gap_to, UINT64_MAX);
+    }
+    atomic_store(&shm->nframes, kept);
+    atomic_fetch_add(&shm->seq, 1);
+    return kept;
+}
+
+/* Publish one committed transaction's frames, in WAL order, then its end. */
+void walshm_publish(const uint32_t *pages, const uint64_t *offsets, size_t n, uint64_t end) {
+    uint32_t count = atomic_load_explicit(&shm->nframes, memory_order_relaxed);
+    if (count + n > SHM_FRAMES || atomic_load(&shm->gap_to) <= atomic_load(&shm->backfilled))
+        count = compact(count);
+    for (size_t i = 0; i < n; i++) {
+        if (count >= SHM_FRAMES) {
+            /* Still full: the rest of the frames up to end go unindexed */
+            if (atomic_load(&shm->gap_from) == UINT64_MAX)
+                atomic_store(&shm->gap_from, offsets[i]);
+            atomic_store(&shm->gap_to, end);
+            break;
+        }
+        _Atomic uint32_t *bucket = &shm->buckets[bucket_of(pages[i])];
+        ShmFrame *f = &shm->frames[count];
+        f->page_id = pages[i];
+        f->offset = offsets[i];
+        f->prev = atomic_load_explicit(bucket, memory_order_relaxed);
+        count++;
+        atomic_store_explicit(bucket, count, memory_order_release);
+    }
+    atomic_store_explicit(&shm->nframes, count, memory_order_release);
+    atomic_store_explicit(&shm->end, end, memory_order_release);
+}
+
+/* ================= READERS ================= */
+uint64_t walshm_end(void) {
+    return atomic_load_explicit(&shm->end, memory_order_acquire);
+}
+
+static int64_t lookup_once(uint32_t page_id, uint64_t snapshot) {
+    int64_t found = WALSHM_ABSENT;
+    uint32_t i = atomic_load_explicit(&shm->buckets[bucket_of(page_id)], memory_order_acquire);
+    for (uint32_t hops = 0; i && i <= SHM_FRAMES && hops < SHM_FRAMES; hops++) {
+        const ShmFrame *f = &shm->frames[i - 1];
+        if (f->page_id == page_id && f->offset < snapshot) {
+            found = (int64_t)f->offset;
+            break;
+        }
+        i = f->prev;
+    }
+    /* A frame newer than the gap is the answer; otherwise the gap may hold
+     * a newer one, unless the checkpoint has copied it (and older frames
+     * still indexed) into the database file. */
+    uint64_t gap_from = atomic_load_explicit(&shm->gap_from, memory_order_acquire);
+    uint64_t gap_to = atomic_load_explicit(&shm->gap_to, memory_order_acquire);
+    if (snapshot > gap_from && (found < 0 || (uint64_t)found < gap_to)) {
+        if (gap_to > atomic_load_explicit(&shm->backfilled, memory_order_acquire))
+            return WALSHM_UNKNOWN;
+        return WALSHM_ABSENT;
+    }
+    return found;
+}
+
+/* Offset of the newest frame of page_id below snapshot, or WALSHM_ABSENT /
+ * WALSHM_UNKNOWN. */
+int64_t walshm_lookup(uint32_t page_id, uint64_t snapshot) {
+    for (;;) {
+        uint32_t seq = atomic_load_explicit(&shm->seq, memory_order_acquire);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        int64_t at = lookup_once(page_id, snapshot);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&shm->seq, memory_order_relaxed) == seq)
+            return at;
+    }
+}
+
+/* Free the slots of processes that exited without releasing them. The
+ * owner is cleared first, so a reader claiming the slot once it is free
+ * never has its own pid overwritten. */
+static void reclaim_dead(void) {
+    pid_t self = getpid();
+    for (int i = 0; i < SHM_READERS; i++) {
+        uint64_t r = atomic_load(&shm->readers[i]);
+        int32_t owner = atomic_load(&shm->owners[i]);
+        if (!r || !owner || owner == self) continue;
+        if (kill(owner, 0) == 0 || errno != ESRCH) continue;
+        if (atomic_compare_exchange_strong(&shm->owners[i], &owner, 0))
+            atomic_compare_exchange_strong(&shm->readers[i], &r, 0);
+    }
+}
+
+/* A free slot claimed for snap while this process holds few, or else the
+ * one it holds with the newest snapshot; -1 if it holds none and none is
+ * free. */
+static int take_slot(uint64_t snap) {
+    int slot = -1, held = 0;
+    pthread_mutex_lock(&slots_lock);
+    for (int i = 0; i < SHM_READERS; i++) {
+        if (!slot_refs[i]) continue;
+        held++;
+        if (slot < 0 || atomic_load(&shm->readers[i]) > atomic_load(&shm->readers[slot]))
+            slot = i;
+    }
+    for (int i = 0; i < SHM_READERS && held < SHM_OWN_SLOTS; i++) {
+        uint64_t expect = 0;
+        if (atomic_compare_exchange_strong(&shm->readers[i], &expect, snap + 1)) {
+            atomic_store(&shm->owners[i], (int32_t)getpid());
+            slot = i;
+            break;
+        }
+    }
+    if (slot >= 0) slot_refs[slot]++;
+    pthread_mutex_unlock(&slots_lock);
+    return slot;
+}
+
+void walshm_reader_end(int slot) {
+    pthread_mutex_lock(&slots_lock);
+    if (--slot_refs[slot] == 0) {
+        atomic_store(&shm->owners[slot], 0);
+        atomic_store(&shm->readers[slot], 0);
+    }
+    pthread_mutex_unlock(&slots_lock);
+}
+
+/* Take a snapshot at the current commit end and register it. Returns the
+ * slot to pass to walshm_reader_end. Waits while every slot is held by
+ * other processes. */
+int walshm_reader_begin(uint64_t *snapshot) {
+    for (;;) {
+        uint64_t snap = walshm_end();
+        int slot = take_slot(snap);
+        if (slot < 0) {
+            reclaim_dead();
+            sched_yield();
+            continue;
+        }
+
+        /* Registered; now make sure no checkpoint has already gone past us */
+        if (atomic_load(&shm->backfill) <= snap) {
+            *snapshot = snap;
+            return slot;
+        }
+        walshm_reader_end(slot);
+        sched_yield();
+    }
+}
+
+/* ================= CHECKPOINT ================= */
+/* Choose how far the checkpoint may copy WAL frames into the database file,
+ * given it has already copied everything below done. Announces the target
+ * first, then re-reads the reader table, so a reader registering at the
+ * same time is either counted here or retries. */
+uint64_t walshm_checkpoint_target(uint64_t done) {
+    reclaim_dead();
+    uint64_t target = walshm_end();
+    if (target < done) target = done;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) atomic_store(&shm->backfill, target);
+        uint64_t limit = target;
+        for (int i = 0; i < SHM_READERS; i++) {
+            uint64_t r = atomic_load(&shm->readers[i]);
+            if (r && r - 1 < limit) limit = r - 1;
+        }
+        /* A reader below done is still validating and will retry */
+        target = limit < done ? done : limit;
+    }
+    atomic_store(&shm->backfill, target);
+    return target;
+}
+
+/* The checkpoint has copied every frame below done into the database file
+ * (and synced it): the index may drop them. */
+void walshm_checkpoint_done(uint64_t done) {
+    if (done > atomic_load(&shm->backfilled))
+        atomic_store(&shm->backfilled, done);
+}
+
+/* Reader slots in use now, by any process (for stats/tests). */
+int walshm_reader_count(void) {
+    int n = 0;
+    for (int i = 0; i < SHM_READERS; i++)
+        if (atomic_load(&shm->readers[i])) n++;
+    return n;
+}
@@ -0,0 +1,107 @@
+import asyncio
+import functools
+from concurrent.futures import ThreadPoolExecutor
+from typing import List, Dict, Any, Optional, Callable
+
+from rwlock import RWLock
+
+# ----------------------------
+# asyncio facade
+#
+# Everything that touches storage ends in a blocking ctypes call (page
+# reads, WAL appends, the commit fsync). ctypes.CDLL drops the GIL for the
+# length of each call, so running them on a dedicated thread pool keeps the
+# event loop free while other threads keep executing Python. Reads go to
+# a pool of storage threads. Writes go through a WriteCoalescer when one is
+# given: its futures resolve when the batch is durable, and awaiting them
+# uses no thread at all. Without one, writes run on a single writer thread,
+# because the write path assumes one writer. Reads and writes exclude each
+# other through an RWLock (the coalescer's, when there is one), since a
+# query walks the indexes a write mutates. A semaphore caps the storage
+# calls in flight. Callers beyond the cap wait, and a caller that waits
+# longer than admit_timeout gets Overloaded instead of adding to the queue.
+# ----------------------------
+
+STORAGE_THREADS = 8   # concurrent reads
+MAX_IN_FLIGHT = 64    # storage calls admitted at once (reads and writes)
+
+
+class Overloaded(Exception):
+    """No storage slot freed up within admit_timeout."""
+
+
+class AsyncDatabase:
+    """Awaitable front end of a Database for use from an event loop."""
+
+    def __init__(self, db, writes=None, threads: int = STORAGE_THREADS,
+                 max_in_flight: int = MAX_IN_FLIGHT, admit_timeout: Optional[float] = None):
+        self.db = db
+        self.writes = writes  # optional coalesce.WriteCoalescer
+        self.lock = writes.lock if writes is not None else RWLock()
+        self.admit_timeout = admit_timeout
+        self._readers = ThreadPoolExecutor(max_workers=threads, thread_name_prefix="pesadb-read")
+        self._writer = ThreadPoolExecutor(max_workers=1, thread_name_prefix="pesadb-write")
+        self._slots = asyncio.Semaphore(max_in_flight)
+        self.max_in_flight = max_in_flight
+        self.rejected = 0
+
+    async def _admit(self):
+        if self.admit_timeout is None:
+            await self._slots.acquire()
+            return
+        try:
+            await asyncio.wait_for(self._slots.acquire(), self.admit_timeout)
+        except asyncio.TimeoutError:
+            self.rejected += 1
+            raise Overloaded(f"more than {self.max_in_flight} storage calls in flight")
+
+    async def _call(self, pool: ThreadPoolExecutor, fn: Callable, *args, **kwargs):
+        await self._admit()
+        try:
+            loop = asyncio.get_running_loop()
+            return await loop.run_in_executor(pool, functools.partial(fn, *args, **kwargs))
+        finally:
+            self._slots.release()
+
+    async def read(self, fn: Callable, *args, **kwargs):
+        """Run a blocking read-only call on a storage thread."""
+        return await self._call(self._readers, self.lock.read, fn, *args, **kwargs)
+
+    async def write(self, fn: Callable, *args, **kwargs):
+        """Run a blocking write on the writer thread."""
+        return await self._call(self._writer, self.lock.write, fn, *args, **kwargs)
+
+    async def query(self, logical) -> List[Dict[str, Any]]:
+        return await self.read(self.db.query, logical)
+
+    async def select(self, table: str, where_col: Optional[str] = None,
+                     where_val: Any = None) -> List[Dict[str, Any]]:
+        return await self.read(self.db.get_table(table).select, where_col, where_val)
+
+    async def insert(self, table: str, row: Dict[str, Any],
+                     id_col: Optional[str] = None) -> Dict[str, Any]:
+        """Insert a row and return it once durable; id_col is filled in as max + 1."""
+        if self.writes is not None:
+            await self._admit()
+            try:
+                return await asyncio.wrap_future(self.writes.submit_async(table, row, id_col))
+            finally:
+                self._slots.release()
+        return await self.write(self._insert_one, table, dict(row), id_col)
+
+    def _insert_one(self, table: str, row: Dict[str, Any], id_col: Optional[str]) -> Dict[str, Any]:
+        tbl = self.db.get_table(table)
+        if id_col is not None:
+            top = tbl.column_max(id_col)
+            row[id_col] = 1 if top is None else top + 1
+        tbl.insert(row)
+        return row
+
+    def stats(self) -> Dict[str, Any]:
+        return {"max_in_flight": self.max_in_flight,
+                "in_flight": self.max_in_flight - self._slots._value,
+                "rejected": self.rejected}
+
+    def close(self):
+        self._readers.shutdown(wait=True)
+        self._writer.shutdown(wait=True)
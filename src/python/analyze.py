@@ -0,0 +1,186 @@
+import base64
+import bisect
+import hashlib
+import math
+from collections import Counter
+from typing import List, Dict, Any, Optional
+
+# ----------------------------
+# ANALYZE: per-column distribution statistics
+#
+# Built from a page sample by Table.analyze() and persisted on a per-table
+# stats page referenced from the catalog. The planner reads them through
+# ColumnAnalysis.eq_selectivity() / range_selectivity().
+# ----------------------------
+
+SAMPLE_PAGES = 300      # pages read per ANALYZE; smaller tables are read in full
+HISTOGRAM_BUCKETS = 16
+MCV_LIMIT = 8
+MAX_TEXT_BOUND = 32     # long TEXT values are truncated in histogram bounds
+HLL_P = 8               # 2^8 registers: ~6.5% standard error, 256 bytes
+
+# Re-analyze once this many rows have changed (same shape as Postgres'
+# autovacuum_analyze_threshold + scale_factor * reltuples).
+AUTO_ANALYZE_BASE = 50
+AUTO_ANALYZE_SCALE = 0.1
+
+
+def _hash64(value: Any) -> int:
+    # Python's hash() is salted per process; the sketch is persisted.
+    tag = "i" if isinstance(value, int) else "s"
+    digest = hashlib.blake2b(f"{tag}:{value}".encode('utf-8'), digest_size=8).digest()
+    return int.from_bytes(digest, "big")
+
+
+class HyperLogLog:
+    def __init__(self, registers: Optional[bytearray] = None):
+        self.m = 1 << HLL_P
+        self.registers = registers if registers is not None else bytearray(self.m)
+
+    def add(self, value: Any):
+        h = _hash64(value)
+        idx = h >> (64 - HLL_P)
+        rest = h & ((1 << (64 - HLL_P)) - 1)
+        rank = (64 - HLL_P) - rest.bit_length() + 1
+        if rank > self.registers[idx]:
+            self.registers[idx] = rank
+
+    def merge(self, other: 'HyperLogLog'):
+        for i, r in enumerate(other.registers):
+            if r > self.registers[i]:
+                self.registers[i] = r
+
+    def estimate(self) -> float:
+        m = self.m
+        alpha = 0.7213 / (1 + 1.079 / m)
+        raw = alpha * m * m / sum(2.0 ** -r for r in self.registers)
+        zeros = self.registers.count(0)
+        if raw <= 2.5 * m and zeros:
+            return m * math.log(m / zeros)  # linear counting for small sets
+        return raw
+
+    def to_str(self) -> str:
+        return base64.b64encode(bytes(self.registers)).decode('ascii')
+
+    @classmethod
+    def from_str(cls, s: str) -> 'HyperLogLog':
+        return cls(bytearray(base64.b64decode(s)))
+
+
+class ColumnAnalysis:
+    def __init__(self, histogram: List[Any], mcv: List[List[Any]], hll: HyperLogLog,
+                 ndv_scale: float = 1.0, null_frac: float = 0.0):
+        self.histogram = histogram   # HISTOGRAM_BUCKETS + 1 bounds, equi-depth
+        self.mcv = mcv               # [[value, frequency], ...], most common first
+        self.hll = hll
+        self.ndv_scale = ndv_scale   # sample -> table extrapolation at ANALYZE time
+        self.null_frac = null_frac
+
+    def ndv(self) -> float:
+        return max(1.0, self.hll.estimate() * self.ndv_scale)
+
+    def eq_selectivity(self, value: Any) -> float:
+        for v, freq in self.mcv:
+            if v == value:
+                return freq
+        mcv_total = sum(freq for _, freq in self.mcv)
+        rest = max(1.0, self.ndv() - len(self.mcv))
+        return max(0.0, 1.0 - mcv_total - self.null_frac) / rest
+
+    def range_selectivity(self, lo: Any = None, hi: Any = None) -> float:
+        """Fraction of rows with lo <= value <= hi (either bound optional)."""
+        return max(0.0, self._frac_below(hi, inclusive=True) - self._frac_below(lo, inclusive=False))
+
+    def _frac_below(self, value: Any, inclusive: bool) -> float:
+        bounds = self.histogram
+        if value is None:
+            return 1.0 if inclusive else 0.0
+        if len(bounds) < 2:
+            return 0.5
+        try:
+            if value < bounds[0]:
+                return 0.0
+            if value >= bounds[-1]:
+                return 1.0
+            b = bisect.bisect_right(bounds, value) - 1
+        except TypeError:
+            return 0.5
+        frac_in = 0.5
+        lo, hi = bounds[b], bounds[b + 1]
+        if isinstance(value, int) and isinstance(lo, int) and isinstance(hi, int) and hi > lo:
+            frac_in = (value - lo) / (hi - lo)
+        return (b + frac_in) / (len(bounds) - 1)
+
+    def to_dict(self) -> Dict[str, Any]:
+        return {
+            "hist": self.histogram,
+            "mcv": self.mcv,
+            "hll": self.hll.to_str(),
+            "ndv_scale": self.ndv_scale,
+            "null_frac": self.null_frac,
+        }
+
+    @classmethod
+    def from_dict(cls, d: Dict[str, Any]) -> 'ColumnAnalysis':
+        return cls(d.get("hist", []), d.get("mcv", []), HyperLogLog.from_str(d["hll"]),
+                   d.get("ndv_scale", 1.0), d.get("null_frac", 0.0))
+
+
+def _bound(value: Any) -> Any:
+    if isinstance(value, str) and len(value) > MAX_TEXT_BOUND:
+        return value[:MAX_TEXT_BOUND]
+    return value
+
+
+def equi_depth_histogram(values: List[Any], buckets: int = HISTOGRAM_BUCKETS) -> List[Any]:
+    if not values:
+        return []
+    ordered = sorted(values)
+    n = len(ordered)
+    buckets = min(buckets, n)
+    return [_bound(ordered[min(n - 1, (i * n) // buckets)]) for i in range(buckets)] + [_bound(ordered[-1])]
+
+
+def estimate_ndv(counts: Counter, sample_rows: int, total_rows: int) -> float:
+    """GEE estimator: sqrt(N/n) * f1 + sum(f_j, j >= 2)."""
+    if sample_rows == 0:
+        return 0.0
+    if sample_rows >= total_rows:
+        return float(len(counts))
+    f1 = sum(1 for c in counts.values() if c == 1)
+    rest = len(counts) - f1
+    return math.sqrt(total_rows / sample_rows) * f1 + rest
+
+
+def analyze_column(values: List[Any], sample_rows: int, total_rows: int) -> ColumnAnalysis:
+    present = [v for v in values if v is not None]
+    counts = Counter(present)
+    hll = HyperLogLog()
+    for v in counts:
+        hll.add(v)
+
+    mcv = []
+    if present:
+        avg = len(present) / len(counts)
+        for v, c in counts.most_common(MCV_LIMIT):
+            # Only values clearly above the average frequency are worth listing
+            if c < 2 or c < 1.25 * avg:
+                break
+            if isinstance(v, str) and len(v) > MAX_TEXT_BOUND:
+                continue
+            mcv.append([v, c / sample_rows])
+
+    ndv = estimate_ndv(counts, sample_rows, total_rows)
+    hll_est = hll.estimate()
+    scale = ndv / hll_est if hll_est > 0 and ndv > hll_est else 1.0
+    null_frac = (sample_rows - len(present)) / sample_rows if sample_rows else 0.0
+    return ColumnAnalysis(equi_depth_histogram(present), mcv, hll, scale, null_frac)
+
+
+def analyze_rows(rows: List[Dict[str, Any]], columns: List[str], total_rows: int) -> Dict[str, ColumnAnalysis]:
+    n = len(rows)
+    return {col: analyze_column([r.get(col) for r in rows], n, max(total_rows, n)) for col in columns}
+
+
+def needs_reanalyze(mods_since_analyze: int, row_count: int) -> bool:
+    return mods_since_analyze > AUTO_ANALYZE_BASE + AUTO_ANALYZE_SCALE * row_count
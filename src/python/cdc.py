@@ -0,0 +1,149 @@
+import json
+import threading
+import time
+import ctypes
+from typing import Any, Dict, Iterator, List, NamedTuple, Optional
+
+import columnar
+from executor import Database, cdc_open, cdc_next, cdc_lsn, cdc_page, cdc_close
+
+# ----------------------------
+# Change data capture
+#
+# changes() follows the WAL through a C cursor (waldb_cdc_*) and yields
+# each committed transaction, in commit order, as the row changes it made.
+# The cursor reports every page a transaction wrote with its image before
+# and after; decoding both with the owning table and comparing slot by
+# slot gives the inserted, updated and deleted rows. A columnar row that
+# outgrows its page is rewritten on another one, which shows up as a
+# delete plus an insert of the same primary key; those pairs are folded
+# back into one update. Values stored out of line (toast.py) come through
+# as toast.Pointer: the chain a pointer names may since have been freed.
+#
+# Each Transaction carries its commit LSN. Passing it back as since resumes
+# right after that transaction, so a consumer that stores the LSN with its
+# own state sees every change exactly once.
+# ----------------------------
+
+POLL = 0.1  # seconds between polls in follow mode once caught up
+
+
+class Change(NamedTuple):
+    table: str
+    op: str                              # "insert", "update" or "delete"
+    before: Optional[Dict[str, Any]]     # None for inserts
+    after: Optional[Dict[str, Any]]      # None for deletes
+
+
+class Transaction(NamedTuple):
+    lsn: int                             # commit end; resume with since=lsn
+    changes: List[Change]
+
+
+def _owner(data: bytes) -> Optional[str]:
+    """Name in a page's table tag (row JSON or PAX header), if any."""
+    if columnar.is_pax(data):
+        return data[5:5 + data[4]].decode('utf-8', 'replace')
+    try:
+        doc = json.loads(data.rstrip(b'\x00').decode('utf-8'))
+    except (json.JSONDecodeError, UnicodeDecodeError):
+        return None
+    return doc.get("__table__") if isinstance(doc, dict) else None
+
+
+def _slots(db: Database, data: bytes):
+    """(table name, row slots) of a page image, or (None, []) if no table owns it."""
+    name = _owner(data)
+    if name is None:
+        return None, []
+    if name not in db.tables:
+        db.refresh()  # created after this attachment loaded its catalog
+    table = db.tables.get(name)
+    if table is None:
+        return None, []
+    return name, table._decode_page(data) or []
+
+
+def _page_changes(db: Database, before: bytes, after: bytes) -> List[Change]:
+    old_table, old = _slots(db, before)
+    new_table, new = _slots(db, after)
+    if old_table != new_table:
+        # The page changed hands: everything on it left one table and joined another
+        return ([Change(old_table, "delete", r, None) for r in old if r is not None] +
+                [Change(new_table, "insert", None, r) for r in new if r is not None])
+
+    out = []
+    for i in range(max(len(old), len(new))):
+        b = old[i] if i < len(old) else None
+        a = new[i] if i < len(new) else None
+        if b == a:
+            continue
+        if b is None:
+            out.append(Change(new_table, "insert", None, a))
+        elif a is None:
+            out.append(Change(old_table, "delete", b, None))
+        else:
+            out.append(Change(new_table, "update", b, a))
+    return out
+
+
+def _fold_moves(db: Database, changes: List[Change]) -> List[Change]:
+    """Delete + insert of the same primary key in one transaction -> update.
+
+    A move that changed nothing but the page (VACUUM) is dropped."""
+    deleted = {}
+    for i, c in enumerate(changes):
+        pk = db.tables[c.table]._pk_col if c.table in db.tables else None
+        if c.op == "delete" and pk:
+            deleted[(c.table, c.before.get(pk))] = i
+    if not deleted:
+        return changes
+
+    out: List[Optional[Change]] = list(changes)
+    for i, c in enumerate(changes):
+        pk = db.tables[c.table]._pk_col if c.table in db.tables else None
+        if c.op != "insert" or not pk:
+            continue
+        j = deleted.pop((c.table, c.after.get(pk)), None)
+        if j is not None:
+            out[j] = None
+            out[i] = None if changes[j].before == c.after else \
+                Change(c.table, "update", changes[j].before, c.after)
+    return [c for c in out if c is not None]
+
+
+def changes(db: Database, since: int = 0, follow: bool = False, poll: float = POLL,
+            stop: Optional[threading.Event] = None) -> Iterator[Transaction]:
+    """Committed transactions after LSN since, oldest first.
+
+    Without follow the generator ends once it has caught up with the latest
+    commit; with follow it keeps waiting for new ones until stop is set.
+    Transactions that changed no rows (catalog or statistics only) are
+    skipped. Works on the writer, a read-only attachment and a replica.
+    """
+    cursor = cdc_open(since)
+    if not cursor:
+        raise ValueError(f"LSN {since} is not a commit boundary of this WAL")
+    before = ctypes.create_string_buffer(db.page_size)
+    after = ctypes.create_string_buffer(db.page_size)
+    try:
+        while True:
+            n = cdc_next(cursor)
+            if n < 0:
+                if not follow or (stop is not None and stop.is_set()):
+                    return
+                if stop is not None:
+                    stop.wait(poll)
+                else:
+                    time.sleep(poll)
+                continue
+            found: List[Change] = []
+            for i in range(n):
+                page_id = cdc_page(cursor, i, before, after)
+                if page_id == 0:
+                    continue  # catalog
+                found.extend(_page_changes(db, before.raw, after.raw))
+            if found:
+                yield Transaction(cdc_lsn(cursor), _fold_moves(db, found))
+    finally:
+        cdc_close(cursor)
@@ -0,0 +1,136 @@
+import socket
+import threading
+from typing import List, Dict, Any, Optional
+
+import wire
+
+# ----------------------------
+# pesadbd client
+#
+# One Unix socket per Client. submit() sends a request and returns its id
+# at once; result() waits for that id's reply. A reader thread drains
+# replies as they arrive, so a client sending far ahead of what it has
+# read never fills the socket buffers in both directions and stalls.
+# A caller can therefore pipeline many requests and pay one round trip
+# for all of them:
+#
+#     ids = [c.submit(wire.OP_EXECUTE, [stmt.id, [k]]) for k in keys]
+#     rows = [c.result(i) for i in ids]
+#
+# The blocking helpers (query, insert, ...) are submit + result.
+# ----------------------------
+
+
+class ServerError(Exception):
+    """An error raised by the server while executing a request."""
+
+    def __init__(self, kind: str, message: str):
+        super().__init__(f"{kind}: {message}")
+        self.kind = kind
+        self.message = message
+
+
+class PreparedStatement:
+    def __init__(self, client: 'Client', stmt_id: int, param_count: int):
+        self.client = client
+        self.id = stmt_id
+        self.param_count = param_count
+
+    def submit(self, *params) -> int:
+        return self.client.submit(wire.OP_EXECUTE, [self.id, list(params)])
+
+    def execute(self, *params) -> List[Dict[str, Any]]:
+        return self.client.result(self.submit(*params))
+
+    def close(self):
+        self.client.call(wire.OP_CLOSE, self.id)
+
+
+class Client:
+    """Connection to a pesadbd server. Safe to share between threads."""
+
+    def __init__(self, socket_path: str):
+        self._sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self._sock.connect(socket_path)
+        self._rfile = self._sock.makefile("rb")
+        self._send_lock = threading.Lock()
+        self._arrived = threading.Condition()
+        self._next_id = 1
+        self._replies: Dict[int, Any] = {}
+        self._closed: Optional[BaseException] = None
+        self._reader = threading.Thread(target=self._read_replies, name="pesadb-client", daemon=True)
+        self._reader.start()
+
+    def _read_replies(self):
+        try:
+            while True:
+                rid, status, value = wire.read_frame(self._rfile)
+                with self._arrived:
+                    self._replies[rid] = (status, value)
+                    self._arrived.notify_all()
+        except (EOFError, OSError, wire.ProtocolError) as e:
+            with self._arrived:
+                self._closed = e
+                self._arrived.notify_all()
+
+    def submit(self, op: int, arg: Any = None) -> int:
+        """Send a request without waiting; returns the id to pass to result()."""
+        with self._send_lock:
+            req_id = self._next_id
+            self._next_id = (self._next_id + 1) & 0xFFFFFFFF or 1
+            self._sock.sendall(wire.frame(req_id, op, arg))
+        return req_id
+
+    def result(self, req_id: int) -> Any:
+        """Wait for the reply to req_id; raises ServerError if the request failed."""
+        with self._arrived:
+            while req_id not in self._replies:
+                if self._closed is not None:
+                    raise ConnectionError(f"pesadbd connection lost: {self._closed}")
+                self._arrived.wait()
+            status, value = self._replies.pop(req_id)
+        if status != wire.STATUS_OK:
+            raise ServerError(*value)
+        return value
+
+    def call(self, op: int, arg: Any = None) -> Any:
+        return self.result(self.submit(op, arg))
+
+    def ping(self) -> str:
+        return self.call(wire.OP_PING)
+
+    def query(self, text: str) -> List[Dict[str, Any]]:
+        """Run "SEL <table> [WHERE ...] [ORDER BY ...] [LIMIT ...]"."""
+        return self.call(wire.OP_QUERY, text)
+
+    def explain(self, text: str) -> str:
+        return self.call(wire.OP_EXPLAIN, text)
+
+    def prepare(self, text: str) -> PreparedStatement:
+        """Parse a SELECT with ? placeholders once on the server."""
+        stmt_id, count = self.call(wire.OP_PREPARE, text)
+        return PreparedStatement(self, stmt_id, count)
+
+    def insert(self, table: str, rows: List[Dict[str, Any]]) -> List[Optional[str]]:
+        """Insert rows in one server-side transaction; per-row error text or None."""
+        return self.call(wire.OP_INSERT, [table, rows])
+
+    def delete(self, table: str, key_col: str, key_val: Any):
+        self.call(wire.OP_DELETE, [table, key_col, key_val])
+
+    def update(self, table: str, key_col: str, key_val: Any, updates: Dict[str, Any]):
+        self.call(wire.OP_UPDATE, [table, key_col, key_val, updates])
+
+    def status(self) -> Dict[str, Any]:
+        """Role and LSNs of the server; replicas add replay_lsn and lag."""
+        return self.call(wire.OP_STATUS)
+
+    def vacuum(self) -> Dict[str, int]:
+        """Compact the database and shrink its file; see vacuum.py."""
+        return self.call(wire.OP_VACUUM)
+
+    def close(self):
+        self._sock.shutdown(socket.SHUT_RDWR)
+        self._reader.join()
+        self._rfile.close()
+        self._sock.close()
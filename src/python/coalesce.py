@@ -0,0 +1,119 @@
+import queue
+import threading
+import time
+from concurrent.futures import Future
+from typing import List, Dict, Any, Optional, Tuple
+
+from rwlock import RWLock
+
+# ----------------------------
+# Write coalescing
+#
+# Concurrent single-row inserts are queued to one committer thread, which
+# takes whatever has arrived (up to max_batch rows, waiting at most
+# max_wait seconds after the first) and commits it as one transaction
+# through Database.insert_batch. Each caller blocks until the batch holding
+# its row is durable, so a burst costs one fsync per batch rather than one
+# per row. The committer is also the only writer of the tables it serves,
+# which lets it hand out max + 1 ids without two requests racing for one.
+# Each batch holds the write lock, which readers sharing the database
+# take for reading (see aio.AsyncDatabase).
+# ----------------------------
+
+MAX_BATCH = 128     # rows per transaction
+MAX_WAIT = 0.002    # seconds a batch stays open for more rows
+
+
+class WriteCoalescer:
+    """Group-commits inserts submitted from many threads."""
+
+    def __init__(self, db, max_batch: int = MAX_BATCH, max_wait: float = MAX_WAIT,
+                 lock: Optional[RWLock] = None):
+        self.db = db
+        self.lock = lock if lock is not None else RWLock()
+        self.max_batch = max_batch
+        self.max_wait = max_wait
+        self._queue: 'queue.Queue[Optional[Tuple[str, Dict[str, Any], Optional[str], Future]]]' = queue.Queue()
+        self.batches = 0
+        self.rows = 0
+        self._thread = threading.Thread(target=self._run, name="pesadb-coalescer", daemon=True)
+        self._thread.start()
+
+    def submit_async(self, table: str, row: Dict[str, Any], id_col: Optional[str] = None) -> Future:
+        """Queue an insert. With id_col, the committer fills it in as max + 1.
+
+        The future resolves to the stored row once its batch has committed,
+        or to the row's own error (e.g. a duplicate key) without failing
+        the rest of the batch.
+        """
+        fut: Future = Future()
+        self._queue.put((table, dict(row), id_col, fut))
+        return fut
+
+    def submit(self, table: str, row: Dict[str, Any], id_col: Optional[str] = None) -> Dict[str, Any]:
+        return self.submit_async(table, row, id_col).result()
+
+    def stats(self) -> Dict[str, Any]:
+        return {"batches": self.batches, "rows": self.rows,
+                "avg_batch": self.rows / self.batches if self.batches else 0.0}
+
+    def close(self):
+        """Commit what is queued, then stop the committer."""
+        self._queue.put(None)
+        self._thread.join()
+
+    def _take_batch(self) -> Tuple[List[Tuple[str, Dict[str, Any], Optional[str], Future]], bool]:
+        """Block for one insert, then gather more; returns (batch, stopping)."""
+        first = self._queue.get()
+        if first is None:
+            return [], True
+        batch = [first]
+        deadline = time.monotonic() + self.max_wait
+        while len(batch) < self.max_batch:
+            remaining = deadline - time.monotonic()
+            try:
+                item = self._queue.get(timeout=remaining) if remaining > 0 else self._queue.get_nowait()
+            except queue.Empty:
+                break
+            if item is None:
+                return batch, True
+            batch.append(item)
+        return batch, False
+
+    def _run(self):
+        while True:
+            batch, stopping = self._take_batch()
+            if batch:
+                self.lock.write(self._commit, batch)
+            if stopping:
+                return
+
+    def _commit(self, batch: List[Tuple[str, Dict[str, Any], Optional[str], Future]]):
+        next_ids: Dict[Tuple[str, str], int] = {}
+        for table, row, id_col, _ in batch:
+            if id_col is None:
+                continue
+            key = (table, id_col)
+            if key not in next_ids:
+                try:
+                    top = self.db.get_table(table).column_max(id_col)
+                except KeyError:
+                    continue  # insert_batch reports the missing table
+                next_ids[key] = 1 if top is None else top + 1
+            row[id_col] = next_ids[key]
+            next_ids[key] += 1
+
+        try:
+            errors = self.db.insert_batch([(table, row) for table, row, _, _ in batch])
+        except Exception as e:
+            for _, _, _, fut in batch:
+                fut.set_exception(e)
+            return
+
+        self.batches += 1
+        self.rows += sum(1 for e in errors if e is None)
+        for (_, row, _, fut), err in zip(batch, errors):
+            if err is None:
+                fut.set_result(row)
+            else:
+                fut.set_exception(err)
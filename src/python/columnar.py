@@ -0,0 +1,256 @@
+import json
+import struct
+from typing import List, Dict, Any, Optional, Tuple
+
+# ----------------------------
+# PAX page codec for columnar tables
+#
+# A columnar table packs up to MAX_ROWS rows into one page, grouped by
+# column, so a scan that needs two columns only decodes those two arrays.
+# Layout (little-endian):
+#
+#   "PAX1" | u8 name_len | table name | u16 nrows | u16 ncols
+#   | u16 col_off[ncols] | deleted bitmap
+#
+#   column block at col_off[i]:
+#     u8 name_len | column name | u8 type | null bitmap | values
+#     INT:  i64 value[nrows]
+#     TEXT: u16 ndict | ndict x (u16 len | utf-8 bytes) | u16 code[nrows]
+#     CODE: u32 code[nrows]   (TEXT column with a table-wide dictionary)
+#
+# Bitmaps are ceil(nrows / 8) bytes with bit i set for slot i. Deleted and
+# NULL slots store 0. Plain TEXT is dictionary-encoded per page. vexec.c
+# decodes the same layout.
+# ----------------------------
+
+MAGIC = b"PAX1"
+MAX_ROWS = 256
+TYPE_INT, TYPE_TEXT, TYPE_CODE = 0, 1, 2
+
+
+def is_pax(data: bytes) -> bool:
+    return data[:4] == MAGIC
+
+
+def _bitmap(flags: List[bool]) -> bytes:
+    out = bytearray((len(flags) + 7) // 8)
+    for i, f in enumerate(flags):
+        if f:
+            out[i >> 3] |= 1 << (i & 7)
+    return bytes(out)
+
+
+def _bit(bm: bytes, i: int) -> bool:
+    return bool(bm[i >> 3] >> (i & 7) & 1)
+
+
+def encode_page(table: str, columns: List[Tuple[str, int]], slots: List[Optional[Dict[str, Any]]]) -> bytes:
+    """Encode row slots (None = deleted) for columns [(name, TYPE_*)].
+
+    TYPE_CODE values must already be dictionary codes.
+    """
+    nrows = len(slots)
+    name = table.encode('utf-8')
+    header_len = 4 + 1 + len(name) + 4 + 2 * len(columns)
+    deleted = _bitmap([r is None for r in slots])
+
+    blocks = []
+    for col, ctype in columns:
+        values = [None if r is None else r.get(col) for r in slots]
+        cname = col.encode('utf-8')
+        block = bytearray(struct.pack("<B", len(cname)) + cname)
+        block.append(ctype)
+        block += _bitmap([v is None for v in values])
+        if ctype == TYPE_CODE:
+            block += struct.pack(f"<{nrows}I", *(0 if v is None else v for v in values))
+        elif ctype == TYPE_TEXT:
+            codes, dictionary = [], {}
+            for v in values:
+                codes.append(0 if v is None else dictionary.setdefault(v, len(dictionary)))
+            block += struct.pack("<H", len(dictionary))
+            for s in dictionary:
+                b = s.encode('utf-8')
+                block += struct.pack("<H", len(b)) + b
+            block += struct.pack(f"<{nrows}H", *codes)
+        else:
+            block += struct.pack(f"<{nrows}q", *(0 if v is None else v for v in values))
+        blocks.append(bytes(block))
+
+    offsets = []
+    pos = header_len + len(deleted)
+    for block in blocks:
+        offsets.append(pos)
+        pos += len(block)
+    if pos > 0xFFFF:
+        raise ValueError("Page too large")
+
+    return b"".join([MAGIC, struct.pack("<B", len(name)), name,
+                     struct.pack("<HH", nrows, len(columns)),
+                     struct.pack(f"<{len(columns)}H", *offsets), deleted] + blocks)
+
+
+def decode_page(data: bytes, table: str) -> Optional[List[Optional[Dict[str, Any]]]]:
+    """Row slots of a PAX page owned by table (None = deleted), else None.
+
+    TYPE_CODE columns come back as dictionary codes.
+    """
+    if not is_pax(data):
+        return None
+    nlen = data[4]
+    if data[5:5 + nlen].decode('utf-8', 'replace') != table:
+        return None
+    pos = 5 + nlen
+    nrows, ncols = struct.unpack_from("<HH", data, pos)
+    pos += 4
+    offsets = struct.unpack_from(f"<{ncols}H", data, pos)
+    pos += 2 * ncols
+    bm = (nrows + 7) // 8
+    deleted = data[pos:pos + bm]
+
+    slots = [None if _bit(deleted, i) else {} for i in range(nrows)]
+    for off in offsets:
+        clen = data[off]
+        col = data[off + 1:off + 1 + clen].decode('utf-8')
+        pos = off + 1 + clen
+        ctype = data[pos]
+        nulls = data[pos + 1:pos + 1 + bm]
+        pos += 1 + bm
+        if ctype == TYPE_TEXT:
+            (ndict,) = struct.unpack_from("<H", data, pos)
+            pos += 2
+            dictionary = []
+            for _ in range(ndict):
+                (n,) = struct.unpack_from("<H", data, pos)
+                dictionary.append(data[pos + 2:pos + 2 + n].decode('utf-8'))
+                pos += 2 + n
+            values = [dictionary[c] if c < ndict else None
+                      for c in struct.unpack_from(f"<{nrows}H", data, pos)]
+        elif ctype == TYPE_CODE:
+            values = struct.unpack_from(f"<{nrows}I", data, pos)
+        else:
+            values = struct.unpack_from(f"<{nrows}q", data, pos)
+        for i, row in enumerate(slots):
+            if row is not None:
+                row[col] = None if _bit(nulls, i) else values[i]
+    return slots
+
+
+# ----------------------------
+# Table-wide TEXT dictionaries
+#
+# A TEXT column declared with dictionary=True stores an integer code in
+# every row (row or columnar layout) instead of the string. Codes are
+# positions in an append-only list, so they never change once written.
+# The list is cached in memory and persisted as a chain of JSON pages,
+# each naming the next, so the catalog holds only the head page id however
+# large the dictionary grows. New entries are written in the same
+# transaction as the row that introduced them. Catalogs written before
+# the chain list the page ids; those stay listed and the chain continues
+# from the last of them.
+# ----------------------------
+DICT_TAG = "__dict__"
+_NO_PAGE = 2 ** 32 - 1  # widest "next" value, for sizing a chunk
+
+
+class TextDictionary:
+    def __init__(self, table: str, column: str, values: Optional[List[str]] = None,
+                 pages: Optional[List[int]] = None):
+        self.table = table
+        self.column = column
+        self.values = list(values or [])
+        self.codes = {v: i for i, v in enumerate(self.values)}
+        self.pages = list(pages or [])  # persisted chunks, in code order
+        self.persisted = len(self.values)
+        self._chunk_start = []          # first code stored on each page
+        self._listed = 0                # leading pages an older catalog lists
+
+    def ref(self):
+        """What the catalog records: the head page id (None before the
+        first page), or the listed pages of an older catalog."""
+        if self._listed:
+            return self.pages[:self._listed]
+        return self.pages[0] if self.pages else None
+
+    def code(self, value: str) -> Optional[int]:
+        return self.codes.get(value)
+
+    def add(self, value: str) -> int:
+        code = self.codes.get(value)
+        if code is None:
+            code = len(self.values)
+            self.values.append(value)
+            self.codes[value] = code
+        return code
+
+    def value(self, code: int) -> Optional[str]:
+        return self.values[code] if 0 <= code < len(self.values) else None
+
+    def _chunk(self, start: int, end: int, next_page: Optional[int] = _NO_PAGE) -> bytes:
+        return json.dumps({"__table__": DICT_TAG, "table": self.table, "column": self.column,
+                           "start": start, "next": next_page,
+                           "values": self.values[start:end]}).encode('utf-8')
+
+    def dirty_pages(self, page_size: int, alloc_page) -> List[Tuple[int, bytes]]:
+        """(page_id, data) to write for entries added since the last call.
+
+        Only the last page is rewritten; when it fills up, new pages are
+        taken from alloc_page and it is rewritten pointing at the first.
+        """
+        if self.persisted == len(self.values):
+            return []
+        chunks = []  # (index into pages, start, end)
+        start = self._chunk_start[-1] if self._chunk_start else 0
+        i = len(self.pages) - 1 if self.pages else None
+        end = start
+        while end < len(self.values):
+            if i is None:
+                self.pages.append(alloc_page())
+                self._chunk_start.append(start)
+                i = len(self.pages) - 1
+            # grow the chunk while it still fits the page
+            end = start + 1
+            if len(self._chunk(start, end)) > page_size:
+                raise ValueError(f"Dictionary value too large in '{self.column}'")
+            while end < len(self.values) and len(self._chunk(start, end + 1)) <= page_size:
+                end += 1
+            chunks.append((i, start, end))
+            start, i = end, None
+        self.persisted = len(self.values)
+        last = len(self.pages) - 1
+        return [(self.pages[i], self._chunk(s, e, self.pages[i + 1] if i < last else None))
+                for i, s, e in chunks]
+
+    def mark(self) -> Tuple[int, int, int]:
+        """State to return to with rollback if the current write fails."""
+        return len(self.values), len(self.pages), self.persisted
+
+    def rollback(self, mark: Tuple[int, int, int]):
+        """Forget the entries and pages added since mark."""
+        n, pages, persisted = mark
+        for v in self.values[n:]:
+            del self.codes[v]
+        del self.values[n:]
+        del self.pages[pages:]
+        del self._chunk_start[pages:]
+        self.persisted = persisted
+
+    @classmethod
+    def load(cls, table: str, column: str, ref, read) -> 'TextDictionary':
+        """Rebuild from persisted pages; ref is what ref() recorded and
+        read(page_id) returns the raw page."""
+        d = cls(table, column)
+        listed = list(ref) if isinstance(ref, list) else ([] if ref is None else [ref])
+        if isinstance(ref, list):
+            d._listed = len(listed)
+        page = listed.pop(0) if listed else None
+        while page is not None:
+            doc = json.loads(read(page).rstrip(b'\x00').decode('utf-8'))
+            if doc.get("__table__") != DICT_TAG or doc.get("start") != len(d.values):
+                raise ValueError(f"Corrupt dictionary page {page} for {table}.{column}")
+            d.pages.append(page)
+            d._chunk_start.append(doc["start"])
+            for v in doc["values"]:
+                d.add(v)
+            page = listed.pop(0) if listed else doc.get("next")
+        d.persisted = len(d.values)
+        return d
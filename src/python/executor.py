@@ -1,8 +1,20 @@
 import ctypes
+import heapq
 import json
-from typing import List, Dict, Any, Optional
+from typing import List, Dict, Any, Optional, Tuple, Iterator
 from enum import Enum
 import os
+import random
+import threading
+from bisect import bisect_left, bisect_right, insort
+
+import analyze
+import columnar
+import matview
+import planner
+import querycache
+import statements
+import toast
 
 # ----------------------------
 # Load C library from build/ directory (relative to this file)
@@ -26,80 +38,421 @@ open_db = _lib.open_db
 open_db.argtypes = [ctypes.c_char_p]
 open_db.restype = None
 
+open_db_readonly = _lib.open_db_readonly
+open_db_readonly.argtypes = [ctypes.c_char_p]
+open_db_readonly.restype = ctypes.c_int
+
+end_read = _lib.end_read
+end_read.argtypes = [c_txn]
+end_read.restype = None
+
+set_replica = _lib.set_replica
+set_replica.argtypes = [ctypes.c_int]
+set_replica.restype = None
+
+replica_apply = _lib.replica_apply
+replica_apply.argtypes = [ctypes.c_char_p, ctypes.c_size_t]
+replica_apply.restype = ctypes.c_size_t
+
+
+class ReadTxn(c_txn):
+    """Read snapshot handle. Its slot in the shared reader table (which holds
+    checkpoints back) is released when the last reference goes away."""
+
+    def __del__(self):
+        if self.value and end_read is not None:
+            end_read(self.value)
+            self.value = None
+
+
 begin_read = _lib.begin_read
 begin_read.argtypes = []
-begin_read.restype = c_txn
+begin_read.restype = ReadTxn
+
+_begin_write = _lib.begin_write
+_begin_write.argtypes = []
+_begin_write.restype = c_txn
+
+
+def begin_write():
+    txn = _begin_write()
+    if not txn:
+        raise PermissionError("Database is open read-only")
+    return txn
 
-begin_write = _lib.begin_write
-begin_write.argtypes = []
-begin_write.restype = c_txn
 
 commit = _lib.commit
 commit.argtypes = [c_txn]
 commit.restype = None
 
+rollback = _lib.rollback
+rollback.argtypes = [c_txn]
+rollback.restype = None
+
 checkpoint = _lib.checkpoint
 checkpoint.argtypes = []
 checkpoint.restype = None
 
-read_page = _lib.read_page
-read_page.argtypes = [c_txn, ctypes.c_int]
-read_page.restype = ctypes.POINTER(ctypes.c_ubyte * 4096)
+checkpoint_async = _lib.checkpoint_async
+checkpoint_async.argtypes = []
+checkpoint_async.restype = None
+
+commit_lsn = _lib.commit_lsn
+commit_lsn.argtypes = []
+commit_lsn.restype = ctypes.c_uint64
+
+# Shrinking the db file (see vacuum.py)
+truncate_db_pages = _lib.truncate_db_pages
+truncate_db_pages.argtypes = [ctypes.c_uint32]
+truncate_db_pages.restype = None
+
+db_pages = _lib.db_pages
+db_pages.argtypes = []
+db_pages.restype = ctypes.c_uint64
+
+# Page size, fixed per database when it is created (see Database)
+set_page_size = _lib.set_page_size
+set_page_size.argtypes = [ctypes.c_uint32]
+set_page_size.restype = ctypes.c_int
+
+page_size_of_db = _lib.page_size_of_db
+page_size_of_db.argtypes = []
+page_size_of_db.restype = ctypes.c_uint32
+
+file_page_size = _lib.file_page_size
+file_page_size.argtypes = [ctypes.c_char_p]
+file_page_size.restype = ctypes.c_uint32
+
+# Change data capture cursor (see cdc.py)
+cdc_open = _lib.cdc_open
+cdc_open.argtypes = [ctypes.c_uint64]
+cdc_open.restype = ctypes.c_void_p
+
+cdc_next = _lib.cdc_next
+cdc_next.argtypes = [ctypes.c_void_p]
+cdc_next.restype = ctypes.c_int64
+
+cdc_lsn = _lib.cdc_lsn
+cdc_lsn.argtypes = [ctypes.c_void_p]
+cdc_lsn.restype = ctypes.c_uint64
+
+cdc_page = _lib.cdc_page
+cdc_page.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p]
+cdc_page.restype = ctypes.c_int64
+
+cdc_close = _lib.cdc_close
+cdc_close.argtypes = [ctypes.c_void_p]
+cdc_close.restype = None
+
+# ----------------------------
+# Bind the shared task pool (taskpool.c)
+# ----------------------------
+PRIO_LEVELS = 3  # high (queries), normal, background (checkpoints)
+
+class PoolStats(ctypes.Structure):
+    _fields_ = [
+        ("workers", ctypes.c_uint64),
+        ("queued", ctypes.c_uint64),
+        ("submitted", ctypes.c_uint64 * PRIO_LEVELS),
+        ("executed", ctypes.c_uint64 * PRIO_LEVELS),
+        ("wait_ns", ctypes.c_uint64 * PRIO_LEVELS),
+        ("max_wait_ns", ctypes.c_uint64),
+        ("steals", ctypes.c_uint64),
+        ("steal_attempts", ctypes.c_uint64),
+    ]
+
+pool_start = _lib.pool_start
+pool_start.argtypes = [ctypes.c_int]
+pool_start.restype = ctypes.c_int
+
+_lib.pool_stats.argtypes = [ctypes.POINTER(PoolStats)]
+_lib.pool_stats.restype = None
+
+def pool_stats() -> Dict[str, Any]:
+    s = PoolStats()
+    _lib.pool_stats(ctypes.byref(s))
+    names = ("high", "normal", "background")
+    return {
+        "workers": s.workers,
+        "queued": s.queued,
+        "submitted": dict(zip(names, s.submitted)),
+        "executed": dict(zip(names, s.executed)),
+        "avg_wait_us": {n: (w / e / 1000.0 if e else 0.0)
+                        for n, w, e in zip(names, s.wait_ns, s.executed)},
+        "max_wait_us": s.max_wait_ns / 1000.0,
+        "steals": s.steals,
+        "steal_attempts": s.steal_attempts,
+    }
+
+_read_page = _lib.read_page
+_read_page.argtypes = [c_txn, ctypes.c_int, ctypes.c_char_p]
+_read_page.restype = None
 
 write_page = _lib.write_page
-write_page.argtypes = [c_txn, ctypes.c_int, ctypes.POINTER(ctypes.c_ubyte * 4096)]
 write_page.restype = None
 
+# Each thread reads pages into a buffer of its own: storage threads and
+# pesadbd handlers read concurrently, and ctypes drops the GIL in the call.
+_read_buffers = threading.local()
+_page_size = 4096
+
+def read_page(txn, page_id: int) -> bytes:
+    """Image of page_id as of txn."""
+    buf = getattr(_read_buffers, "buf", None)
+    if buf is None or len(buf) != _page_size:
+        buf = _read_buffers.buf = ctypes.create_string_buffer(_page_size)
+    _read_page(txn, page_id, buf)
+    return buf.raw
+
+def _bind_page_size(size: int):
+    """Size the page buffers of read_page and write_page; the C library
+    has one database open at a time, so one binding serves every caller."""
+    global _page_size
+    _page_size = size
+    write_page.argtypes = [c_txn, ctypes.c_int, ctypes.POINTER(ctypes.c_ubyte * size)]
+
+_bind_page_size(4096)
+
 # ----------------------------
-# Bind hash_join correctly — NOW USING size_t
+# Bind the C hash join (hashjoin.c)
 # ----------------------------
-_lib.hash_join.argtypes = [
-    c_char_pp,              # const char** inner_rows
-    ctypes.c_size_t,        # size_t inner_count
-    c_char_pp,              # const char** outer_rows
-    ctypes.c_size_t,        # size_t outer_count
-    ctypes.c_char_p,        # const char* inner_key
-    ctypes.c_char_p,        # const char* outer_key
-    ctypes.POINTER(ctypes.c_char),  # char* output_buf
-    ctypes.c_size_t         # size_t output_buf_size
-]
-_lib.hash_join.restype = ctypes.c_int
-
-def hash_join_c(inner_rows: List[bytes], outer_rows: List[bytes],
-                inner_key: str, outer_key: str, output_buf: bytearray) -> int:
-    """Call C hash_join with proper ctypes conversion."""
-    if not inner_rows or not outer_rows:
-        return 0
+_lib.hj_build.argtypes = [c_char_pp, ctypes.c_size_t, ctypes.c_char_p]
+_lib.hj_build.restype = ctypes.c_void_p
+_lib.hj_probe.argtypes = [ctypes.c_void_p, c_char_pp, ctypes.c_size_t, ctypes.c_char_p,
+                          ctypes.c_int, ctypes.c_char_p, ctypes.c_size_t,
+                          ctypes.POINTER(ctypes.c_size_t), ctypes.POINTER(ctypes.c_size_t)]
+_lib.hj_probe.restype = ctypes.c_longlong
+_lib.hj_free.argtypes = [ctypes.c_void_p]
+_lib.hj_free.restype = None
+
+class CHashJoin:
+    """Build side of a C hash join, hashed once and probed batch by batch.
+
+    Merged rows take outer (probe) values on column clashes unless
+    build_overrides is set. The output buffer grows when one probe row's
+    matches do not fit, so no match is dropped.
+    """
+
+    OUTPUT_BUF = 1 << 20
+
+    def __init__(self, build_rows: List[bytes], key: str):
+        arr = (ctypes.c_char_p * len(build_rows))(*build_rows)
+        self._handle = _lib.hj_build(arr, len(build_rows), key.encode('utf-8'))
+        if not self._handle:
+            raise RuntimeError("Hash join build failed: unparsable row or out of memory")
+        self._buf = ctypes.create_string_buffer(self.OUTPUT_BUF)
+
+    def probe(self, rows: List[bytes], key: str, build_overrides: bool = False) -> Iterator[Dict[str, Any]]:
+        key_b = key.encode('utf-8')
+        consumed, need = ctypes.c_size_t(), ctypes.c_size_t()
+        while rows:
+            arr = (ctypes.c_char_p * len(rows))(*rows)
+            used = _lib.hj_probe(self._handle, arr, len(rows), key_b, int(build_overrides),
+                                 self._buf, len(self._buf), ctypes.byref(consumed), ctypes.byref(need))
+            if used < 0:
+                raise RuntimeError("Hash join probe failed: unparsable row or out of memory")
+            for seg in ctypes.string_at(self._buf, used).split(b'\x00')[:-1]:
+                yield json.loads(seg)
+            if consumed.value == 0:  # the next row's matches alone overflow
+                self._buf = ctypes.create_string_buffer(max(2 * len(self._buf), need.value))
+            rows = rows[consumed.value:]
+
+    def close(self):
+        if self._handle:
+            _lib.hj_free(self._handle)
+            self._handle = None
+
+    def __del__(self):
+        self.close()
 
-    inner_arr = (ctypes.c_char_p * len(inner_rows))(*inner_rows)
-    outer_arr = (ctypes.c_char_p * len(outer_rows))(*outer_rows)
-
-    return _lib.hash_join(
-        inner_arr,
-        ctypes.c_size_t(len(inner_rows)),
-        outer_arr,
-        ctypes.c_size_t(len(outer_rows)),
-        inner_key.encode('utf-8'),
-        outer_key.encode('utf-8'),
-        (ctypes.c_char * len(output_buf)).from_buffer(output_buf),
-        ctypes.c_size_t(len(output_buf))
-    )
+# ----------------------------
+# Bind vectorized batch engine (vexec.c)
+# ----------------------------
+VX_INT, VX_TEXT = 0, 1
+VX_OPS = {"=": 0, "<": 1, "<=": 2, ">": 3, ">=": 4}
+VX_AGGS = {"count": 0, "sum": 1, "min": 2, "max": 3}
+
+_lib.vx_plan_new.argtypes = [ctypes.c_char_p]
+_lib.vx_plan_new.restype = ctypes.c_void_p
+_lib.vx_plan_column.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int]
+_lib.vx_plan_column.restype = ctypes.c_int
+_lib.vx_plan_filter_int.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_int64]
+_lib.vx_plan_filter_int.restype = ctypes.c_int
+_lib.vx_plan_filter_text.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_char_p]
+_lib.vx_plan_filter_text.restype = ctypes.c_int
+_lib.vx_plan_dictionary.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t]
+_lib.vx_plan_dictionary.restype = ctypes.c_int
+_lib.vx_plan_output.argtypes = [ctypes.c_void_p, ctypes.c_int]
+_lib.vx_plan_output.restype = ctypes.c_int
+_lib.vx_plan_group_by.argtypes = [ctypes.c_void_p, ctypes.c_int]
+_lib.vx_plan_group_by.restype = ctypes.c_int
+_lib.vx_plan_aggregate.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int]
+_lib.vx_plan_aggregate.restype = ctypes.c_int
+_lib.vx_plan_pages.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_uint32), ctypes.c_size_t]
+_lib.vx_plan_pages.restype = None
+_lib.vx_plan_parallel.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int]
+_lib.vx_plan_parallel.restype = None
+_lib.vx_next_batch.argtypes = [ctypes.c_void_p]
+_lib.vx_next_batch.restype = ctypes.c_size_t
+_lib.vx_batch_ints.argtypes = [ctypes.c_void_p, ctypes.c_int]
+_lib.vx_batch_ints.restype = ctypes.POINTER(ctypes.c_int64)
+_lib.vx_batch_nulls.argtypes = [ctypes.c_void_p, ctypes.c_int]
+_lib.vx_batch_nulls.restype = ctypes.POINTER(ctypes.c_uint8)
+_lib.vx_batch_text.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+_lib.vx_batch_text.restype = ctypes.c_void_p
+_lib.vx_plan_free.argtypes = [ctypes.c_void_p]
+_lib.vx_plan_free.restype = None
+
+
+class VectorPlan:
+    """Thin owner of a C vx plan: describe it, then pull column batches."""
+
+    def __init__(self, table: str):
+        self._plan = _lib.vx_plan_new(table.encode('utf-8'))
+        self._out_types = []
+
+    def column(self, name: str, dtype: 'DataType', dictionary: Optional[List[str]] = None) -> int:
+        """dictionary: values of a dictionary-encoded TEXT column, in code order."""
+        slot = _lib.vx_plan_column(self._plan, name.encode('utf-8'),
+                                   VX_INT if dtype == DataType.INT else VX_TEXT)
+        if slot < 0:
+            raise ValueError("Too many columns for vectorized plan")
+        if dictionary is not None:
+            arr = (ctypes.c_char_p * max(1, len(dictionary)))(*(v.encode('utf-8') for v in dictionary))
+            _lib.vx_plan_dictionary(self._plan, slot, arr, len(dictionary))
+        return slot
+
+    def filter(self, slot: int, op: str, value: Any):
+        if isinstance(value, int):
+            rc = _lib.vx_plan_filter_int(self._plan, slot, VX_OPS[op], value)
+        else:
+            rc = _lib.vx_plan_filter_text(self._plan, slot, VX_OPS[op], value.encode('utf-8'))
+        if rc < 0:
+            raise ValueError("Unsupported vectorized filter")
+
+    def output(self, slot: int, dtype: 'DataType'):
+        _lib.vx_plan_output(self._plan, slot)
+        self._out_types.append(dtype)
+
+    def group_by(self, slot: int, dtype: 'DataType'):
+        _lib.vx_plan_group_by(self._plan, slot)
+        self._out_types.append(dtype)
+
+    def aggregate(self, func: str, slot: int):
+        if _lib.vx_plan_aggregate(self._plan, VX_AGGS[func], slot) < 0:
+            raise ValueError(f"Unsupported vectorized aggregate: {func}")
+        self._out_types.append(DataType.INT)
+
+    def pages(self, page_ids: List[int]):
+        arr = (ctypes.c_uint32 * len(page_ids))(*page_ids)
+        _lib.vx_plan_pages(self._plan, arr, len(page_ids))
+
+    def parallel(self, workers: int, ordered: bool = True):
+        """Split the page list over worker threads; ordered keeps page order."""
+        _lib.vx_plan_parallel(self._plan, workers, 1 if ordered else 0)
+
+    def batches(self):
+        """Yield each result batch as a list of per-column Python lists."""
+        try:
+            while True:
+                n = _lib.vx_next_batch(self._plan)
+                if n == 0:
+                    return
+                cols = []
+                for out, dtype in enumerate(self._out_types):
+                    nulls = _lib.vx_batch_nulls(self._plan, out)[:n]
+                    if dtype == DataType.INT:
+                        vals = _lib.vx_batch_ints(self._plan, out)[:n]
+                    else:
+                        vals = []
+                        length = ctypes.c_size_t()
+                        for i in range(n):
+                            ptr = _lib.vx_batch_text(self._plan, out, i, ctypes.byref(length))
+                            vals.append(None if not ptr else ctypes.string_at(ptr, length.value).decode('utf-8'))
+                    cols.append([None if nl else v for v, nl in zip(vals, nulls)])
+                yield cols
+        finally:
+            self.close()
+
+    def close(self):
+        if self._plan:
+            _lib.vx_plan_free(self._plan)
+            self._plan = None
+
+# ----------------------------
+# External merge sort (extsort.c)
+# ----------------------------
+_lib.xs_new.argtypes = [ctypes.c_size_t, ctypes.c_char_p]
+_lib.xs_new.restype = ctypes.c_void_p
+_lib.xs_add.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.c_char_p, ctypes.c_size_t]
+_lib.xs_add.restype = ctypes.c_int
+_lib.xs_finish.argtypes = [ctypes.c_void_p]
+_lib.xs_finish.restype = ctypes.c_int
+_lib.xs_next.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_void_p), ctypes.POINTER(ctypes.c_size_t)]
+_lib.xs_next.restype = ctypes.c_int
+_lib.xs_runs.argtypes = [ctypes.c_void_p]
+_lib.xs_runs.restype = ctypes.c_size_t
+_lib.xs_free.argtypes = [ctypes.c_void_p]
+_lib.xs_free.restype = None
+
+
+class ExternalSorter:
+    """Owner of a C external sort: add (key, payload) pairs, then read payloads back in key order."""
+
+    def __init__(self, mem_budget: int, tmpdir: Optional[str] = None):
+        self._sort = _lib.xs_new(mem_budget, tmpdir.encode('utf-8') if tmpdir else None)
+        if not self._sort:
+            raise MemoryError("Cannot start an external sort")
+
+    def add(self, key: bytes, payload: bytes):
+        if _lib.xs_add(self._sort, key, len(key), payload, len(payload)) < 0:
+            raise ValueError("Sort record too large, or a run failed to spill")
+
+    @property
+    def runs(self) -> int:
+        """Runs spilled to disk so far (0: sorted entirely in memory)."""
+        return _lib.xs_runs(self._sort)
+
+    def sorted(self):
+        """Yield payloads in key order; the sorter is freed afterwards."""
+        try:
+            if _lib.xs_finish(self._sort) < 0:
+                raise IOError("External sort failed to spill or merge its runs")
+            ptr, length = ctypes.c_void_p(), ctypes.c_size_t()
+            while True:
+                got = _lib.xs_next(self._sort, ctypes.byref(ptr), ctypes.byref(length))
+                if got < 0:
+                    raise MemoryError("External sort could not read back a record")
+                if not got:
+                    break
+                yield ctypes.string_at(ptr, length.value)
+        finally:
+            self.close()
+
+    def close(self):
+        if self._sort:
+            _lib.xs_free(self._sort)
+            self._sort = None
 
 # ----------------------------
 # Data model
 # ----------------------------
-PAGE_SIZE = 4096
+DEFAULT_PAGE_SIZE = 4096
 
 class DataType(Enum):
     INT = "INT"
     TEXT = "TEXT"
 
 class Column:
-    def __init__(self, name: str, dtype: DataType, primary_key: bool = False, unique: bool = False):
+    def __init__(self, name: str, dtype: DataType, primary_key: bool = False, unique: bool = False,
+                 dictionary: bool = False):
+        if dictionary and dtype != DataType.TEXT:
+            raise ValueError(f"Column '{name}': only TEXT columns can be dictionary-encoded")
         self.name = name
         self.dtype = dtype
         self.primary_key = primary_key
         self.unique = unique
+        self.dictionary = dictionary  # store codes into a table-wide TextDictionary
 
     def validate(self, value):
         if self.dtype == DataType.INT:
@@ -109,21 +462,223 @@ class Column:
             if not isinstance(value, str):
                 raise TypeError(f"Column '{self.name}' expects TEXT, got {type(value).__name__}")
 
+class TableStats:
+    """Per-table statistics, updated in the same WAL transaction as the rows.
+
+    min/max are bounds: they widen on insert/update but are not narrowed on
+    delete, so they stay safe for ID allocation and range pruning.
+    """
+
+    TEXT_BOUND = 64  # characters of a TEXT value kept in its bounds
+
+    def __init__(self, row_count: int = 0, live_pages: int = 0, dead_pages: int = 0,
+                 col_min: Optional[Dict[str, Any]] = None, col_max: Optional[Dict[str, Any]] = None,
+                 analyze_page: Optional[int] = None, mods_since_analyze: int = 0,
+                 version: int = 0):
+        self.row_count = row_count
+        self.live_pages = live_pages
+        self.dead_pages = dead_pages
+        self.col_min = dict(col_min or {})
+        self.col_max = dict(col_max or {})
+        self.analyze_page = analyze_page          # page holding ANALYZE output, if any
+        self.mods_since_analyze = mods_since_analyze
+        # Bumped by every write that commits stats (_write_catalog), so a
+        # refresh can tell which tables changed
+        self.version = version
+
+    def copy(self) -> 'TableStats':
+        return TableStats(self.row_count, self.live_pages, self.dead_pages,
+                          self.col_min, self.col_max,
+                          self.analyze_page, self.mods_since_analyze, self.version)
+
+    # Long text is bounded by its prefix, so the catalog stays small. Both
+    # are idempotent, so bounds already cut are left as they are.
+    @classmethod
+    def _lower(cls, val):
+        return val[:cls.TEXT_BOUND] if isinstance(val, str) and len(val) > cls.TEXT_BOUND else val
+
+    @classmethod
+    def _upper(cls, val):
+        if isinstance(val, str) and len(val) > cls.TEXT_BOUND:
+            return val[:cls.TEXT_BOUND] + chr(0x10FFFF)
+        return val
+
+    def _widen(self, row: Dict[str, Any]):
+        for col, val in row.items():
+            if not isinstance(val, (int, str)):
+                continue
+            lo, hi = self._lower(val), self._upper(val)
+            if self.col_min.get(col) is None or lo < self.col_min[col]:
+                self.col_min[col] = lo
+            if self.col_max.get(col) is None or hi > self.col_max[col]:
+                self.col_max[col] = hi
+
+    def on_insert(self, row: Dict[str, Any], new_page: bool = True):
+        self.row_count += 1
+        if new_page:
+            self.live_pages += 1
+        self.mods_since_analyze += 1
+        self._widen(row)
+
+    def on_delete(self, page_freed: bool = True):
+        """dead_pages counts dead row slots left on live pages; a page whose
+        last row goes is freed for reuse instead."""
+        self.row_count -= 1
+        if page_freed:
+            self.live_pages -= 1
+        else:
+            self.dead_pages += 1
+        self.mods_since_analyze += 1
+
+    def on_update(self, new_row: Dict[str, Any], page_delta: int = 0):
+        self.live_pages += page_delta
+        self.mods_since_analyze += 1
+        self._widen(new_row)
+
+    def to_dict(self) -> Dict[str, Any]:
+        return {
+            "row_count": self.row_count,
+            "live_pages": self.live_pages,
+            "dead_pages": self.dead_pages,
+            "min": self.col_min,
+            "max": self.col_max,
+            "analyze_page": self.analyze_page,
+            "mods": self.mods_since_analyze,
+            "version": self.version,
+        }
+
+    @classmethod
+    def from_dict(cls, d: Dict[str, Any]) -> 'TableStats':
+        # Catalogs written before TEXT_BOUND hold whole values; cut them here
+        col_min = {c: cls._lower(v) for c, v in (d.get("min") or {}).items()}
+        col_max = {c: cls._upper(v) for c, v in (d.get("max") or {}).items()}
+        return cls(d.get("row_count", 0), d.get("live_pages", 0), d.get("dead_pages", 0),
+                   col_min, col_max, d.get("analyze_page"), d.get("mods", 0),
+                   d.get("version", 0))
+
+
+class SortedIndex(dict):
+    """Index dict (key -> page id or page-id set) that also keeps its keys sorted.
+
+    Inserting a new key is a bisect plus a list insert; range() walks keys
+    in order without sorting the table. Keys of one column share a type.
+    """
+
+    def __init__(self):
+        super().__init__()
+        self._keys = []
+
+    def __setitem__(self, key, value):
+        if key not in self:
+            insort(self._keys, key)
+        super().__setitem__(key, value)
+
+    def setdefault(self, key, default=None):
+        if key not in self:
+            self[key] = default
+        return self[key]
+
+    def __delitem__(self, key):
+        super().__delitem__(key)
+        del self._keys[bisect_left(self._keys, key)]
+
+    def clear(self):
+        super().clear()
+        self._keys.clear()
+
+    def range(self, lo: Any = None, lo_incl: bool = True, hi: Any = None, hi_incl: bool = True,
+              descending: bool = False):
+        """Yield (key, value) for lo <(=) key <(=) hi in key order; None = unbounded."""
+        keys = self._keys
+        start = 0 if lo is None else (bisect_left if lo_incl else bisect_right)(keys, lo)
+        end = len(keys) if hi is None else (bisect_right if hi_incl else bisect_left)(keys, hi)
+        span = range(end - 1, start - 1, -1) if descending else range(start, end)
+        for i in span:
+            if i >= len(keys):  # keys deleted while the caller was consuming
+                return
+            key = keys[i]
+            value = dict.get(self, key)
+            if value is not None:
+                yield key, value
+
+
 class Table:
-    def __init__(self, name: str, columns: List[Column], db_path: str, db: 'Database'):
+    """Row layout: one JSON row per page."""
+
+    LAYOUT = "row"
+    ZONE_PAGES = 16  # pages per zone-map entry
+    TOAST = True     # rows too large for a page move TEXT values to overflow chains
+
+    def __init__(self, name: str, columns: List[Column], db_path: str, db: 'Database',
+                 stats: Optional[TableStats] = None, indexes: Optional[List[str]] = None,
+                 dicts: Optional[Dict[str, Any]] = None):
         self.name = name
         self.columns = {col.name: col for col in columns}
         self.db_path = db_path
         self.db = db  # Reference to Database for page allocation
         self._pk_col = next((col.name for col in columns if col.primary_key), None)
         self._unique_cols = [col.name for col in columns if col.unique]
-        self._pk_index = {}
-        self._unique_indexes = {col: {} for col in self._unique_cols}
+        # TEXT columns whose values may be stored out of line (see toast.py)
+        self._toastable = [col.name for col in columns
+                           if col.dtype == DataType.TEXT and not col.dictionary] if self.TOAST else []
+        self._dropped: Dict[int, List[int]] = {}  # page -> chain pages its pending write drops
+        self.toasted = set()  # columns with out-of-line values (since loading)
+        self._pk_index = SortedIndex()
+        self._unique_indexes = {col: SortedIndex() for col in self._unique_cols}
+        # Non-unique secondary indexes: value -> set of page ids
+        self._secondary = {col: SortedIndex() for col in (indexes or [])}
+        # Zone maps: zone number -> {col: [min, max]}; bounds only widen
+        self._zones = {}
+        # Stats from the catalog are trusted; older catalogs get them rebuilt
+        # from the index scan below.
+        self.stats = stats
+        self._pages = set()  # live page ids; the sampling frame for ANALYZE
+        # Commit LSN of the last write to this table; versions cached results
+        self.lsn = commit_lsn()
+        # Dictionary-encoded TEXT columns; needed to decode pages below
+        dicts = dicts or {}
+        self._dicts = {
+            col.name: columnar.TextDictionary.load(
+                name, col.name, dicts.get(col.name),
+                lambda page: read_page(begin_read(), page))
+            for col in columns if col.dictionary
+        }
         self._rebuild_indexes()
+        self.analysis = self._load_analysis()
+
+    def _to_codes(self, row: Dict[str, Any]) -> Dict[str, Any]:
+        """Copy of row with dictionary columns replaced by their codes."""
+        if not self._dicts:
+            return row
+        out = dict(row)
+        for col, d in self._dicts.items():
+            if out.get(col) is not None:
+                out[col] = d.add(out[col])
+        return out
+
+    def _from_codes(self, row: Dict[str, Any]) -> Dict[str, Any]:
+        for col, d in self._dicts.items():
+            if isinstance(row.get(col), int):
+                row[col] = d.value(row[col])
+        return row
+
+    def _flush_dicts(self, txn):
+        """Stage dictionary entries added by this write; before _write_catalog."""
+        for d in self._dicts.values():
+            for page_id, data in d.dirty_pages(self.db.page_size, self.db.alloc_page):
+                self._write_bytes(txn, page_id, data)
+
+    def dictionary(self, col: str) -> Optional[List[str]]:
+        """Values of a dictionary-encoded column in code order, else None."""
+        d = self._dicts.get(col)
+        return None if d is None else d.values
 
     def _serialize_row(self, row: Dict[str, Any]) -> bytes:
         # Tag every row with its table name for isolation
-        tagged_row = {"__table__": self.name, **row}
+        tagged_row = {"__table__": self.name, **self._to_codes(row)}
+        for col, val in tagged_row.items():
+            if isinstance(val, toast.Pointer):
+                tagged_row[col] = val.to_json()
         return json.dumps(tagged_row).encode('utf-8')
 
     def _deserialize_row(self, data: bytes) -> Optional[Dict[str, Any]]:
@@ -137,35 +692,398 @@ class Table:
                 return None
             # Remove internal tag before returning
             row.pop("__table__", None)
-            return row
+            for col, val in row.items():
+                if isinstance(val, dict):
+                    row[col] = toast.Pointer.from_json(val)
+            return self._from_codes(row)
         except (json.JSONDecodeError, UnicodeDecodeError):
             return None
 
+    def _decode_page(self, data: bytes) -> Optional[List[Optional[Dict[str, Any]]]]:
+        """Row slots stored in a page of this table (None = deleted), or None."""
+        row = self._deserialize_row(data)
+        if row is None:
+            return None
+        return [None] if row.get("__deleted__") else [row]
+
+    def _write_bytes(self, txn, page_id: int, data: bytes):
+        size = self.db.page_size
+        if len(data) > size:
+            raise ValueError("Row too large")
+        buf = (ctypes.c_ubyte * size).from_buffer_copy(data.ljust(size, b'\x00'))
+        write_page(txn, page_id, ctypes.pointer(buf))
+
+    # ---- out-of-line values ----
+    def _page_reader(self, txn):
+        return lambda page_id: read_page(txn, page_id)
+
+    def _stored_row(self, page_id: int) -> Dict[str, Any]:
+        """The row on page_id as stored, overflow pointers and all."""
+        return self._deserialize_row(read_page(begin_read(), page_id)) or {}
+
+    def _detoast(self, txn, row: Dict[str, Any], columns=None):
+        """Replace the overflow pointers in columns (None: all) by their values."""
+        for col in self._toastable if columns is None else columns:
+            val = row.get(col)
+            if isinstance(val, toast.Pointer):
+                row[col] = toast.load(self._page_reader(txn), val)
+
+    def _toast_row(self, txn, row: Dict[str, Any], old: Optional[Dict[str, Any]] = None) -> Dict[str, Any]:
+        """The row to store: while it does not fit a page, its largest TEXT
+        value goes to an overflow chain (reusing old's chain if unchanged)."""
+        if len(self._serialize_row(row)) <= self.db.page_size:
+            return row
+        stored = dict(row)
+        large = sorted((c for c in self._toastable if isinstance(row.get(c), str)),
+                       key=lambda c: len(row[c]), reverse=True)
+        for col in large:
+            prev = (old or {}).get(col)
+            if isinstance(prev, toast.Pointer) and toast.same_value(prev, row[col]):
+                stored[col] = prev
+            else:
+                stored[col] = toast.store(self.name, row[col], self.db.page_size, self.db.alloc_page,
+                                          lambda p, data: self._write_bytes(txn, p, data),
+                                          self.db.toast_compress)
+            self.toasted.add(col)
+            if len(self._serialize_row(stored)) <= self.db.page_size:
+                return stored
+        raise ValueError("Row too large")
+
+    def _drop_chains(self, page_id: int, old: Dict[str, Any], kept: Dict[str, Any]):
+        """Remember the chains of old that kept no longer points at; their
+        pages are freed once the write commits (_free_dropped)."""
+        reader = self._page_reader(begin_read())
+        keep = {v.first for v in kept.values() if isinstance(v, toast.Pointer)}
+        self._dropped[page_id] = [p for v in old.values()
+                                  if isinstance(v, toast.Pointer) and v.first not in keep
+                                  for p in toast.chain_pages(reader, v)]
+
+    def _free_dropped(self, page_id: int):
+        for p in self._dropped.pop(page_id, ()):
+            self.db.free_page(p)
+
+    def stream_value(self, key_col: str, key_val: Any, col: str) -> Iterator[str]:
+        """Yield the value of col in the row keyed key_col = key_val in
+        pieces, reading an overflow chain one page at a time."""
+        page_id = self._find_page_by_key(key_col, key_val)
+        if page_id is None:
+            raise KeyError(f"No row with {key_col} = {key_val}")
+        txn = begin_read()
+        for row in self._decode_page(read_page(txn, page_id)) or ():
+            if row is not None and row.get(key_col) == key_val:
+                val = row.get(col)
+                if isinstance(val, toast.Pointer):
+                    yield from toast.stream(self._page_reader(txn), val)
+                elif val is not None:
+                    yield val
+                return
+        raise KeyError(f"No row with {key_col} = {key_val}")
+
+    # ---- storage hooks: how rows map onto pages (overridden by ColumnarTable) ----
+    def _store_insert(self, txn, row: Dict[str, Any]) -> Tuple[int, bool]:
+        """Write a new row; returns (page_id, page_became_live)."""
+        data = self._serialize_row(self._toast_row(txn, row))
+        if len(data) > self.db.page_size:
+            raise ValueError("Row too large")
+        # Allocate page from global database allocator
+        page_id = self.db.alloc_page()
+        self._write_bytes(txn, page_id, data)
+        return page_id, True
+
+    def _store_delete(self, txn, page_id: int, key_col: str, key_val: Any) -> bool:
+        """Delete the row keyed key_col = key_val; returns True if its page is now empty."""
+        if self._toastable:
+            self._drop_chains(page_id, self._stored_row(page_id), {})
+        self._write_bytes(txn, page_id, self._serialize_row({"__deleted__": True}))
+        return True
+
+    def _store_update(self, txn, page_id: int, key_col: str, key_val: Any,
+                      new_row: Dict[str, Any]) -> Tuple[int, bool]:
+        """Rewrite a row in place; returns (page_id it now lives on, old page now empty)."""
+        if not self._toastable:
+            self._write_bytes(txn, page_id, self._serialize_row(new_row))
+            return page_id, False
+        old = self._stored_row(page_id)
+        stored = self._toast_row(txn, new_row, old)
+        self._write_bytes(txn, page_id, self._serialize_row(stored))
+        self._drop_chains(page_id, old, stored)
+        return page_id, False
+
+    def _store_move(self, txn, page_id: int, new_page_id: int, rows: List[Dict[str, Any]]) -> int:
+        """Copy the live rows of page_id onto the free page new_page_id and
+        empty page_id (VACUUM); returns the dead slots left behind."""
+        # The stored image, so overflow pointers move along unchanged
+        self._write_bytes(txn, new_page_id, read_page(begin_read(), page_id))
+        self._write_bytes(txn, page_id, self._serialize_row({"__deleted__": True}))
+        return 0
+
+    def _saw_page(self, page_id: int, slots: List[Optional[Dict[str, Any]]]):
+        """Called for each of this table's pages during _rebuild_indexes."""
+
+    def _release_page(self, page_id: int):
+        """A committed delete or move left page_id without live rows: hand
+        it back to the database's free list."""
+        self._pages.discard(page_id)
+        self.db.free_page(page_id)
+
+    def _read_row(self, page_id: int, key_col: str, key_val: Any) -> Optional[Dict[str, Any]]:
+        for _, row in self.read_rows([page_id]):
+            if row.get(key_col) == key_val:
+                return row
+        return None
+
     def _rebuild_indexes(self):
         self._pk_index.clear()
         for idx in self._unique_indexes.values():
             idx.clear()
-
+        for idx in self._secondary.values():
+            idx.clear()
+        self._zones.clear()
+        self._pages.clear()
+        derived = TableStats()
+
+        empty = []  # pages left holding only tombstones: free for reuse
+        chains = {}  # this table's overflow pages -> next page of their chain
+        heads = set()  # first pages of the chains live rows point at
+        indexed = [c for c in self._toastable
+                   if c == self._pk_col or c in self._unique_indexes or c in self._secondary]
         txn = begin_read()
         page_id = 1
-        while True:
-            raw_ptr = read_page(txn, page_id)
-            if not raw_ptr:
-                break
-            raw = bytes(raw_ptr.contents)
+        # Pages at or past next_page are unallocated: a VACUUM may have cut
+        # them off while the db file still holds their last image
+        while page_id < self.db.next_page:
+            raw = read_page(txn, page_id)
             if all(b == 0 for b in raw):
                 break
-            row = self._deserialize_row(raw)
-            if row is None or row.get("__deleted__"):
+            if toast.is_toast(raw):
+                name, next_page, _ = toast.parse_page(raw)
+                if name == self.name:
+                    chains[page_id] = next_page
+                page_id += 1
+                continue
+            slots = self._decode_page(raw)
+            if slots is None:
+                page_id += 1
+                continue
+            self._saw_page(page_id, slots)
+            if all(row is None for row in slots):
+                empty.append(page_id)
                 page_id += 1
                 continue
-            if self._pk_col and self._pk_col in row:
-                self._pk_index[row[self._pk_col]] = page_id
-            for col in self._unique_cols:
-                if col in row:
-                    self._unique_indexes[col][row[col]] = page_id
+            for row in slots:
+                if row is None:
+                    derived.dead_pages += 1
+                    continue
+                for col, val in row.items():
+                    if isinstance(val, toast.Pointer):
+                        heads.add(val.first)
+                        self.toasted.add(col)
+                self._detoast(txn, row, indexed)
+                derived.on_insert(row, new_page=page_id not in self._pages)
+                self._pages.add(page_id)
+                self._index_row(page_id, row)
+                if self._pk_col and self._pk_col in row:
+                    self._pk_index[row[self._pk_col]] = page_id
+                for col in self._unique_cols:
+                    if col in row:
+                        self._unique_indexes[col][row[col]] = page_id
             page_id += 1
 
+        # Chain pages no live row reaches were dropped by a delete or update
+        for page_id in heads:
+            while page_id in chains:
+                page_id = chains.pop(page_id)
+        for page_id in empty + sorted(chains):
+            self._release_page(page_id)
+        if self.stats is None:
+            derived.mods_since_analyze = 0
+            self.stats = derived
+
+    # ----------------------------
+    # ANALYZE
+    # ----------------------------
+    ANALYZE_TAG = "__analyze__"
+
+    def _load_analysis(self) -> Dict[str, analyze.ColumnAnalysis]:
+        if self.stats.analyze_page is None:
+            return {}
+        raw = read_page(begin_read(), self.stats.analyze_page)
+        try:
+            doc = json.loads(raw.rstrip(b'\x00').decode('utf-8'))
+            if doc.get("__table__") != self.ANALYZE_TAG or doc.get("table") != self.name:
+                return {}
+            return {col: analyze.ColumnAnalysis.from_dict(d) for col, d in doc["columns"].items()}
+        except (json.JSONDecodeError, UnicodeDecodeError, KeyError):
+            return {}
+
+    def _encode_analysis(self, analysis: Dict[str, analyze.ColumnAnalysis]) -> bytes:
+        columns = {col: a.to_dict() for col, a in analysis.items()}
+        # Shed the bulkiest parts first if a wide table overflows the page
+        for shed in (None, "mcv", "hist"):
+            if shed:
+                for d in columns.values():
+                    d[shed] = []
+            data = json.dumps({"__table__": self.ANALYZE_TAG, "table": self.name,
+                               "columns": columns}).encode('utf-8')
+            if len(data) <= self.db.page_size:
+                return data
+        raise ValueError("Analyze stats too large")
+
+    def analyze(self, sample_pages: int = analyze.SAMPLE_PAGES) -> Dict[str, analyze.ColumnAnalysis]:
+        """Sample up to sample_pages of this table and persist column statistics."""
+        pages = sorted(self._pages)
+        if len(pages) > sample_pages:
+            pages = sorted(random.sample(pages, sample_pages))
+
+        rows = [row for _, row in self.read_rows(pages)]
+
+        result = analyze.analyze_rows(rows, list(self.columns), self.stats.row_count)
+        data = self._encode_analysis(result)
+
+        new_stats = self.stats.copy()
+        alloc = self.db._write_mark()
+        txn = begin_write()
+        try:
+            if new_stats.analyze_page is None:
+                new_stats.analyze_page = self.db.alloc_page()
+            new_stats.mods_since_analyze = 0
+            self._write_bytes(txn, new_stats.analyze_page, data)
+            self.db._write_catalog(txn, {self.name: new_stats})
+        except Exception:
+            self.db._abort(txn, alloc)
+            raise
+        commit(txn)
+
+        self.stats = new_stats
+        self.analysis = result
+        return result
+
+    def _after_write(self, *rows: Dict[str, Any]):
+        """Fold the rows of a committed write into the ANALYZE output,
+        refreshing it when stale. Call once per write and table, after its
+        indexes, views and LSN are all current: a re-ANALYZE commits the
+        catalog as it then stands."""
+        if not self.analysis:
+            return
+        if analyze.needs_reanalyze(self.stats.mods_since_analyze, self.stats.row_count):
+            self.analyze()
+            return
+        # Distinct-count sketches absorb new values without a rescan
+        for row in rows:
+            for col, a in self.analysis.items():
+                if row.get(col) is not None:
+                    a.hll.add(row[col])
+
+    def _index_row(self, page_id: int, row: Dict[str, Any]):
+        for col, idx in self._secondary.items():
+            if col in row:
+                idx.setdefault(row[col], set()).add(page_id)
+        zone = self._zones.setdefault(page_id // self.ZONE_PAGES, {})
+        for col, val in row.items():
+            if isinstance(val, toast.Pointer):
+                zone[col] = None  # not read while loading: no bounds for this zone
+                continue
+            if col not in zone:
+                zone[col] = [val, val]
+                continue
+            bounds = zone[col]
+            if bounds is None:
+                continue
+            if isinstance(val, type(bounds[0])):
+                if val < bounds[0]:
+                    bounds[0] = val
+                if val > bounds[1]:
+                    bounds[1] = val
+
+    def _unindex_row(self, page_id: int, row: Dict[str, Any]):
+        for col, idx in self._secondary.items():
+            pages = idx.get(row.get(col))
+            if pages is not None:
+                pages.discard(page_id)
+                if not pages:
+                    del idx[row[col]]
+
+    def create_index(self, col: str):
+        """Add a non-unique secondary index on col and record it in the catalog."""
+        if col not in self.columns:
+            raise ValueError(f"Unknown column: {col}")
+        if col in self._secondary or col == self._pk_col or col in self._unique_cols:
+            raise ValueError(f"Column '{col}' is already indexed")
+        self._secondary[col] = SortedIndex()
+        for page_id, row in self.read_rows(sorted(self._pages)):
+            self._secondary[col].setdefault(row[col], set()).add(page_id)
+        try:
+            self.db._save_catalog()
+        except Exception:
+            del self._secondary[col]
+            raise
+
+    # ----------------------------
+    # Access paths (used by the planner)
+    # ----------------------------
+    def page_ids(self) -> List[int]:
+        return sorted(self._pages)
+
+    def read_rows(self, page_ids, txn=None, columns=None):
+        """Yield (page_id, row) for the live rows of this table among page_ids.
+
+        Overflow chains are read for columns only (None: all); other
+        out-of-line values stay toast.Pointer.
+        """
+        if txn is None:
+            txn = begin_read()
+        for page_id in page_ids:
+            for row in self._decode_page(read_page(txn, page_id)) or ():
+                if row is not None:
+                    if self._toastable:
+                        self._detoast(txn, row, columns)
+                    yield page_id, row
+
+    def index_kind(self, col: str) -> Optional[str]:
+        if col == self._pk_col:
+            return "pk"
+        if col in self._unique_indexes:
+            return "unique"
+        if col in self._secondary:
+            return "secondary"
+        return None
+
+    def index_lookup(self, col: str, value: Any) -> List[int]:
+        kind = self.index_kind(col)
+        if kind == "secondary":
+            return sorted(self._secondary[col].get(value, ()))
+        page_id = self._find_page_by_key(col, value)
+        return [] if page_id is None else [page_id]
+
+    def index_range(self, col: str, lo: Any = None, lo_incl: bool = True, hi: Any = None,
+                    hi_incl: bool = True, descending: bool = False):
+        """Yield (key, page ids) from the index on col in key order within the bounds."""
+        kind = self.index_kind(col)
+        if kind == "secondary":
+            for key, pages in self._secondary[col].range(lo, lo_incl, hi, hi_incl, descending):
+                yield key, sorted(pages)
+            return
+        idx = self._pk_index if kind == "pk" else self._unique_indexes[col]
+        for key, page_id in idx.range(lo, lo_incl, hi, hi_incl, descending):
+            yield key, [page_id]
+
+    def index_entries(self, col: str) -> int:
+        """Number of distinct keys in the index on col (0 if unindexed)."""
+        if col == self._pk_col:
+            return len(self._pk_index)
+        if col in self._unique_indexes:
+            return len(self._unique_indexes[col])
+        return len(self._secondary.get(col, ()))
+
+    def zone_pages(self, may_match) -> List[int]:
+        """Live pages whose zone bounds pass may_match({col: [min, max]})."""
+        pages = []
+        for page_id in sorted(self._pages):
+            zone = self._zones.get(page_id // self.ZONE_PAGES)
+            if zone is None or may_match(zone):
+                pages.append(page_id)
+        return pages
+
     def _find_page_by_key(self, col_name: str, value: Any) -> Optional[int]:
         if col_name == self._pk_col:
             return self._pk_index.get(value)
@@ -173,7 +1091,18 @@ class Table:
             return self._unique_indexes[col_name].get(value)
         return None
 
-    def insert(self, row: Dict[str, Any]):
+    def _check_writable(self):
+        if self.name in self.db.views:
+            raise PermissionError(f"'{self.name}' is a materialized view; write to its source tables")
+
+    def _check_insert(self, row: Dict[str, Any],
+                      claimed: Optional[Dict[str, set]] = None) -> Dict[str, Any]:
+        """Validate a row for insert; returns the row to store.
+
+        claimed maps pk/unique columns to keys taken earlier in the same
+        batch, which are not in the indexes until the batch commits.
+        """
+        self._check_writable()
         if set(row.keys()) != set(self.columns.keys()):
             raise ValueError(f"Row must have exactly columns: {list(self.columns.keys())}")
 
@@ -183,64 +1112,136 @@ class Table:
             col.validate(val)
             clean_row[col_name] = val
 
+        claimed = claimed if claimed is not None else {}
         if self._pk_col:
             pk_val = clean_row[self._pk_col]
-            if pk_val in self._pk_index:
+            if pk_val in self._pk_index or pk_val in claimed.get(self._pk_col, ()):
                 raise ValueError(f"Duplicate primary key: {pk_val}")
 
         for col_name in self._unique_cols:
             uval = clean_row[col_name]
-            if uval in self._unique_indexes[col_name]:
+            if uval in self._unique_indexes[col_name] or uval in claimed.get(col_name, ()):
                 raise ValueError(f"Duplicate unique value in '{col_name}': {uval}")
 
-        txn = begin_write()
-        try:
-            row_bytes = self._serialize_row(clean_row)
-            if len(row_bytes) > PAGE_SIZE:
-                raise ValueError("Row too large")
-            page_data = (ctypes.c_ubyte * PAGE_SIZE)()
-            for i, b in enumerate(row_bytes):
-                page_data[i] = b
+        for col_name in ([self._pk_col] if self._pk_col else []) + list(self._unique_cols):
+            claimed.setdefault(col_name, set()).add(clean_row[col_name])
+        return clean_row
 
-            # Allocate page from global database allocator
-            page_id = self.db.alloc_page()
-            write_page(txn, page_id, ctypes.pointer(page_data))
+    def _apply_insert(self, page_id: int, row: Dict[str, Any]):
+        """Index a row whose insert has committed."""
+        if self._pk_col:
+            self._pk_index[row[self._pk_col]] = page_id
+        for col_name in self._unique_cols:
+            self._unique_indexes[col_name][row[col_name]] = page_id
+        self._pages.add(page_id)
+        self._index_row(page_id, row)
+
+    def _apply_delete(self, page_id: int, old_row: Dict[str, Any], page_freed: bool):
+        """Unindex a row whose delete has committed."""
+        if self._pk_col and old_row.get(self._pk_col) in self._pk_index:
+            del self._pk_index[old_row[self._pk_col]]
+        for col_name in self._unique_cols:
+            if old_row.get(col_name) in self._unique_indexes[col_name]:
+                del self._unique_indexes[col_name][old_row[col_name]]
+        self._unindex_row(page_id, old_row)
+        self._free_dropped(page_id)
+        if page_freed:
+            self._release_page(page_id)
+
+    def _apply_update(self, page_id: int, new_page_id: int, old_row: Dict[str, Any],
+                      new_row: Dict[str, Any], old_freed: bool):
+        """Reindex a row whose update has committed; a columnar row may
+        have moved to another page."""
+        moved = new_page_id != page_id
+        if moved:
+            self._pages.add(new_page_id)
+        if self._pk_col:
+            del self._pk_index[old_row[self._pk_col]]
+            self._pk_index[new_row[self._pk_col]] = new_page_id
 
-            if self._pk_col:
-                self._pk_index[pk_val] = page_id
-            for col_name in self._unique_cols:
-                self._unique_indexes[col_name][uval] = page_id
+        for col in self._unique_cols:
+            if old_row.get(col) != new_row.get(col) or moved:
+                old_val = old_row.get(col)
+                if old_val is not None and old_val in self._unique_indexes[col]:
+                    del self._unique_indexes[col][old_val]
+                self._unique_indexes[col][new_row[col]] = new_page_id
+
+        self._unindex_row(page_id, old_row)
+        self._index_row(new_page_id, new_row)
+        self._free_dropped(page_id)
+        if old_freed:
+            self._release_page(page_id)
+
+    def _apply_move(self, page_id: int, new_page_id: int, rows: List[Dict[str, Any]]):
+        """Reindex rows whose move by _store_move has committed."""
+        for row in rows:
+            self._apply_update(page_id, new_page_id, row, row, False)
+        self._release_page(page_id)
 
-            commit(txn)
-            checkpoint()  # ✅ Always checkpoint during development
+    def insert(self, row: Dict[str, Any]):
+        clean_row = self._check_insert(row)
 
+        alloc = self.db._write_mark()
+        txn = begin_write()
+        try:
+            page_id, new_page = self._store_insert(txn, clean_row)
+            self._flush_dicts(txn)
+
+            # Stats, next_page and dependent views ride along in the same transaction
+            new_stats = self.stats.copy()
+            new_stats.on_insert(clean_row, new_page)
+            stats = {self.name: new_stats}
+            views_done = self.db.views.stage(txn, [(self, None, clean_row)], stats)
+            self.db._write_catalog(txn, stats)
         except Exception:
+            self.db._abort(txn, alloc)
             raise
 
+        commit(txn)
+        self.stats = new_stats
+        self._apply_insert(page_id, clean_row)
+        views_done()
+        # Last: a cached read that sees the new LSN must also see the new indexes
+        self.lsn = commit_lsn()
+        checkpoint()  # ✅ Always checkpoint during development
+        self._after_write(clean_row)
+
+    def insert_many(self, rows: List[Dict[str, Any]]) -> List[Optional[Exception]]:
+        """Insert rows in one transaction; see Database.insert_batch."""
+        return self.db.insert_batch([(self.name, row) for row in rows])
+
     def delete(self, key_col: str, key_val: Any):
+        self._check_writable()
         page_id = self._find_page_by_key(key_col, key_val)
         if page_id is None:
             raise KeyError(f"No row with {key_col} = {key_val}")
 
+        old_row = self._read_row(page_id, key_col, key_val) or {key_col: key_val}
+
+        alloc = self.db._write_mark()
         txn = begin_write()
         try:
-            tomb = self._serialize_row({"__deleted__": True})
-            buf = (ctypes.c_ubyte * PAGE_SIZE)()
-            for i, b in enumerate(tomb):
-                buf[i] = b
-            write_page(txn, page_id, ctypes.pointer(buf))
-
-            if key_col == self._pk_col:
-                del self._pk_index[key_val]
-            elif key_col in self._unique_indexes:
-                del self._unique_indexes[key_col][key_val]
-
-            commit(txn)
-            # Optional: checkpoint() here if you want immediate durability
+            page_freed = self._store_delete(txn, page_id, key_col, key_val)
+
+            new_stats = self.stats.copy()
+            new_stats.on_delete(page_freed)
+            stats = {self.name: new_stats}
+            views_done = self.db.views.stage(txn, [(self, old_row, None)], stats)
+            self.db._write_catalog(txn, stats)
         except Exception:
+            self.db._abort(txn, alloc)
             raise
 
+        commit(txn)
+        self.stats = new_stats
+        self._apply_delete(page_id, old_row, page_freed)
+        views_done()
+        self.lsn = commit_lsn()
+        self._after_write()
+        # Optional: checkpoint() here if you want immediate durability
+
     def update(self, where_col: str, where_val: Any, updates: Dict[str, Any]):
+        self._check_writable()
         # Validate that all update keys are valid columns
         for col_name in updates:
             if col_name not in self.columns:
@@ -253,11 +1254,8 @@ class Table:
             raise KeyError(f"No row with {where_col} = {where_val}")
 
         # Read the existing row
-        txn = begin_read()
-        raw_ptr = read_page(txn, page_id)
-        raw = bytes(raw_ptr.contents)
-        old_row = self._deserialize_row(raw)
-        if old_row is None or old_row.get("__deleted__"):
+        old_row = self._read_row(page_id, where_col, where_val)
+        if old_row is None:
             raise KeyError("Row not found")
 
         # Apply updates
@@ -278,58 +1276,44 @@ class Table:
                     raise ValueError(f"Duplicate unique value in '{col}': {new_val}")
 
         # Write updated row
+        alloc = self.db._write_mark()
         txn_write = begin_write()
         try:
-            row_bytes = self._serialize_row(new_row)
-            if len(row_bytes) > PAGE_SIZE:
-                raise ValueError("Row too large")
-            page_data = (ctypes.c_ubyte * PAGE_SIZE)()
-            for i, b in enumerate(row_bytes):
-                page_data[i] = b
-            write_page(txn_write, page_id, ctypes.pointer(page_data))
-            commit(txn_write)
-            # Optional: checkpoint()
-            # Update indexes
-            if self._pk_col and self._pk_col in updates:
-                del self._pk_index[where_val]
-                self._pk_index[new_row[self._pk_col]] = page_id
-
-            for col in self._unique_cols:
-                if col in updates:
-                    # Remove old value if it was indexed
-                    if where_col == col:
-                        old_val = where_val
-                    else:
-                        old_val = old_row.get(col)
-                    if old_val is not None and old_val in self._unique_indexes[col]:
-                        del self._unique_indexes[col][old_val]
-                    self._unique_indexes[col][new_row[col]] = page_id
-
+            new_page_id, old_freed = self._store_update(txn_write, page_id, where_col, where_val, new_row)
+            self._flush_dicts(txn_write)
+            moved = new_page_id != page_id
+            new_stats = self.stats.copy()
+            new_stats.on_update(new_row, int(moved) - int(old_freed))
+            stats = {self.name: new_stats}
+            views_done = self.db.views.stage(txn_write, [(self, old_row, new_row)], stats)
+            self.db._write_catalog(txn_write, stats)
         except Exception:
+            self.db._abort(txn_write, alloc)
             raise
 
+        commit(txn_write)
+        self.stats = new_stats
+        # Optional: checkpoint()
+        self._apply_update(page_id, new_page_id, old_row, new_row, old_freed)
+        views_done()
+        self.lsn = commit_lsn()
+        self._after_write(new_row)
+
+    def count(self) -> int:
+        """Live row count from the maintained stats (no scan)."""
+        return self.stats.row_count
+
+    def column_min(self, col: str) -> Any:
+        """Lower bound of a column's values, or None for an empty table."""
+        return self.stats.col_min.get(col)
+
+    def column_max(self, col: str) -> Any:
+        """Upper bound of a column's values, or None for an empty table."""
+        return self.stats.col_max.get(col)
+
     def select(self, where_col: Optional[str] = None, where_val: Any = None) -> List[Dict[str, Any]]:
-        rows = []
-        txn = begin_read()
-        page_id = 1
-        while True:
-            raw_ptr = read_page(txn, page_id)
-            if not raw_ptr:
-                break
-            raw = bytes(raw_ptr.contents)
-            if all(b == 0 for b in raw):
-                break
-            row = self._deserialize_row(raw)
-            if row is None or row.get("__deleted__"):
-                page_id += 1
-                continue
-            if where_col is not None:
-                if row.get(where_col) != where_val:
-                    page_id += 1
-                    continue
-            rows.append(row)
-            page_id += 1
-        return rows
+        preds = [] if where_col is None else [planner.Predicate(where_col, "=", where_val)]
+        return self.db.planner.select(self.name, preds)
 
     def hash_join(self, other: 'Table', self_key: str, other_key: str) -> List[Dict]:
         # Force join keys to STRINGS to ensure matching in C
@@ -371,103 +1355,495 @@ class Table:
             print(f"    {r.decode('utf-8')}")
         print()
 
-        output_buf = bytearray(1024 * 1024)  # 1MB buffer
-        count = hash_join_c(inner_rows, outer_rows, self_key, other_key, output_buf)
+        join = CHashJoin(inner_rows, self_key)
+        try:
+            return list(join.probe(outer_rows, other_key))
+        finally:
+            join.close()
+
+
+class ColumnarTable(Table):
+    """PAX layout: up to columnar.MAX_ROWS rows per page, stored column by column.
+
+    Inserts fill the table's last page until it is full. A delete clears
+    the row's slot; an update that no longer fits its page moves the row
+    to a fresh page.
+    """
+
+    LAYOUT = "columnar"
+    TOAST = False  # values stay inline, where the C vector engine reads them
+
+    def __init__(self, name: str, columns: List[Column], db_path: str, db: 'Database',
+                 stats: Optional[TableStats] = None, indexes: Optional[List[str]] = None,
+                 dicts: Optional[Dict[str, Any]] = None):
+        self._tail_page = None  # last page of this table; inserts append here
+        super().__init__(name, columns, db_path, db, stats, indexes, dicts)
+
+    def _column_types(self) -> List[Tuple[str, int]]:
+        return [(col.name, columnar.TYPE_CODE if col.dictionary else
+                 columnar.TYPE_TEXT if col.dtype == DataType.TEXT else columnar.TYPE_INT)
+                for col in self.columns.values()]
+
+    def _decode_page(self, data: bytes) -> Optional[List[Optional[Dict[str, Any]]]]:
+        slots = columnar.decode_page(data, self.name)
+        if slots is None or not self._dicts:
+            return slots
+        return [None if row is None else self._from_codes(row) for row in slots]
+
+    def _encode_page(self, slots: List[Optional[Dict[str, Any]]]) -> bytes:
+        slots = [None if row is None else self._to_codes(row) for row in slots]
+        return columnar.encode_page(self.name, self._column_types(), slots)
+
+    def _page_slots(self, page_id: int) -> List[Optional[Dict[str, Any]]]:
+        return self._decode_page(read_page(begin_read(), page_id)) or []
+
+    def _saw_page(self, page_id: int, slots: List[Optional[Dict[str, Any]]]):
+        self._tail_page = page_id
+
+    def _release_page(self, page_id: int):
+        # An empty tail page stays ours: the next insert refills it
+        if page_id == self._tail_page:
+            self._pages.discard(page_id)
+        else:
+            super()._release_page(page_id)
+
+    @staticmethod
+    def _slot_of(slots, key_col: str, key_val: Any) -> int:
+        for i, row in enumerate(slots):
+            if row is not None and row.get(key_col) == key_val:
+                return i
+        raise KeyError(f"No row with {key_col} = {key_val}")
+
+    def _new_page(self, txn, slots: List[Optional[Dict[str, Any]]]) -> int:
+        data = self._encode_page(slots)
+        if len(data) > self.db.page_size:
+            raise ValueError("Row too large")
+        page_id = self.db.alloc_page()
+        self._write_bytes(txn, page_id, data)
+        self._tail_page = page_id
+        return page_id
+
+    def _store_insert(self, txn, row: Dict[str, Any]) -> Tuple[int, bool]:
+        if self._tail_page is not None:
+            slots = self._page_slots(self._tail_page)
+            if len(slots) < columnar.MAX_ROWS:
+                data = self._encode_page(slots + [row])
+                if len(data) <= self.db.page_size:
+                    self._write_bytes(txn, self._tail_page, data)
+                    return self._tail_page, all(r is None for r in slots)
+        return self._new_page(txn, [row]), True
+
+    def _store_delete(self, txn, page_id: int, key_col: str, key_val: Any) -> bool:
+        slots = self._page_slots(page_id)
+        slots[self._slot_of(slots, key_col, key_val)] = None
+        self._write_bytes(txn, page_id, self._encode_page(slots))
+        return all(r is None for r in slots)
+
+    def _store_update(self, txn, page_id: int, key_col: str, key_val: Any,
+                      new_row: Dict[str, Any]) -> Tuple[int, bool]:
+        slots = self._page_slots(page_id)
+        i = self._slot_of(slots, key_col, key_val)
+        slots[i] = new_row
+        data = self._encode_page(slots)
+        if len(data) <= self.db.page_size:
+            self._write_bytes(txn, page_id, data)
+            return page_id, False
+        # The grown row no longer fits beside its neighbours: move it
+        new_page_id = self._new_page(txn, [new_row])
+        slots[i] = None
+        self._write_bytes(txn, page_id, self._encode_page(slots))
+        return new_page_id, all(r is None for r in slots)
+
+    def _store_move(self, txn, page_id: int, new_page_id: int, rows: List[Dict[str, Any]]) -> int:
+        slots = self._page_slots(page_id)
+        self._write_bytes(txn, new_page_id, self._encode_page(rows))
+        self._write_bytes(txn, page_id, self._encode_page([None] * len(slots)))
+        return len(slots) - len(rows)
+
+    def _apply_move(self, page_id: int, new_page_id: int, rows: List[Dict[str, Any]]):
+        if page_id == self._tail_page:
+            self._tail_page = new_page_id
+        super()._apply_move(page_id, new_page_id, rows)
+
+    def _unindex_row(self, page_id: int, row: Dict[str, Any]):
+        # Other rows on the page may share the value and still need the entry
+        remaining = [r for r in self._page_slots(page_id) if r is not None]
+        for col, idx in self._secondary.items():
+            val = row.get(col)
+            if any(r.get(col) == val for r in remaining):
+                continue
+            pages = idx.get(val)
+            if pages is not None:
+                pages.discard(page_id)
+                if not pages:
+                    del idx[val]
 
-        results = []
-        pos = 0
-        for _ in range(count):
-            try:
-                end = pos
-                while end < len(output_buf) and output_buf[end] != 0:
-                    end += 1
-                if end <= pos:
-                    break
-                segment = output_buf[pos:end]
-                if segment:
-                    row = json.loads(segment.decode('utf-8'))
-                    results.append(row)
-                pos = end + 1
-            except Exception:
-                break
 
-        return results
+TABLE_LAYOUTS = {cls.LAYOUT: cls for cls in (Table, ColumnarTable)}
 
 
 class Database:
     CATALOG_PAGE = 0
     NEXT_PAGE_KEY = "next_page"  # Key for storing global next_page in catalog
-
-    def __init__(self, path: str):
-        open_db(path.encode('utf-8'))
+    STATS_KEY = "stats"          # Per-table TableStats, keyed by table name
+    INDEXES_KEY = "indexes"      # Per-table secondary index columns
+    LAYOUTS_KEY = "layouts"      # Tables not using the default row layout
+    DICTS_KEY = "dicts"          # Per-table {column: dictionary head page id}
+    VIEWS_KEY = "views"          # Materialized view definitions, by view table
+
+    SORT_MEM = 64 << 20          # Default memory budget of one external sort
+
+    def __init__(self, path: str, workers: Optional[int] = None, sort_mem: Optional[int] = None,
+                 tmpdir: Optional[str] = None, result_cache: int = 0, readonly: bool = False,
+                 replica: bool = False, toast_compress: bool = True, page_size: Optional[int] = None):
+        # readonly: attach to a database another process has open, reading
+        # through its shared WAL index; tables follow that writer's commits.
+        # replica: own the files, but change them only by replaying a
+        # primary's WAL (see replica.py); tables follow the replay.
+        # page_size: bytes per page of a database created by this open, a
+        # power of two from 4096 to 65536 (default 4096). It is kept in the
+        # db file's header; an existing database keeps the size it has.
+        if set_page_size(page_size or DEFAULT_PAGE_SIZE) != 0:
+            raise ValueError(f"Page size must be a power of two from 4096 to 65536, not {page_size}")
+        if readonly:
+            if open_db_readonly(path.encode('utf-8')) != 0:
+                raise RuntimeError(f"No writer has {path} open (missing or stale {path}-shm)")
+        else:
+            open_db(path.encode('utf-8'))
+            set_replica(int(replica))
+        self.page_size = page_size_of_db()
+        if page_size and page_size != self.page_size:
+            raise ValueError(f"{path} has {self.page_size}-byte pages, not {page_size}")
+        _bind_page_size(self.page_size)
+        self.readonly = readonly
+        self.replica = replica
         self.path = path
+        # Size of the shared C task pool; None: WALDB_WORKERS or one per CPU
+        self.workers = pool_start(workers or 0)
+        # Sorts larger than sort_mem spill runs under tmpdir (None: $TMPDIR or /tmp)
+        self.sort_mem = sort_mem or self.SORT_MEM
+        self.tmpdir = tmpdir
+        # zlib-compress overflowed values when that saves space (toast.py)
+        self.toast_compress = toast_compress
         self.tables = {}
         self.next_page = 1  # Global page allocator
+        self._free_pages: List[int] = []  # heap of page ids free for reuse
+        self._reused: List[int] = []      # free pages handed out since _write_mark
+        self.planner = planner.Planner(self)
+        # Optional LSN-versioned cache of query results (entries; 0 = off)
+        self.cache = querycache.ResultCache(self, result_cache) if result_cache else None
+        self.views = matview.Views(self)
+        self._loaded_lsn = commit_lsn()
+        self._refresh_lock = threading.Lock()
+        self._catalog_entries: Dict[str, Any] = {}  # per table, as last loaded
         self._load_catalog()
 
     def alloc_page(self) -> int:
-        """Allocate a new page ID globally."""
+        """Allocate a page ID globally: the lowest free page, else a new one."""
+        if self._free_pages:
+            page = heapq.heappop(self._free_pages)
+            self._reused.append(page)
+            return page
         page = self.next_page
         self.next_page += 1
         return page
 
-    def _save_catalog(self):
-        catalog = {
+    def _write_mark(self):
+        """Start of a write: the allocator and dictionary state that _abort
+        returns to."""
+        self._reused = []
+        return self.next_page, [(d, d.mark()) for t in self.tables.values() for d in t._dicts.values()]
+
+    def _abort(self, txn, mark):
+        """Drop a write that failed before commit (e.g. "Catalog too large"):
+        its staged pages, the pages it allocated and its dictionary entries."""
+        rollback(txn)
+        self.next_page, dicts = mark
+        for page in self._reused:
+            heapq.heappush(self._free_pages, page)
+        self._reused = []
+        for d, state in dicts:
+            d.rollback(state)
+
+    def free_page(self, page_id: int):
+        """Make a page whose rows are all deleted available to alloc_page.
+
+        There is no separate free-list structure on disk: the tombstones
+        that the deleting transaction wrote mark the page free, and loading
+        the tables finds them again. A reused page is simply overwritten
+        in the allocating transaction, so older snapshots still read its
+        old image from the WAL.
+        """
+        heapq.heappush(self._free_pages, page_id)
+
+    def free_page_count(self) -> int:
+        return len(self._free_pages)
+
+    def _catalog_dict(self, stats_overrides: Optional[Dict[str, TableStats]] = None) -> Dict[str, Any]:
+        stats_overrides = stats_overrides or {}
+        return {
             "tables": {
                 name: [
                     (col.name, col.dtype.value, col.primary_key, col.unique)
+                    + ((True,) if col.dictionary else ())
                     for col in table.columns.values()
                 ]
                 for name, table in self.tables.items()
             },
+            self.STATS_KEY: {
+                name: stats_overrides.get(name, table.stats).to_dict()
+                for name, table in self.tables.items()
+            },
+            self.INDEXES_KEY: {
+                name: list(table._secondary)
+                for name, table in self.tables.items() if table._secondary
+            },
+            self.LAYOUTS_KEY: {
+                name: table.LAYOUT
+                for name, table in self.tables.items() if table.LAYOUT != Table.LAYOUT
+            },
+            self.DICTS_KEY: {
+                name: {col: d.ref() for col, d in table._dicts.items()}
+                for name, table in self.tables.items() if table._dicts
+            },
+            self.VIEWS_KEY: self.views.specs(),
             self.NEXT_PAGE_KEY: self.next_page
         }
+
+    def _write_catalog(self, txn, stats_overrides: Optional[Dict[str, TableStats]] = None):
+        """Stage the catalog page in an open write transaction.
+
+        Callers pass the stats they are about to commit, for every table
+        whose pages the transaction writes; the in-memory copies are only
+        replaced once commit() returns.
+        """
+        for name, stats in (stats_overrides or {}).items():
+            stats.version = self.tables[name].stats.version + 1
+        data = json.dumps(self._catalog_dict(stats_overrides)).encode('utf-8')
+        if len(data) > self.page_size:
+            raise ValueError("Catalog too large")
+        buf = (ctypes.c_ubyte * self.page_size).from_buffer_copy(data.ljust(self.page_size, b'\x00'))
+        write_page(txn, self.CATALOG_PAGE, ctypes.pointer(buf))
+
+    def insert_batch(self, items: List[Tuple[str, Dict[str, Any]]]) -> List[Optional[Exception]]:
+        """Insert (table, row) pairs in a single transaction and one fsync.
+
+        Rows that fail validation or a key constraint (including against
+        earlier rows of the batch) are left out and their error returned
+        in their position; the rest commit together. Unlike Table.insert
+        this does not checkpoint: the background checkpoint catches up.
+        """
+        errors: List[Optional[Exception]] = [None] * len(items)
+        claimed: Dict[str, Dict[str, set]] = {}
+        new_stats: Dict[str, TableStats] = {}
+        staged = []
+
+        alloc = self._write_mark()
         txn = begin_write()
+        for i, (name, row) in enumerate(items):
+            try:
+                table = self.get_table(name)
+                clean_row = table._check_insert(row, claimed.setdefault(name, {}))
+                page_id, new_page = table._store_insert(txn, clean_row)
+            except (KeyError, ValueError) as e:
+                errors[i] = e
+                continue
+            new_stats.setdefault(name, table.stats.copy()).on_insert(clean_row, new_page)
+            staged.append((table, page_id, clean_row))
+        if not staged:
+            self._abort(txn, alloc)
+            return errors
+
         try:
-            data = json.dumps(catalog).encode('utf-8')
-            buf = (ctypes.c_ubyte * PAGE_SIZE)()
-            for i, b in enumerate(data):
-                buf[i] = b
-            write_page(txn, self.CATALOG_PAGE, ctypes.pointer(buf))
-            commit(txn)
-            checkpoint()  # ✅ CRITICAL: persist catalog to .pesa file
-        except Exception as e:
-            print(f"Warning: failed to save catalog: {e}")
-
-    def _load_catalog(self):
+            for name in new_stats:
+                self.tables[name]._flush_dicts(txn)
+            tables = set(new_stats)
+            views_done = self.views.stage(txn, [(table, None, row) for table, _, row in staged], new_stats)
+            self._write_catalog(txn, new_stats)
+        except Exception:
+            self._abort(txn, alloc)
+            raise
+        commit(txn)
+
+        for name in tables:
+            self.tables[name].stats = new_stats[name]
+        for table, page_id, clean_row in staged:
+            table._apply_insert(page_id, clean_row)
+        views_done()
+        # Only once the indexes are current may cached reads see the new version
+        lsn = commit_lsn()
+        for name in tables:
+            self.tables[name].lsn = lsn
+        for name in tables:
+            self.tables[name]._after_write(*(row for table, _, row in staged if table.name == name))
+        return errors
+
+    def table_stats(self) -> Dict[str, Dict[str, Any]]:
+        return {name: table.stats.to_dict() for name, table in self.tables.items()}
+
+    def pool_stats(self) -> Dict[str, Any]:
+        return pool_stats()
+
+    def query(self, logical) -> List[Dict[str, Any]]:
+        """Run a logical plan to a list, through the result cache when enabled."""
+        self.refresh()
+        if self.cache is not None:
+            return self.cache.rows(logical)
+        return self.planner.plan(logical).execute()
+
+    def etag(self, logical) -> str:
+        """HTTP ETag of a query's result, derived from its tables' commit LSNs."""
+        return querycache.etag(self, logical)
+
+    def _save_catalog(self):
+        """Commit the in-memory catalog. If it cannot be staged (e.g.
+        "Catalog too large"), the write is rolled back and the error raised,
+        so the caller can undo the change it was recording."""
+        mark = self._write_mark()
+        txn = begin_write()
+        try:
+            self._write_catalog(txn)
+        except Exception:
+            self._abort(txn, mark)
+            raise
+        commit(txn)
+        checkpoint()  # ✅ CRITICAL: persist catalog to .pesa file
+
+    def _load_catalog(self, keep: bool = False):
+        """Load the tables of the committed catalog. The new table map is
+        built aside and swapped in whole, so a reader sees either the old
+        or the new one. keep: reuse the loaded Table of every table whose
+        catalog entry (columns, stats with their write version, indexes,
+        layout, dictionaries) is unchanged, instead of scanning it again."""
         txn = begin_read()
-        raw_ptr = read_page(txn, self.CATALOG_PAGE)
-        if not raw_ptr:
-            return
-        raw = bytes(raw_ptr.contents)
+        raw = read_page(txn, self.CATALOG_PAGE)
         try:
             text = raw.rstrip(b'\x00').decode('utf-8')
-            if text:
-                catalog = json.loads(text)
-                self.next_page = catalog.get(self.NEXT_PAGE_KEY, 1)
-
-                for name, col_specs in catalog.get("tables", {}).items():
-                    columns = []
-                    for spec in col_specs:
-                        col_name, dtype_str, pk, uniq = spec
-                        dtype = DataType(dtype_str)
-                        columns.append(Column(col_name, dtype, primary_key=pk, unique=uniq))
-                    self.tables[name] = Table(name, columns, self.path, self)
+            if not text:
+                return
+            catalog = json.loads(text)
+            next_page = catalog.get(self.NEXT_PAGE_KEY, 1)
+            stats = catalog.get(self.STATS_KEY, {})
+            indexes = catalog.get(self.INDEXES_KEY, {})
+            layouts = catalog.get(self.LAYOUTS_KEY, {})
+            dicts = catalog.get(self.DICTS_KEY, {})
+
+            tables, entries, loaded = {}, {}, []
+            old_free = self._free_pages
+            self.next_page = next_page  # bounds the page scan of new Tables
+            self._free_pages = []       # filled by the Tables built below
+            for name, col_specs in catalog.get("tables", {}).items():
+                entry = [col_specs, stats.get(name), indexes.get(name),
+                         layouts.get(name), dicts.get(name)]
+                entries[name] = entry
+                if keep and name in self.tables and self._catalog_entries.get(name) == entry:
+                    tables[name] = self.tables[name]
+                    continue
+                columns = []
+                for spec in col_specs:
+                    col_name, dtype_str, pk, uniq = spec[:4]
+                    dtype = DataType(dtype_str)
+                    columns.append(Column(col_name, dtype, primary_key=pk, unique=uniq,
+                                          dictionary=len(spec) > 4 and spec[4]))
+                table_stats = TableStats.from_dict(stats[name]) if name in stats else None
+                cls = TABLE_LAYOUTS[layouts.get(name, Table.LAYOUT)]
+                tables[name] = cls(name, columns, self.path, self, table_stats,
+                                   indexes.get(name), dicts.get(name))
+                loaded.append(tables[name])
+            # Free pages of the kept tables are still free; those the reloaded
+            # ones found were just added again
+            live = set().union(*(t._pages for t in loaded))
+            free = set(self._free_pages)
+            free.update(p for p in old_free if p < next_page and p not in live)
+            self._free_pages = sorted(free)  # a sorted list is a heap
+            self.views.load(catalog.get(self.VIEWS_KEY, {}))
+            self.tables = tables
+            self._catalog_entries = entries
         except:
             pass
 
-    def create_table(self, name: str, columns: List[Column]) -> Table:
+    def create_table(self, name: str, columns: List[Column], layout: str = Table.LAYOUT) -> Table:
+        """layout: "row" (one JSON row per page) or "columnar" (PAX pages)."""
+        if self.readonly or self.replica:
+            raise PermissionError("Database is open read-only")
         if name in self.tables:
             raise ValueError(f"Table {name} already exists")
+        if layout not in TABLE_LAYOUTS:
+            raise ValueError(f"Unknown table layout: {layout}")
         pk_count = sum(1 for col in columns if col.primary_key)
         if pk_count > 1:
             raise ValueError("Only one primary key allowed")
-        tbl = Table(name, columns, self.path, self)
+        tbl = TABLE_LAYOUTS[layout](name, columns, self.path, self)
         self.tables[name] = tbl
-        self._save_catalog()
+        try:
+            self._save_catalog()
+        except Exception:
+            del self.tables[name]
+            raise
         return tbl
 
+    def create_materialized_view(self, name: str, query: str) -> Table:
+        """Create a view table kept up to date by every write to its sources.
+
+        query is "SELECT g.., COUNT(*), SUM(col) [AS alias] FROM t [WHERE ...]
+        GROUP BY g.." or "JOIN left right ON left_key right_key"; see
+        matview.py. The view table, its indexes and its rows from the
+        current source rows commit in one transaction, so a view is
+        either registered and filled or not there at all. It can then be
+        read like any table.
+        """
+        if self.readonly or self.replica:
+            raise PermissionError("Database is open read-only")
+        if name in self.tables:
+            raise ValueError(f"Table {name} already exists")
+        view = statements.parse_view(name, query)
+        for source in view.sources:
+            if source in self.views:
+                raise ValueError(f"'{source}' is a materialized view; views of views are not supported")
+        columns = [Column(col, DataType(dtype), primary_key=pk) for col, dtype, pk in view.columns(self)]
+        view.bind(self)
+
+        table = Table(name, columns, self.path, self)
+        for col in view.indexes(self):
+            table._secondary[col] = SortedIndex()  # empty so far, like the table
+        self.tables[name] = table
+        self.views.defs[name] = view
+
+        alloc = self._write_mark()
+        txn = begin_write()
+        try:
+            stats: Dict[str, TableStats] = {}
+            views_done = self.views.stage(txn, view.initial_changes(self), stats, only=[view])
+            self._write_catalog(txn, stats)
+        except Exception:
+            self._abort(txn, alloc)
+            del self.views.defs[name]
+            del self.tables[name]
+            raise
+        commit(txn)
+        views_done()
+        table.lsn = commit_lsn()
+        checkpoint()
+        return table
+
+    def refresh(self):
+        """Read-only attachments and replicas: reload the catalog, and the
+        tables written since, if a commit has landed since they were loaded.
+        A no-op for the writer. _loaded_lsn moves only once the new tables
+        are in place, so a concurrent refresh waits for them."""
+        if not (self.readonly or self.replica):
+            return
+        if commit_lsn() == self._loaded_lsn:
+            return
+        with self._refresh_lock:
+            lsn = commit_lsn()
+            if lsn == self._loaded_lsn:
+                return
+            self._load_catalog(keep=True)
+            self._loaded_lsn = lsn
+
     def get_table(self, name: str) -> Table:
+        self.refresh()
         if name not in self.tables:
             raise KeyError(f"Table '{name}' does not exist")
         return self.tables[name]
\ No newline at end of file
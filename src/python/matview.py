@@ -0,0 +1,322 @@
+import json
+from typing import Any, Callable, Dict, List, Optional, Tuple
+
+from planner import Predicate
+
+# ----------------------------
+# Incrementally maintained materialized views
+#
+# A view is stored as an ordinary row-layout table named after it, so it
+# is read, indexed, planned and cached like any other. Its definition is
+# kept in the catalog (Database.VIEWS_KEY). Every write path of a source
+# table hands its row changes, (old row, new row) pairs, to Views.stage
+# inside its own write transaction before the catalog page is staged; the
+# views turn them into writes of their own rows in that same transaction.
+# A view therefore commits atomically with the change that caused it, and
+# any snapshot sees the view and its sources at the same commit.
+#
+# Two kinds of view:
+#   aggregate  SELECT g.., COUNT(*|col), SUM(col) FROM t [WHERE ...] GROUP BY g..
+#              One row per group: the group columns, one column per
+#              aggregate and _rows, the number of source rows in the group.
+#              Changes add to or subtract from the group's running values;
+#              the row goes away with its last source row. MIN/MAX/AVG are
+#              not offered: MIN/MAX cannot be undone on delete without a
+#              rescan, and AVG is SUM / _rows.
+#   join       JOIN left right ON left_key right_key (an inner equi-join)
+#              One row per matching pair, with columns <table>_<column>
+#              from both sides. A changed row drops the view rows built
+#              from its old version and joins its new version against the
+#              other side through that side's index on the join key.
+# ----------------------------
+
+AGG_FUNCS = ("count", "sum")
+
+
+def _key_text(values) -> str:
+    return json.dumps(list(values))
+
+
+class _ViewWrites:
+    """A view table's rows as changed by the current transaction.
+
+    Rows are looked up once from the committed table and then edited in
+    memory, so several changes to one view row in a transaction (a batch
+    insert) make one page write. flush() stages the net result.
+    """
+
+    def __init__(self, table):
+        self.table = table
+        self.pk = table._pk_col
+        self.orig: Dict[Any, Optional[Dict[str, Any]]] = {}
+        self.rows: Dict[Any, Optional[Dict[str, Any]]] = {}
+
+    def get(self, key) -> Optional[Dict[str, Any]]:
+        if key not in self.rows:
+            page_id = self.table._find_page_by_key(self.pk, key)
+            row = None if page_id is None else self.table._read_row(page_id, self.pk, key)
+            self.orig[key] = row
+            self.rows[key] = None if row is None else dict(row)
+        return self.rows[key]
+
+    def put(self, key, row: Optional[Dict[str, Any]]):
+        self.get(key)
+        self.rows[key] = row
+
+    def find(self, col: str, value) -> List[Dict[str, Any]]:
+        """Rows with col = value as of this transaction (col must be indexed)."""
+        found = {}
+        for _, row in self.table.read_rows(self.table.index_lookup(col, value)):
+            if row.get(col) == value:
+                found[row[self.pk]] = row
+        for key, row in self.rows.items():
+            if row is not None and row.get(col) == value:
+                found[key] = row
+            else:
+                found.pop(key, None)
+        return list(found.values())
+
+    def flush(self, txn, stats) -> List[Callable[[], None]]:
+        """Stage the net row writes; returns what to apply once committed."""
+        t = self.table
+        new_stats = stats[t.name] = t.stats.copy()
+        done = []
+        for key, row in self.rows.items():
+            old = self.orig[key]
+            if old == row:
+                continue
+            if old is None:
+                page_id, new_page = t._store_insert(txn, row)
+                new_stats.on_insert(row, new_page)
+                done.append(lambda p=page_id, r=row: t._apply_insert(p, r))
+            elif row is None:
+                page_id = t._find_page_by_key(self.pk, key)
+                freed = t._store_delete(txn, page_id, self.pk, key)
+                new_stats.on_delete(freed)
+                done.append(lambda p=page_id, o=old, f=freed: t._apply_delete(p, o, f))
+            else:
+                page_id = t._find_page_by_key(self.pk, key)
+                t._store_update(txn, page_id, self.pk, key, row)
+                new_stats.on_update(row, 0)
+                done.append(lambda p=page_id, o=old, r=row: t._apply_update(p, p, o, r, False))
+        return done
+
+
+class AggregateView:
+    KIND = "aggregate"
+
+    def __init__(self, name: str, source: str, group_by: List[str],
+                 aggs: List[Tuple[str, Optional[str], str]], where: Optional[List[Predicate]] = None):
+        self.name = name
+        self.source = source
+        self.group_by = list(group_by)
+        self.aggs = [(func.lower(), col, alias) for func, col, alias in aggs]
+        self.where = where or []
+        self.sources = [source]
+
+    def spec(self) -> Dict[str, Any]:
+        return {"kind": self.KIND, "source": self.source, "group_by": self.group_by,
+                "aggs": [list(a) for a in self.aggs],
+                "where": [[p.col, p.op, p.value] for p in self.where]}
+
+    @classmethod
+    def from_spec(cls, name: str, spec: Dict[str, Any]) -> 'AggregateView':
+        return cls(name, spec["source"], spec["group_by"], [tuple(a) for a in spec["aggs"]],
+                   [Predicate(*p) for p in spec.get("where", [])])
+
+    def columns(self, db) -> List[Tuple[str, str, bool]]:
+        """(name, type, primary key) of the view table's columns."""
+        src = db.get_table(self.source)
+        for col in self.group_by:
+            if col not in src.columns:
+                raise ValueError(f"Unknown column in GROUP BY: {self.source}.{col}")
+        for p in self.where:
+            if p.col not in src.columns:
+                raise ValueError(f"Unknown column in WHERE: {self.source}.{p.col}")
+        cols = []
+        single = len(self.group_by) == 1
+        if not single:
+            cols.append(("_key", "TEXT", True))
+        cols += [(g, src.columns[g].dtype.value, single) for g in self.group_by]
+        for func, col, alias in self.aggs:
+            if func not in AGG_FUNCS:
+                raise ValueError(f"{func.upper()} cannot be maintained incrementally; "
+                                 f"use COUNT or SUM (AVG is SUM / _rows)")
+            if col is not None and col not in src.columns:
+                raise ValueError(f"Unknown column: {self.source}.{col}")
+            if func == "sum" and (col is None or src.columns[col].dtype.value != "INT"):
+                raise ValueError("SUM needs an INT column")
+            if alias in self.group_by or alias in ("_key", "_rows"):
+                raise ValueError(f"Duplicate column name: {alias}")
+            cols.append((alias, "INT", False))
+        cols.append(("_rows", "INT", False))
+        return cols
+
+    def indexes(self, db) -> List[str]:
+        return self.group_by if len(self.group_by) > 1 else []
+
+    def bind(self, db):
+        pass
+
+    def initial_changes(self, db):
+        src = db.get_table(self.source)
+        return [(src, None, row) for _, row in src.read_rows(src.page_ids())]
+
+    def _key(self, row: Dict[str, Any]):
+        values = [row.get(g) for g in self.group_by]
+        return values[0] if len(values) == 1 else _key_text(values)
+
+    def stage(self, writes: _ViewWrites, table, old, new):
+        for row, sign in ((old, -1), (new, 1)):
+            if row is None or not all(p.matches(row) for p in self.where):
+                continue
+            key = self._key(row)
+            cur = writes.get(key)
+            if cur is None:
+                cur = {g: row.get(g) for g in self.group_by}
+                if len(self.group_by) != 1:
+                    cur["_key"] = key
+                cur.update({alias: 0 for _, _, alias in self.aggs})
+                cur["_rows"] = 0
+            else:
+                cur = dict(cur)
+            for func, col, alias in self.aggs:
+                v = 1 if col is None else row.get(col)
+                if v is None:
+                    continue
+                cur[alias] += sign * (1 if func == "count" else v)
+            cur["_rows"] += sign
+            writes.put(key, cur if cur["_rows"] > 0 else None)
+
+
+class JoinView:
+    KIND = "join"
+
+    def __init__(self, name: str, left: str, right: str, left_key: str, right_key: str):
+        if left == right:
+            raise ValueError("A join view needs two different tables")
+        self.name = name
+        self.left, self.right = left, right
+        self.left_key, self.right_key = left_key, right_key
+        self.sources = [left, right]
+
+    def spec(self) -> Dict[str, Any]:
+        return {"kind": self.KIND, "join": [self.left, self.right, self.left_key, self.right_key]}
+
+    @classmethod
+    def from_spec(cls, name: str, spec: Dict[str, Any]) -> 'JoinView':
+        return cls(name, *spec["join"])
+
+    def _sides(self, db):
+        return [(db.get_table(self.left), self.left_key), (db.get_table(self.right), self.right_key)]
+
+    def columns(self, db) -> List[Tuple[str, str, bool]]:
+        cols = [("_key", "TEXT", True)]
+        for table, key in self._sides(db):
+            if key not in table.columns:
+                raise ValueError(f"Unknown join column: {table.name}.{key}")
+            if not table._pk_col:
+                raise ValueError(f"A join view needs a primary key on {table.name}")
+            cols += [(f"{table.name}_{c.name}", c.dtype.value, False) for c in table.columns.values()]
+        return cols
+
+    def indexes(self, db) -> List[str]:
+        """View columns to index: each side's primary key, to find the view
+        rows built from a changed source row."""
+        return [f"{t.name}_{t._pk_col}" for t, _ in self._sides(db)]
+
+    def bind(self, db):
+        """Index the join keys of both sides, to find a changed row's partners."""
+        for table, key in self._sides(db):
+            if table.index_kind(key) is None:
+                table.create_index(key)
+
+    def initial_changes(self, db):
+        left = db.get_table(self.left)
+        return [(left, None, row) for _, row in left.read_rows(left.page_ids())]
+
+    def _merge(self, lrow, rrow) -> Dict[str, Any]:
+        out = {f"{self.left}_{c}": v for c, v in lrow.items()}
+        out.update({f"{self.right}_{c}": v for c, v in rrow.items()})
+        return out
+
+    def stage(self, writes: _ViewWrites, table, old, new):
+        (ltab, lkey), (rtab, rkey) = self._sides(table.db)
+        is_left = table.name == self.left
+        pk = table._pk_col
+        mine = self.pending.setdefault(table.name, {})
+        if old is not None:
+            for row in writes.find(f"{table.name}_{pk}", old[pk]):
+                writes.put(row["_key"], None)
+            mine[old[pk]] = None
+        if new is None:
+            return
+        other, okey = (rtab, rkey) if is_left else (ltab, lkey)
+        value = new[lkey if is_left else rkey]
+        pending = self.pending.setdefault(other.name, {})
+        partners = {r[other._pk_col]: r for _, r in other.read_rows(other.index_lookup(okey, value))
+                    if r.get(okey) == value}
+        for opk, r in pending.items():
+            if r is not None and r.get(okey) == value:
+                partners[opk] = r
+            else:
+                partners.pop(opk, None)
+        for opk, prow in partners.items():
+            lrow, rrow = (new, prow) if is_left else (prow, new)
+            key = _key_text([lrow[ltab._pk_col], rrow[rtab._pk_col]])
+            row = self._merge(lrow, rrow)
+            row["_key"] = key
+            writes.put(key, row)
+        mine[new[pk]] = new
+
+
+VIEW_KINDS = {cls.KIND: cls for cls in (AggregateView, JoinView)}
+
+
+def _noop():
+    pass
+
+
+class Views:
+    """The database's materialized views, keyed by name."""
+
+    def __init__(self, db):
+        self.db = db
+        self.defs: Dict[str, Any] = {}
+
+    def __contains__(self, name: str) -> bool:
+        return name in self.defs
+
+    def specs(self) -> Dict[str, Dict[str, Any]]:
+        return {name: v.spec() for name, v in self.defs.items()}
+
+    def load(self, specs: Dict[str, Dict[str, Any]]):
+        self.defs = {name: VIEW_KINDS[spec["kind"]].from_spec(name, spec)
+                     for name, spec in specs.items()}
+
+    def stage(self, txn, changes, stats: Dict[str, Any], only=None) -> Callable[[], None]:
+        """Stage the view writes implied by changes, [(source table, old row
+        or None, new row or None)], into txn, and add the views' new stats
+        to stats. Returns the function to call once txn has committed."""
+        views = only or [v for v in self.defs.values()
+                         if any(t.name in v.sources for t, _, _ in changes)]
+        if not views:
+            return _noop
+        done = []
+        for view in views:
+            writes = _ViewWrites(self.db.tables[view.name])
+            view.pending = {}  # source rows changed so far, by table and key
+            for table, old, new in changes:
+                if table.name in view.sources:
+                    view.stage(writes, table, old, new)
+            done.append((writes.table, writes.flush(txn, stats)))
+
+        def finish():
+            from executor import commit_lsn
+            lsn = commit_lsn()
+            for table, applies in done:
+                table.stats = stats[table.name]
+                for apply in applies:
+                    apply()
+                table.lsn = lsn  # after the indexes, as on every write path
+        return finish
@@ -0,0 +1,615 @@
+import heapq
+import json
+import struct
+from typing import List, Dict, Any, Optional, Tuple, Iterator
+
+# ----------------------------
+# Pull-based (Volcano) operators
+#
+# Every physical operator is an iterable of row dicts. Parents pull rows
+# from children one at a time, so a Limit stops the scans under it after
+# a handful of pages instead of materializing whole tables. Only Sort,
+# Aggregate and the build side of HashJoin hold rows in memory.
+# ----------------------------
+
+PROBE_BATCH = 256  # probe rows handed to the C hash join per call
+
+
+class Operator:
+    est_rows: float = 0.0
+    cost: float = 0.0
+
+    def __iter__(self) -> Iterator[Dict[str, Any]]:
+        raise NotImplementedError
+
+    def execute(self) -> List[Dict[str, Any]]:
+        return list(self)
+
+    def describe(self) -> str:
+        raise NotImplementedError
+
+    def children(self) -> List['Operator']:
+        return []
+
+    def explain(self, depth: int = 0) -> str:
+        line = f"{'  ' * depth}{self.describe()}  (rows={self.est_rows:.0f} cost={self.cost:.2f})"
+        return "\n".join([line] + [c.explain(depth + 1) for c in self.children()])
+
+
+# ----------------------------
+# Scans
+# ----------------------------
+class TableAccess(Operator):
+    """Reads a list of pages lazily and applies the residual predicates."""
+
+    def __init__(self, table, predicates):
+        self.table = table
+        self.predicates = predicates
+        self.columns: Optional[List[str]] = None  # set under a Project: the columns it keeps
+
+    def page_list(self) -> List[int]:
+        raise NotImplementedError
+
+    def _rows(self, page_ids, txn=None, *extra: str):
+        """read_rows fetching out-of-line values only for the columns used."""
+        columns = None
+        if self.columns is not None:
+            columns = set(self.columns) | {p.col for p in self.predicates} | set(extra)
+        return self.table.read_rows(page_ids, txn, columns)
+
+    def __iter__(self):
+        for _, row in self._rows(self.page_list()):
+            if all(p.matches(row) for p in self.predicates):
+                yield row
+
+    def _filter_desc(self) -> str:
+        return f" filter [{', '.join(map(repr, self.predicates))}]" if self.predicates else ""
+
+
+class SeqScan(TableAccess):
+    def page_list(self):
+        return self.table.page_ids()
+
+    def describe(self):
+        return f"SeqScan {self.table.name}{self._filter_desc()}"
+
+
+class ZoneMapScan(TableAccess):
+    def __init__(self, table, predicates, pages: List[int]):
+        super().__init__(table, predicates)
+        self.pages = pages
+
+    def page_list(self):
+        return self.pages
+
+    def describe(self):
+        return f"ZoneMapScan {self.table.name} pages={len(self.pages)}{self._filter_desc()}"
+
+
+class IndexLookup(TableAccess):
+    def __init__(self, table, predicates, key, kind: str):
+        super().__init__(table, predicates)
+        self.key = key
+        self.kind = kind
+
+    def page_list(self):
+        return self.table.index_lookup(self.key.col, self.key.value)
+
+    def __iter__(self):
+        # Index entries address pages, and a columnar page holds many rows
+        for _, row in self._rows(self.page_list(), None, self.key.col):
+            if self.key.matches(row) and all(p.matches(row) for p in self.predicates):
+                yield row
+
+    def describe(self):
+        return f"IndexLookup[{self.kind}] {self.table.name} {self.key!r}{self._filter_desc()}"
+
+
+class IndexRangeScan(TableAccess):
+    """Walks an ordered index between the bounds set by its key predicates.
+
+    Rows come out in key order (descending if asked), so ORDER BY on the
+    key needs no sort and a Limit above stops the walk early.
+    """
+
+    def __init__(self, table, predicates, col: str, kind: str, keys, descending: bool = False):
+        super().__init__(table, predicates)
+        self.col = col
+        self.kind = kind
+        self.keys = keys              # predicates on col that bound the walk
+        self.descending = descending
+
+    def bounds(self) -> Tuple[Any, bool, Any, bool]:
+        """Tightest (lo, lo_inclusive, hi, hi_inclusive); None = unbounded."""
+        lo, lo_incl, hi, hi_incl = None, True, None, True
+        for p in self.keys:
+            if p.op in ("=", ">", ">=") and (lo is None or p.value > lo or (p.value == lo and p.op == ">")):
+                lo, lo_incl = p.value, p.op != ">"
+            if p.op in ("=", "<", "<=") and (hi is None or p.value < hi or (p.value == hi and p.op == "<")):
+                hi, hi_incl = p.value, p.op != "<"
+        return lo, lo_incl, hi, hi_incl
+
+    def page_list(self):
+        return [page for _, pages in self.table.index_range(self.col, *self.bounds()) for page in pages]
+
+    def __iter__(self):
+        import executor
+
+        txn = executor.begin_read()
+        # Neighbouring keys often share a (columnar) page: decode it once
+        cached_page, cached_rows = None, []
+        for key, pages in self.table.index_range(self.col, *self.bounds(), self.descending):
+            for page_id in pages:
+                if page_id != cached_page:
+                    cached_page = page_id
+                    cached_rows = [row for _, row in self._rows([page_id], txn, self.col)]
+                for row in cached_rows:
+                    if row.get(self.col) == key and all(p.matches(row) for p in self.predicates):
+                        yield row
+
+    def describe(self):
+        rng = " AND ".join(map(repr, self.keys)) or f"{self.col} all"
+        order = " DESC" if self.descending else ""
+        return f"IndexRangeScan[{self.kind}] {self.table.name} {rng}{order}{self._filter_desc()}"
+
+
+# ----------------------------
+# Vectorized operators (C batch engine, vexec.c)
+# ----------------------------
+def vectorizable(table, predicates) -> bool:
+    """True if every predicate compares a column with a value of its own type
+    and no value is out of line (vexec.c reads values inline only)."""
+    import executor
+
+    if table.toasted:
+        return False
+    for p in predicates:
+        col = table.columns.get(p.col)
+        if col is None:
+            return False
+        want = int if col.dtype == executor.DataType.INT else str
+        if type(p.value) is not want:
+            return False
+    return True
+
+
+def _plan_column(plan, table, name: str) -> int:
+    """Add a table column to a VectorPlan, with its dictionary if it has one."""
+    return plan.column(name, table.columns[name].dtype, table.dictionary(name))
+
+
+class VectorScan(Operator):
+    """Scan + filter + project in C; rows are rebuilt from column batches."""
+
+    def __init__(self, table, predicates, pages: Optional[List[int]] = None,
+                 columns: Optional[List[str]] = None, workers: int = 1, ordered: bool = True):
+        self.table = table
+        self.predicates = predicates
+        self.pages = pages          # None: all of the table's pages
+        self.columns = columns or list(table.columns)
+        self.workers = workers      # > 1: split pages across C worker threads
+        self.ordered = ordered      # keep page order when running in parallel
+
+    def _plan(self):
+        import executor
+
+        plan = executor.VectorPlan(self.table.name)
+        for name in self.columns:
+            dtype = self.table.columns[name].dtype
+            plan.output(_plan_column(plan, self.table, name), dtype)
+        for p in self.predicates:
+            plan.filter(_plan_column(plan, self.table, p.col), p.op, p.value)
+        plan.pages(self.pages if self.pages is not None else self.table.page_ids())
+        if self.workers > 1:
+            plan.parallel(self.workers, self.ordered)
+        return plan
+
+    def __iter__(self):
+        for cols in self._plan().batches():
+            for values in zip(*cols):
+                yield dict(zip(self.columns, values))
+
+    def describe(self):
+        pages = "" if self.pages is None else f" pages={len(self.pages)}"
+        par = f" workers={self.workers}" if self.workers > 1 else ""
+        cols = f" columns={','.join(self.columns)}" if len(self.columns) < len(self.table.columns) else ""
+        flt = f" filter [{', '.join(map(repr, self.predicates))}]" if self.predicates else ""
+        return f"VectorScan {self.table.name}{pages}{par}{cols}{flt}"
+
+
+class VectorAggregate(Operator):
+    """Filtered, optionally single-column grouped aggregate computed in C.
+
+    avg is split into sum and count on the way in and recombined here.
+    """
+
+    def __init__(self, table, predicates, group_by: Optional[str],
+                 aggs: List[Tuple[str, Optional[str], str]], pages: Optional[List[int]] = None,
+                 workers: int = 1):
+        self.table = table
+        self.predicates = predicates
+        self.group_by = group_by
+        self.aggs = aggs
+        self.pages = pages
+        self.workers = workers      # partial aggregates per worker, merged in C
+
+    def __iter__(self):
+        import executor
+
+        plan = executor.VectorPlan(self.table.name)
+        if self.group_by is not None:
+            dtype = self.table.columns[self.group_by].dtype
+            plan.group_by(_plan_column(plan, self.table, self.group_by), dtype)
+        slots = []  # per requested agg: output positions to combine
+        for func, col, _ in self.aggs:
+            cslot = -1 if col is None else _plan_column(plan, self.table, col)
+            if func == "avg":
+                slots.append((len(plan._out_types), len(plan._out_types) + 1))
+                plan.aggregate("sum", cslot)
+                plan.aggregate("count", cslot)
+            else:
+                slots.append((len(plan._out_types),))
+                plan.aggregate(func, cslot)
+        for p in self.predicates:
+            plan.filter(_plan_column(plan, self.table, p.col), p.op, p.value)
+        plan.pages(self.pages if self.pages is not None else self.table.page_ids())
+        if self.workers > 1:
+            plan.parallel(self.workers, ordered=False)
+
+        for cols in plan.batches():
+            for values in zip(*cols):
+                out = {} if self.group_by is None else {self.group_by: values[0]}
+                for (func, _, alias), pos in zip(self.aggs, slots):
+                    if func == "avg":
+                        total, n = values[pos[0]], values[pos[1]]
+                        out[alias] = total / n if n else None
+                    else:
+                        out[alias] = values[pos[0]]
+                yield out
+
+    def describe(self):
+        aggs = ", ".join(f"{f}({c or '*'})" for f, c, _ in self.aggs)
+        grp = f" group by {self.group_by}" if self.group_by else ""
+        par = f" workers={self.workers}" if self.workers > 1 else ""
+        flt = f" filter [{', '.join(map(repr, self.predicates))}]" if self.predicates else ""
+        return f"VectorAggregate {self.table.name} {aggs}{grp}{par}{flt}"
+
+
+# ----------------------------
+# Row-at-a-time operators
+# ----------------------------
+class Filter(Operator):
+    def __init__(self, child: Operator, predicates):
+        self.child = child
+        self.predicates = predicates
+
+    def children(self):
+        return [self.child]
+
+    def __iter__(self):
+        for row in self.child:
+            if all(p.matches(row) for p in self.predicates):
+                yield row
+
+    def describe(self):
+        return f"Filter [{', '.join(map(repr, self.predicates))}]"
+
+
+class Project(Operator):
+    def __init__(self, child: Operator, columns: List[str]):
+        self.child = child
+        self.columns = columns
+
+    def children(self):
+        return [self.child]
+
+    def __iter__(self):
+        for row in self.child:
+            yield {c: row.get(c) for c in self.columns}
+
+    def describe(self):
+        return f"Project {', '.join(self.columns)}"
+
+
+class Limit(Operator):
+    def __init__(self, child: Operator, limit: int, offset: int = 0):
+        self.child = child
+        self.limit = limit
+        self.offset = offset
+
+    def children(self):
+        return [self.child]
+
+    def __iter__(self):
+        if self.limit <= 0:
+            return
+        seen = 0
+        for row in self.child:
+            seen += 1
+            if seen <= self.offset:
+                continue
+            yield row
+            if seen - self.offset >= self.limit:
+                return
+
+    def describe(self):
+        return f"Limit {self.limit}" + (f" offset {self.offset}" if self.offset else "")
+
+
+def _sort_key(row: Dict[str, Any], col: str):
+    # NULLs sort first; mixed types fall back to their string form
+    v = row.get(col)
+    return (v is not None, v if isinstance(v, (int, float)) else str(v) if v is not None else "")
+
+
+class Sort(Operator):
+    """Materializing sort on [(col, descending), ...]."""
+
+    def __init__(self, child: Operator, keys: List[Tuple[str, bool]]):
+        self.child = child
+        self.keys = keys
+
+    def children(self):
+        return [self.child]
+
+    def __iter__(self):
+        rows = list(self.child)
+        # Stable sorts applied from the least significant key
+        for col, desc in reversed(self.keys):
+            rows.sort(key=lambda r, c=col: _sort_key(r, c), reverse=desc)
+        return iter(rows)
+
+    def describe(self):
+        return "Sort " + ", ".join(f"{c}{' DESC' if d else ''}" for c, d in self.keys)
+
+
+def normalized_key(row: Dict[str, Any], keys: List[Tuple[str, bool]]) -> bytes:
+    """Byte string whose memcmp order is the Sort order of row on keys.
+
+    Per key: 0x00 for NULL (first) or 0x01 then the value. INTs are
+    big-endian with the sign bit flipped, floats use the IEEE order trick,
+    text is UTF-8 with 0x00 escaped as 0x00 0xFF and ended by 0x00 0x01.
+    DESC keys are bit-inverted.
+    """
+    out = bytearray()
+    for col, desc in keys:
+        v = row.get(col)
+        if v is None:
+            part = b"\x00"
+        elif isinstance(v, bool) or isinstance(v, int):
+            part = b"\x01" + struct.pack(">Q", (int(v) + (1 << 63)) & 0xFFFFFFFFFFFFFFFF)
+        elif isinstance(v, float):
+            (bits,) = struct.unpack(">Q", struct.pack(">d", v))
+            bits = bits ^ 0xFFFFFFFFFFFFFFFF if bits >> 63 else bits | (1 << 63)
+            part = b"\x01" + struct.pack(">Q", bits)
+        else:
+            part = b"\x01" + str(v).encode('utf-8').replace(b"\x00", b"\x00\xff") + b"\x00\x01"
+        out += bytes(b ^ 0xFF for b in part) if desc else part
+    return bytes(out)
+
+
+class ExternalSort(Operator):
+    """Sort in the C external merge sort (extsort.c) under a memory budget.
+
+    Rows travel as JSON behind their normalized key; runs that do not fit
+    in mem_budget are spilled to temp files and merged back.
+    """
+
+    def __init__(self, child: Operator, keys: List[Tuple[str, bool]], mem_budget: int,
+                 tmpdir: Optional[str] = None):
+        self.child = child
+        self.keys = keys
+        self.mem_budget = mem_budget
+        self.tmpdir = tmpdir
+
+    def children(self):
+        return [self.child]
+
+    def __iter__(self):
+        import executor
+
+        sorter = executor.ExternalSorter(self.mem_budget, self.tmpdir)
+        try:
+            for row in self.child:
+                sorter.add(normalized_key(row, self.keys), json.dumps(row).encode('utf-8'))
+        except BaseException:
+            sorter.close()
+            raise
+        for payload in sorter.sorted():
+            yield json.loads(payload)
+
+    def describe(self):
+        keys = ", ".join(f"{c}{' DESC' if d else ''}" for c, d in self.keys)
+        return f"ExternalSort {keys} mem={self.mem_budget >> 10}KB"
+
+
+class _OrderKey:
+    """Comparable sort key for [(col, descending), ...] with mixed directions."""
+
+    __slots__ = ("vals", "desc")
+
+    def __init__(self, row: Dict[str, Any], keys: List[Tuple[str, bool]]):
+        self.vals = [_sort_key(row, c) for c, _ in keys]
+        self.desc = [d for _, d in keys]
+
+    def __lt__(self, other):
+        for a, b, d in zip(self.vals, other.vals, self.desc):
+            if a != b:
+                return a > b if d else a < b
+        return False
+
+    def __eq__(self, other):
+        # heapq falls back to input order only for keys that compare equal
+        return self.vals == other.vals
+
+
+class TopN(Operator):
+    """Sort followed by a limit of n: keeps only the best n rows in a heap."""
+
+    def __init__(self, child: Operator, keys: List[Tuple[str, bool]], n: int):
+        self.child = child
+        self.keys = keys
+        self.n = n
+
+    def children(self):
+        return [self.child]
+
+    def __iter__(self):
+        # nsmallest is stable, so ties keep input order just like Sort
+        return iter(heapq.nsmallest(self.n, self.child, key=lambda r: _OrderKey(r, self.keys)))
+
+    def describe(self):
+        return f"TopN {self.n} " + ", ".join(f"{c}{' DESC' if d else ''}" for c, d in self.keys)
+
+
+AGG_FUNCS = ("count", "sum", "min", "max", "avg")
+
+
+class Aggregate(Operator):
+    """Hash aggregate; aggs is [(func, col or None, alias), ...]."""
+
+    def __init__(self, child: Operator, group_by: Optional[List[str]], aggs: List[Tuple[str, Optional[str], str]]):
+        for func, _, _ in aggs:
+            if func not in AGG_FUNCS:
+                raise ValueError(f"Unsupported aggregate: {func}")
+        self.child = child
+        self.group_by = group_by or []
+        self.aggs = aggs
+
+    def children(self):
+        return [self.child]
+
+    def __iter__(self):
+        groups: Dict[tuple, list] = {}
+        for row in self.child:
+            key = tuple(row.get(c) for c in self.group_by)
+            state = groups.get(key)
+            if state is None:
+                state = groups[key] = [[0, None] for _ in self.aggs]
+            for (func, col, _), st in zip(self.aggs, state):
+                v = 1 if col is None else row.get(col)
+                if v is None:
+                    continue
+                if func in ("count", "sum", "avg"):
+                    st[0] += 1
+                    st[1] = v if st[1] is None else st[1] + v
+                elif func == "min":
+                    st[1] = v if st[1] is None or v < st[1] else st[1]
+                else:
+                    st[1] = v if st[1] is None or v > st[1] else st[1]
+
+        if not groups and not self.group_by:
+            groups[()] = [[0, None] for _ in self.aggs]
+        for key, state in groups.items():
+            out = dict(zip(self.group_by, key))
+            for (func, _, alias), (n, acc) in zip(self.aggs, state):
+                if func == "count":
+                    out[alias] = n
+                elif func == "avg":
+                    out[alias] = acc / n if n else None
+                else:
+                    out[alias] = acc
+            yield out
+
+    def describe(self):
+        aggs = ", ".join(f"{f}({c or '*'})" for f, c, _ in self.aggs)
+        return f"Aggregate {aggs}" + (f" group by {', '.join(self.group_by)}" if self.group_by else "")
+
+
+# ----------------------------
+# Joins
+# ----------------------------
+def _stringify_keys(row: Dict[str, Any], keys: Tuple[str, ...]) -> Dict[str, Any]:
+    # Join output keeps the historical shape: join keys come back as strings
+    out = row.copy()
+    for k in keys:
+        if k in out:
+            out[k] = str(out[k])
+    return out
+
+
+class HashJoin(Operator):
+    """C hash join: the build side is materialized and hashed once, the
+    probe side is pulled lazily and probed in PROBE_BATCH chunks against
+    that one table. Right-hand columns win clashes whichever side is built."""
+
+    def __init__(self, left: Operator, right: Operator, left_key: str, right_key: str,
+                 build_left: bool):
+        self.left = left
+        self.right = right
+        self.left_key = left_key
+        self.right_key = right_key
+        self.build_left = build_left
+
+    def children(self):
+        return [self.left, self.right]
+
+    def __iter__(self):
+        import executor  # deferred: executor imports the planner, which imports us
+
+        keys = (self.left_key, self.right_key)
+        if self.build_left:
+            build_op, probe_op, bkey, pkey, overrides = self.left, self.right, self.left_key, self.right_key, False
+        else:
+            build_op, probe_op, bkey, pkey, overrides = self.right, self.left, self.right_key, self.left_key, True
+
+        build = [json.dumps(_stringify_keys(r, keys)).encode('utf-8') for r in build_op]
+        if not build:
+            return
+
+        join = executor.CHashJoin(build, bkey)
+        try:
+            batch = []
+            for row in probe_op:
+                batch.append(json.dumps(_stringify_keys(row, keys)).encode('utf-8'))
+                if len(batch) < PROBE_BATCH:
+                    continue
+                yield from join.probe(batch, pkey, overrides)
+                batch = []
+            if batch:
+                yield from join.probe(batch, pkey, overrides)
+        finally:
+            join.close()
+
+    def describe(self):
+        side = "left" if self.build_left else "right"
+        return f"HashJoin {self.left_key} = {self.right_key} build={side}"
+
+
+class IndexNestedLoopJoin(Operator):
+    """Probe the inner table's index once per outer row."""
+
+    def __init__(self, outer: Operator, inner_table, outer_key: str, inner_key: str,
+                 outer_is_left: bool, inner_predicates):
+        self.outer = outer
+        self.inner_table = inner_table
+        self.outer_key = outer_key
+        self.inner_key = inner_key
+        self.outer_is_left = outer_is_left
+        self.inner_predicates = inner_predicates
+
+    def children(self):
+        return [self.outer]
+
+    def __iter__(self):
+        if self.outer_is_left:
+            keys = (self.outer_key, self.inner_key)
+        else:
+            keys = (self.inner_key, self.outer_key)
+        for outer_row in self.outer:
+            pages = self.inner_table.index_lookup(self.inner_key, outer_row.get(self.outer_key))
+            for _, inner_row in self.inner_table.read_rows(pages):
+                if inner_row.get(self.inner_key) != outer_row.get(self.outer_key):
+                    continue
+                if not all(p.matches(inner_row) for p in self.inner_predicates):
+                    continue
+                if self.outer_is_left:
+                    merged = {**outer_row, **inner_row}
+                else:
+                    merged = {**inner_row, **outer_row}
+                yield _stringify_keys(merged, keys)
+
+    def describe(self):
+        kind = self.inner_table.index_kind(self.inner_key)
+        return (f"IndexNestedLoopJoin {self.outer_key} -> "
+                f"{self.inner_table.name}.{self.inner_key} [{kind}]")
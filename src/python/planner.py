@@ -0,0 +1,426 @@
+from typing import List, Dict, Any, Optional, Tuple, Iterator
+
+from operators import (Operator, TableAccess, SeqScan, ZoneMapScan, IndexLookup, IndexRangeScan,
+                       HashJoin, IndexNestedLoopJoin, Project, Limit, Sort, TopN, ExternalSort,
+                       Aggregate, VectorScan, VectorAggregate, vectorizable)
+
+# ----------------------------
+# Cost-based planner
+#
+# Sits between the command layer (repl.py / api.py) and the Table access
+# primitives: commands build a small logical plan, the planner picks access
+# paths and join strategies with a cost model fed by TableStats and
+# ANALYZE output, and returns a tree of pull-based operators (operators.py).
+# ----------------------------
+
+# Cost units are "one sequential page read".
+SEQ_PAGE_COST = 1.0
+RANDOM_PAGE_COST = 4.0
+CPU_ROW_COST = 0.01     # JSON decode + predicate per row
+HASH_BUILD_COST = 0.02  # per build row: serialized, parsed and hashed once
+HASH_PROBE_COST = 0.01  # per probe row
+VECTOR_ROW_COST = 0.002 # per row decoded and filtered in the C batch engine
+PAX_ROW_COST = 0.0005   # same, reading only the needed arrays of a PAX page
+VECTOR_BATCH = 1024     # rows the C engine decodes per batch (VX_BATCH)
+
+# Parallel vector scans: only worth the task start-up past this many
+# pages per worker, and capped by the size of the shared task pool.
+PARALLEL_MIN_PAGES = 64
+WORKER_STARTUP_COST = 2.0
+
+# Sorts whose input is estimated past Database.sort_mem go external; rows
+# are sized as their JSON, and every spilled byte is written and read once.
+SORT_ROW_BYTES = 128
+
+# Fallback selectivities when a column has not been ANALYZEd
+DEFAULT_EQ_SEL = 0.1
+DEFAULT_RANGE_SEL = 1.0 / 3.0
+
+OPS = ("=", "<", "<=", ">", ">=")
+
+
+class Predicate:
+    def __init__(self, col: str, op: str, value: Any):
+        if op not in OPS:
+            raise ValueError(f"Unsupported operator: {op}")
+        self.col = col
+        self.op = op
+        self.value = value
+
+    def matches(self, row: Dict[str, Any]) -> bool:
+        v = row.get(self.col)
+        if v is None:
+            return False
+        try:
+            if self.op == "=":
+                return v == self.value
+            if self.op == "<":
+                return v < self.value
+            if self.op == "<=":
+                return v <= self.value
+            if self.op == ">":
+                return v > self.value
+            return v >= self.value
+        except TypeError:
+            return False
+
+    def may_match(self, bounds: Optional[List[Any]]) -> bool:
+        """Zone-map test: can any value in [lo, hi] satisfy the predicate?"""
+        if bounds is None:
+            return True
+        lo, hi = bounds
+        try:
+            if self.op == "=":
+                return lo <= self.value <= hi
+            if self.op == "<":
+                return lo < self.value
+            if self.op == "<=":
+                return lo <= self.value
+            if self.op == ">":
+                return hi > self.value
+            return hi >= self.value
+        except TypeError:
+            return True
+
+    def __repr__(self):
+        return f"{self.col} {self.op} {self.value!r}"
+
+
+# ----------------------------
+# Logical plan
+# ----------------------------
+class LogicalScan:
+    def __init__(self, table: str, predicates: Optional[List[Predicate]] = None):
+        self.table = table
+        self.predicates = predicates or []
+
+
+class LogicalJoin:
+    def __init__(self, left: LogicalScan, right: LogicalScan, left_key: str, right_key: str):
+        self.left = left
+        self.right = right
+        self.left_key = left_key
+        self.right_key = right_key
+
+
+class LogicalProject:
+    def __init__(self, child, columns: List[str]):
+        self.child = child
+        self.columns = columns
+
+
+class LogicalAggregate:
+    def __init__(self, child, group_by: Optional[List[str]], aggs: List[Tuple[str, Optional[str], str]]):
+        self.child = child
+        self.group_by = group_by or []
+        self.aggs = aggs
+
+
+class LogicalSort:
+    def __init__(self, child, keys: List[Tuple[str, bool]]):
+        self.child = child
+        self.keys = keys
+
+
+class LogicalLimit:
+    def __init__(self, child, limit: int, offset: int = 0):
+        self.child = child
+        self.limit = limit
+        self.offset = offset
+
+
+# ----------------------------
+# Planner
+# ----------------------------
+class Planner:
+    def __init__(self, db):
+        self.db = db
+
+    # ---- estimation ----
+    def _selectivity(self, table, pred: Predicate) -> float:
+        analysis = table.analysis.get(pred.col)
+        rows = max(1, table.stats.row_count)
+        if pred.op == "=":
+            if table.index_kind(pred.col) in ("pk", "unique"):
+                return 1.0 / rows
+            if analysis is not None:
+                return analysis.eq_selectivity(pred.value)
+            entries = table.index_entries(pred.col)
+            return 1.0 / entries if entries else DEFAULT_EQ_SEL
+        if analysis is not None:
+            if pred.op in ("<", "<="):
+                return analysis.range_selectivity(None, pred.value)
+            return analysis.range_selectivity(pred.value, None)
+        return DEFAULT_RANGE_SEL
+
+    def _estimate_rows(self, table, predicates: List[Predicate]) -> float:
+        sel = 1.0
+        for p in predicates:
+            sel *= self._selectivity(table, p)
+        return max(0.0, table.stats.row_count * sel)
+
+    def _ndv(self, table, col: str) -> float:
+        if table.index_kind(col) in ("pk", "unique"):
+            return max(1, table.stats.row_count)
+        analysis = table.analysis.get(col)
+        if analysis is not None:
+            return analysis.ndv()
+        entries = table.index_entries(col)
+        return entries if entries else max(1.0, table.stats.row_count * DEFAULT_EQ_SEL)
+
+    @staticmethod
+    def _index_comparable(table, pred: Predicate) -> bool:
+        # Ordered index keys are native values; bisecting needs the same type
+        want = int if table.columns[pred.col].dtype.value == "INT" else str
+        return type(pred.value) is want
+
+    def _walk_cost(self, table, rows: float) -> float:
+        """Cost of visiting rows through an index: a random read per page touched."""
+        return max(1.0, min(rows, table.stats.live_pages)) * RANDOM_PAGE_COST + rows * CPU_ROW_COST
+
+    def _workers(self, pages: int) -> int:
+        return max(1, min(self.db.workers, pages // PARALLEL_MIN_PAGES))
+
+    def _vector_scan(self, table, preds, pages: Optional[List[int]], npages: int, rows: float,
+                     parallel: bool = True) -> VectorScan:
+        workers = self._workers(npages) if parallel else 1
+        vs = VectorScan(table, preds, pages, workers=workers)
+        row_cost = PAX_ROW_COST if table.LAYOUT == "columnar" else VECTOR_ROW_COST
+        vs.cost = (npages * SEQ_PAGE_COST + rows * row_cost) / workers
+        if workers > 1:
+            vs.cost += workers * WORKER_STARTUP_COST
+        return vs
+
+    def _first_rows(self, table, preds, paths: List[Operator], rows: float, want: int):
+        """Re-cost paths for a caller that pulls only `want` rows (LIMIT).
+
+        Row-at-a-time paths stop early, so they cost their share of a full
+        run. A vector scan still decodes whole batches, at least the first
+        one, so it runs on one thread (workers would read ahead past the
+        limit) and costs the pages of that batch."""
+        frac = min(1.0, want / rows) if rows > 0 else 1.0
+        per_page = table.stats.row_count / max(1, table.stats.live_pages)
+        for i, path in enumerate(paths):
+            if isinstance(path, VectorScan):
+                npages = len(path.pages) if path.pages is not None else table.stats.live_pages
+                first = min(npages, max(VECTOR_BATCH / max(1.0, per_page), npages * frac))
+                paths[i] = self._vector_scan(table, preds, path.pages, first, first * per_page,
+                                             parallel=False)
+            else:
+                path.cost = max(SEQ_PAGE_COST, path.cost * frac)
+
+    # ---- access paths ----
+    def access_paths(self, scan: LogicalScan, want: Optional[int] = None) -> List[Operator]:
+        """Candidate operators for scan; want: rows the caller will pull
+        (LIMIT + OFFSET), None for all."""
+        table = self.db.get_table(scan.table)
+        preds = scan.predicates
+        rows = self._estimate_rows(table, preds)
+        live = table.stats.live_pages
+        paths = []
+
+        vector = vectorizable(table, preds)
+
+        seq = SeqScan(table, preds)
+        seq.cost = live * SEQ_PAGE_COST + table.stats.row_count * CPU_ROW_COST
+        paths.append(seq)
+        if vector:
+            paths.append(self._vector_scan(table, preds, None, live, table.stats.row_count))
+
+        if preds:
+            pages = table.zone_pages(lambda zone: all(p.may_match(zone.get(p.col)) for p in preds))
+            if len(pages) < live:
+                zone_rows = len(pages) * table.stats.row_count / max(1, live)
+                zm = ZoneMapScan(table, preds, pages)
+                zm.cost = len(pages) * SEQ_PAGE_COST + zone_rows * CPU_ROW_COST
+                paths.append(zm)
+                if vector:
+                    paths.append(self._vector_scan(table, preds, pages, len(pages), zone_rows))
+
+        for p in preds:
+            kind = table.index_kind(p.col)
+            if p.op != "=" or kind is None:
+                continue
+            residual = [q for q in preds if q is not p]
+            matched = self._estimate_rows(table, [p])
+            idx = IndexLookup(table, residual, p, kind)
+            idx.cost = max(1.0, matched) * RANDOM_PAGE_COST + matched * CPU_ROW_COST
+            paths.append(idx)
+
+        for col in {p.col for p in preds if p.op != "="}:
+            kind = table.index_kind(col)
+            keys = [p for p in preds if p.col == col and self._index_comparable(table, p)]
+            if kind is None or not keys:
+                continue
+            residual = [q for q in preds if all(q is not k for k in keys)]
+            rng = IndexRangeScan(table, residual, col, kind, keys)
+            rng.cost = self._walk_cost(table, self._estimate_rows(table, keys))
+            paths.append(rng)
+
+        if want is not None:
+            self._first_rows(table, preds, paths, rows, want)
+        for path in paths:
+            path.est_rows = rows
+        return paths
+
+    def plan_scan(self, scan: LogicalScan, want: Optional[int] = None) -> Operator:
+        return min(self.access_paths(scan, want), key=lambda p: p.cost)
+
+    # ---- ordering ----
+    def _ordered_scan(self, scan: LogicalScan, keys: List[Tuple[str, bool]],
+                      want: Optional[int]) -> Optional[Operator]:
+        """Walk the index on a single sort key instead of sorting.
+
+        want: rows the caller will pull (LIMIT + OFFSET), None for all.
+        """
+        if len(keys) != 1:
+            return None
+        col, desc = keys[0]
+        table = self.db.get_table(scan.table)
+        kind = table.index_kind(col)
+        if kind is None:
+            return None
+        bound = [p for p in scan.predicates if p.col == col and self._index_comparable(table, p)]
+        residual = [p for p in scan.predicates if all(p is not b for b in bound)]
+        op = IndexRangeScan(table, residual, col, kind, bound, desc)
+        walked = self._estimate_rows(table, bound)
+        op.est_rows = self._estimate_rows(table, scan.predicates)
+        if want is not None and op.est_rows > 0:
+            # The walk stops once `want` rows have passed the residual filter
+            walked = min(walked, walked * want / op.est_rows)
+        op.cost = self._walk_cost(table, walked)
+        return op
+
+    def _plan_sort(self, sort: LogicalSort, want: Optional[int] = None) -> Operator:
+        child = self.plan(sort.child)
+        spill = child.est_rows * SORT_ROW_BYTES
+        if want is not None:
+            op = TopN(child, sort.keys, want)
+            op.est_rows = min(child.est_rows, want)
+            op.cost = child.cost + child.est_rows * CPU_ROW_COST
+        elif spill > self.db.sort_mem:
+            op = ExternalSort(child, sort.keys, self.db.sort_mem, self.db.tmpdir)
+            op.est_rows = child.est_rows
+            op.cost = child.cost + child.est_rows * CPU_ROW_COST + 2 * spill / 4096 * SEQ_PAGE_COST
+        else:
+            op = Sort(child, sort.keys)
+            op.est_rows = child.est_rows
+            op.cost = child.cost + child.est_rows * CPU_ROW_COST
+        if isinstance(sort.child, LogicalScan):
+            ordered = self._ordered_scan(sort.child, sort.keys, want)
+            if ordered is not None and ordered.cost < op.cost:
+                return ordered
+        return op
+
+    # ---- joins ----
+    def plan_join(self, join: LogicalJoin) -> Operator:
+        left = self.plan_scan(join.left)
+        right = self.plan_scan(join.right)
+        lt = self.db.get_table(join.left.table)
+        rt = self.db.get_table(join.right.table)
+
+        out_rows = left.est_rows * right.est_rows / max(
+            1.0, self._ndv(lt, join.left_key), self._ndv(rt, join.right_key))
+        candidates = []
+
+        build_left = left.est_rows <= right.est_rows
+        hj = HashJoin(left, right, join.left_key, join.right_key, build_left)
+        build_rows, probe_rows = sorted((left.est_rows, right.est_rows))
+        hj.cost = left.cost + right.cost + build_rows * HASH_BUILD_COST + probe_rows * HASH_PROBE_COST
+        candidates.append(hj)
+
+        # Index nested loop in either direction when the inner key is indexed
+        for outer, outer_key, inner_t, inner_scan, inner_key, outer_is_left in (
+                (left, join.left_key, rt, join.right, join.right_key, True),
+                (right, join.right_key, lt, join.left, join.left_key, False)):
+            if inner_t.index_kind(inner_key) is None:
+                continue
+            # Index keys are native values; only pair columns of the same type
+            if lt.columns[join.left_key].dtype != rt.columns[join.right_key].dtype:
+                continue
+            per_probe = inner_t.stats.row_count / max(1.0, self._ndv(inner_t, inner_key))
+            inlj = IndexNestedLoopJoin(outer, inner_t, outer_key, inner_key, outer_is_left,
+                                       inner_scan.predicates)
+            inlj.cost = outer.cost + outer.est_rows * (
+                max(1.0, per_probe) * RANDOM_PAGE_COST + per_probe * CPU_ROW_COST)
+            candidates.append(inlj)
+
+        best = min(candidates, key=lambda p: p.cost)
+        best.est_rows = out_rows
+        return best
+
+    # ---- entry points for the command layer ----
+    def plan(self, logical, want: Optional[int] = None) -> Operator:
+        """want: rows the caller will pull, passed down from a LIMIT through
+        projections to the scan; None for all."""
+        if isinstance(logical, LogicalScan):
+            return self.plan_scan(logical, want)
+        if isinstance(logical, LogicalJoin):
+            return self.plan_join(logical)
+        if isinstance(logical, LogicalSort):
+            return self._plan_sort(logical)
+        if isinstance(logical, LogicalLimit) and isinstance(logical.child, LogicalSort):
+            # ORDER BY ... LIMIT: an index walk or a bounded heap, never a full sort
+            child = self._plan_sort(logical.child, logical.limit + logical.offset)
+            op = Limit(child, logical.limit, logical.offset)
+            op.est_rows = min(child.est_rows, logical.limit)
+            op.cost = child.cost
+            return op
+
+        if isinstance(logical, LogicalLimit):
+            want = logical.limit + logical.offset
+        elif not isinstance(logical, LogicalProject):
+            want = None
+        child = self.plan(logical.child, want)
+        if isinstance(logical, LogicalProject):
+            if isinstance(child, VectorScan) and all(c in child.table.columns for c in logical.columns):
+                # Only decode the projected columns (a fraction of a PAX page)
+                child.columns = list(logical.columns)
+            elif isinstance(child, TableAccess):
+                # Only read the overflow chains of projected columns
+                child.columns = list(logical.columns)
+            op = Project(child, logical.columns)
+            op.est_rows = child.est_rows
+        elif isinstance(logical, LogicalLimit):
+            op = Limit(child, logical.limit, logical.offset)
+            op.est_rows = min(child.est_rows, logical.limit)
+        elif isinstance(logical, LogicalAggregate):
+            vec = self._vector_aggregate(logical, child)
+            if vec is not None:
+                return vec
+            op = Aggregate(child, logical.group_by, logical.aggs)
+            op.est_rows = 1.0 if not logical.group_by else max(1.0, child.est_rows ** 0.5)
+        else:
+            raise TypeError(f"Unknown logical node: {type(logical).__name__}")
+        op.cost = child.cost
+        return op
+
+    def _vector_aggregate(self, logical: 'LogicalAggregate', child: Operator) -> Optional[Operator]:
+        """Push a scan's aggregate into the C engine when the scan already runs there."""
+        if not isinstance(child, VectorScan) or len(logical.group_by) > 1:
+            return None
+        table = child.table
+        for func, col, _ in logical.aggs:
+            if col is not None and (col not in table.columns or
+                                    (func != "count" and table.columns[col].dtype.value != "INT")):
+                return None
+        if logical.group_by and logical.group_by[0] not in table.columns:
+            return None
+        op = VectorAggregate(table, child.predicates, logical.group_by[0] if logical.group_by else None,
+                             logical.aggs, child.pages, workers=child.workers)
+        op.est_rows = 1.0 if not logical.group_by else max(1.0, self._ndv(table, logical.group_by[0]))
+        op.cost = child.cost
+        return op
+
+    def run(self, logical) -> Iterator[Dict[str, Any]]:
+        """Plan and return a lazy row iterator."""
+        return iter(self.plan(logical))
+
+    def select(self, table: str, predicates: Optional[List[Predicate]] = None) -> List[Dict[str, Any]]:
+        return self.plan(LogicalScan(table, predicates)).execute()
+
+    def join(self, left: str, right: str, left_key: str, right_key: str) -> List[Dict[str, Any]]:
+        return self.plan(LogicalJoin(LogicalScan(left), LogicalScan(right), left_key, right_key)).execute()
+
+    def explain(self, logical) -> str:
+        return self.plan(logical).explain()
@@ -0,0 +1,104 @@
+import threading
+from collections import OrderedDict
+from typing import List, Dict, Any, Optional, Tuple
+
+import planner
+
+# ----------------------------
+# Query result cache
+#
+# Results are keyed by a normalized form of the logical plan and tagged
+# with the commit LSN of every table the plan reads (Table.lsn, taken
+# from the WAL end after each commit). A lookup whose tables have not
+# committed since the entry was stored is a hit; any commit to one of
+# them makes the entry stale on its next lookup, so invalidation is
+# exact without the write path knowing about the cache. The same LSNs
+# give HTTP ETags.
+# ----------------------------
+
+MAX_CACHED_ROWS = 10000  # larger results are returned but not kept
+
+
+def normalize(logical) -> str:
+    """Canonical text of a logical plan: equal for equivalent queries."""
+    if isinstance(logical, planner.LogicalScan):
+        preds = sorted(f"{p.col}{p.op}{p.value!r}" for p in logical.predicates)
+        return f"scan({logical.table};{','.join(preds)})"
+    if isinstance(logical, planner.LogicalJoin):
+        return (f"join({normalize(logical.left)},{normalize(logical.right)};"
+                f"{logical.left_key}={logical.right_key})")
+    if isinstance(logical, planner.LogicalProject):
+        return f"project({normalize(logical.child)};{','.join(logical.columns)})"
+    if isinstance(logical, planner.LogicalAggregate):
+        aggs = ",".join(f"{f}({c or '*'})as {a}" for f, c, a in logical.aggs)
+        return f"agg({normalize(logical.child)};{','.join(logical.group_by)};{aggs})"
+    if isinstance(logical, planner.LogicalSort):
+        keys = ",".join(f"{c}{' desc' if d else ''}" for c, d in logical.keys)
+        return f"sort({normalize(logical.child)};{keys})"
+    if isinstance(logical, planner.LogicalLimit):
+        return f"limit({normalize(logical.child)};{logical.limit},{logical.offset})"
+    raise TypeError(f"Unknown logical node: {type(logical).__name__}")
+
+
+def tables_of(logical) -> List[str]:
+    """Sorted names of the tables a logical plan reads."""
+    if isinstance(logical, planner.LogicalScan):
+        return [logical.table]
+    if isinstance(logical, planner.LogicalJoin):
+        return sorted(set(tables_of(logical.left)) | set(tables_of(logical.right)))
+    return tables_of(logical.child)
+
+
+class ResultCache:
+    """LRU of query results, each valid while its tables' commit LSNs hold."""
+
+    def __init__(self, db, capacity: int = 256):
+        self.db = db
+        self.capacity = capacity
+        self._entries: 'OrderedDict[str, Tuple[Tuple[int, ...], List[Dict[str, Any]]]]' = OrderedDict()
+        self._lock = threading.Lock()  # API handlers run on a thread pool
+        self.hits = 0
+        self.misses = 0
+        self.stale = 0
+
+    def versions(self, tables: List[str]) -> Tuple[int, ...]:
+        return tuple(self.db.get_table(t).lsn for t in tables)
+
+    def rows(self, logical) -> List[Dict[str, Any]]:
+        """Result rows of logical, from the cache when still current.
+
+        The returned list is shared with the cache: callers must not modify it.
+        """
+        key = normalize(logical)
+        # Versions are read before running, so a write racing the query can
+        # only leave an entry that looks older than it is, never newer.
+        version = self.versions(tables_of(logical))
+        with self._lock:
+            entry = self._entries.get(key)
+            if entry is not None:
+                if entry[0] == version:
+                    self._entries.move_to_end(key)
+                    self.hits += 1
+                    return entry[1]
+                del self._entries[key]
+                self.stale += 1
+            self.misses += 1
+
+        result = self.db.planner.plan(logical).execute()
+        if len(result) <= MAX_CACHED_ROWS:
+            with self._lock:
+                self._entries[key] = (version, result)
+                self._entries.move_to_end(key)
+                while len(self._entries) > self.capacity:
+                    self._entries.popitem(last=False)
+        return result
+
+    def stats(self) -> Dict[str, Any]:
+        with self._lock:
+            return {"entries": len(self._entries), "capacity": self.capacity,
+                    "hits": self.hits, "misses": self.misses, "stale": self.stale}
+
+
+def etag(db, logical) -> str:
+    """Strong ETag for the result of logical: changes iff a read table commits."""
+    return '"' + "-".join(f"{db.get_table(t).lsn:x}" for t in tables_of(logical)) + '"'
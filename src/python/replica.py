@@ -0,0 +1,179 @@
+import os
+import stat
+import threading
+from typing import Dict, Any, Optional
+
+from executor import Database, replica_apply, commit_lsn, file_page_size
+from rwlock import RWLock
+
+# ----------------------------
+# WAL-shipping read replicas
+#
+# A follower owns a second copy of the database (its own data directory)
+# and keeps it current by replaying the primary's WAL: it reads the log
+# from where it stopped, hands the bytes to replica_apply, which commits
+# every complete primary transaction in them as one local transaction, and
+# moves its position past the last commit applied. That position is the
+# replay LSN: the follower's data equals the primary's as of that offset
+# of the primary's WAL. It is kept in <db>-replica so a restarted
+# follower resumes instead of starting over (page images replay
+# idempotently, so resuming slightly early is harmless).
+#
+# The log comes either straight from the primary's WAL file (same host)
+# or from a pesadbd serving the primary, over its socket (OP_WAL_READ).
+# Page images replay as they are, so a new follower is created with the
+# primary's page size, which each source reports.
+#
+# Each applied chunk and the table refresh that follows it run under the
+# write side of `lock`, so readers that take the read side (pesadbd's
+# Engine shares it) never see pages newer than the indexes. The refresh
+# reloads only the tables whose catalog entry the chunk changed.
+# ----------------------------
+
+CHUNK = 4 << 20   # bytes of primary WAL fetched per read
+POLL = 0.05       # seconds between polls once caught up
+
+
+class FileWalSource:
+    """The primary's WAL read directly from its file."""
+
+    def __init__(self, wal_path: str):
+        self.path = wal_path
+
+    def read(self, offset: int, size: int) -> bytes:
+        try:
+            with open(self.path, "rb") as f:
+                f.seek(offset)
+                return f.read(size)
+        except FileNotFoundError:
+            return b""
+
+    def end(self) -> int:
+        try:
+            return os.path.getsize(self.path)
+        except FileNotFoundError:
+            return 0
+
+    def page_size(self) -> Optional[int]:
+        return file_page_size(self.path[:-len("-wal")].encode('utf-8')) or None
+
+
+class SocketWalSource:
+    """The primary's WAL fetched from its pesadbd."""
+
+    def __init__(self, socket_path: str):
+        from client import Client
+        self.client = Client(socket_path)
+        self._end = 0
+
+    def read(self, offset: int, size: int) -> bytes:
+        import wire
+        data, self._end = self.client.call(wire.OP_WAL_READ, [offset, size])
+        return data
+
+    def end(self) -> int:
+        return self._end
+
+    def page_size(self) -> Optional[int]:
+        return self.client.status().get("page_size")
+
+
+def wal_source(primary: str):
+    """Source for a primary given as a pesadbd socket, a db path or its WAL path."""
+    if os.path.exists(primary) and stat.S_ISSOCK(os.stat(primary).st_mode):
+        return SocketWalSource(primary)
+    return FileWalSource(primary if primary.endswith("-wal") else primary + "-wal")
+
+
+class Replica:
+    """Follows a primary and serves snapshot reads from its own copy."""
+
+    def __init__(self, path: str, primary, chunk: int = CHUNK, poll: float = POLL, **db_kwargs):
+        self.path = path
+        self.source = wal_source(primary) if isinstance(primary, str) else primary
+        self.chunk = chunk
+        self.poll = poll
+        if hasattr(self.source, "page_size"):
+            db_kwargs.setdefault("page_size", self.source.page_size())
+        self.db = Database(path, replica=True, **db_kwargs)
+        self.lock = RWLock()
+        self.replay_lsn = self._load_position()
+        self._stop = threading.Event()
+        self._thread: Optional[threading.Thread] = None
+        self.error: Optional[BaseException] = None
+
+    # ---- position ----
+    def _position_file(self) -> str:
+        return self.path + "-replica"
+
+    def _load_position(self) -> int:
+        try:
+            with open(self._position_file()) as f:
+                return int(f.read().strip() or 0)
+        except FileNotFoundError:
+            return 0
+
+    def _save_position(self):
+        tmp = self._position_file() + ".tmp"
+        with open(tmp, "w") as f:
+            f.write(str(self.replay_lsn))
+            f.flush()
+            os.fsync(f.fileno())
+        os.replace(tmp, self._position_file())
+
+    # ---- replay ----
+    def catch_up(self) -> int:
+        """Replay everything the primary has committed so far; returns the
+        number of WAL bytes applied."""
+        applied = 0
+        chunk = self.chunk
+        while True:
+            data = self.source.read(self.replay_lsn, chunk)
+            if not data:
+                return applied
+            used = self.lock.write(self._apply, data)
+            if used == 0:
+                if len(data) < chunk:
+                    return applied  # only a partial transaction so far
+                chunk *= 2          # one transaction larger than the chunk
+                continue
+            self.replay_lsn += used
+            applied += used
+            self._save_position()
+            chunk = self.chunk
+
+    def _apply(self, data: bytes) -> int:
+        used = replica_apply(data, len(data))
+        if used:
+            self.db.refresh()
+        return used
+
+    def start(self):
+        """Follow the primary on a background thread."""
+        if self._thread is not None:
+            return
+        self._stop.clear()
+        self._thread = threading.Thread(target=self._run, name="pesadb-replica", daemon=True)
+        self._thread.start()
+
+    def stop(self):
+        self._stop.set()
+        if self._thread is not None:
+            self._thread.join()
+            self._thread = None
+
+    def _run(self):
+        while not self._stop.is_set():
+            try:
+                if not self.catch_up():
+                    self._stop.wait(self.poll)
+            except Exception as e:  # keep serving reads at the last replay LSN
+                self.error = e
+                self._stop.wait(self.poll)
+
+    def status(self) -> Dict[str, Any]:
+        primary = self.source.end()
+        return {"role": "replica", "replay_lsn": self.replay_lsn, "primary_lsn": primary,
+                "page_size": self.db.page_size,
+                "lag_bytes": max(0, primary - self.replay_lsn), "commit_lsn": commit_lsn(),
+                "error": None if self.error is None else str(self.error)}
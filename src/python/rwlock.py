@@ -0,0 +1,61 @@
+import threading
+
+# ----------------------------
+# Reader/writer lock
+#
+# Queries walk the in-memory indexes, dictionaries and page maps that a
+# write mutates while it stages and applies, so a read must not overlap a
+# write. Reads may overlap each other. A waiting writer holds off new
+# readers so a steady stream of queries cannot starve it.
+# ----------------------------
+
+
+class RWLock:
+    """Many readers or one writer."""
+
+    def __init__(self):
+        self._cond = threading.Condition()
+        self._readers = 0
+        self._writing = False
+        self._writers_waiting = 0
+
+    def acquire_read(self):
+        with self._cond:
+            while self._writing or self._writers_waiting:
+                self._cond.wait()
+            self._readers += 1
+
+    def release_read(self):
+        with self._cond:
+            self._readers -= 1
+            if not self._readers:
+                self._cond.notify_all()
+
+    def acquire_write(self):
+        with self._cond:
+            self._writers_waiting += 1
+            while self._writing or self._readers:
+                self._cond.wait()
+            self._writers_waiting -= 1
+            self._writing = True
+
+    def release_write(self):
+        with self._cond:
+            self._writing = False
+            self._cond.notify_all()
+
+    def read(self, fn, *args, **kwargs):
+        """fn(*args, **kwargs) under the read lock."""
+        self.acquire_read()
+        try:
+            return fn(*args, **kwargs)
+        finally:
+            self.release_read()
+
+    def write(self, fn, *args, **kwargs):
+        """fn(*args, **kwargs) under the write lock."""
+        self.acquire_write()
+        try:
+            return fn(*args, **kwargs)
+        finally:
+            self.release_write()
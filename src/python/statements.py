@@ -0,0 +1,171 @@
+import re
+from typing import List, Any, Tuple
+
+import matview
+from planner import LogicalScan, LogicalLimit, LogicalSort, Predicate, OPS
+
+# ----------------------------
+# SELECT statement text -> logical plan
+#
+# The REPL's SEL syntax, shared by repl.py and pesadbd. A "?" in place of
+# a WHERE value or a LIMIT/OFFSET count is a parameter: prepare() parses
+# such text once, and each execution binds values into a fresh copy of
+# the plan. Planning still happens per execution, since the best access
+# path depends on the bound values.
+# ----------------------------
+
+
+def parse_value(tok):
+    try:
+        return int(tok)
+    except ValueError:
+        return tok
+
+
+SELECT_USAGE = ("Usage: SEL <table> [WHERE col [op] val [AND ...]] "
+                "[ORDER BY col [DESC]] [LIMIT n [OFFSET m]]")
+
+
+class Param:
+    """Placeholder for the index-th bound value of a prepared statement."""
+
+    def __init__(self, index: int):
+        self.index = index
+
+
+def build_select(args, params: List[Param] = None):
+    """SEL <table> [WHERE col [op] val [AND col [op] val ...]] [ORDER BY col [DESC]]
+    [LIMIT n [OFFSET m]] -> logical plan (args excludes the verb). op defaults to =.
+
+    With params, each "?" value becomes a Param appended to it."""
+    if not args:
+        raise ValueError(SELECT_USAGE)
+
+    def value(tok, convert=parse_value):
+        if params is not None and tok == "?":
+            params.append(Param(len(params)))
+            return params[-1]
+        return convert(tok)
+
+    preds = []
+    rest = args[1:]
+    if rest and rest[0].upper() == "WHERE":
+        rest = rest[1:]
+        while True:
+            if len(rest) >= 3 and rest[1] in OPS:
+                preds.append(Predicate(rest[0], rest[1], value(rest[2])))
+                rest = rest[3:]
+            elif len(rest) >= 2 and rest[1] not in OPS:
+                preds.append(Predicate(rest[0], "=", value(rest[1])))
+                rest = rest[2:]
+            else:
+                raise ValueError(SELECT_USAGE)
+            if not rest or rest[0].upper() != "AND":
+                break
+            rest = rest[1:]
+    plan = LogicalScan(args[0], preds)
+    if len(rest) >= 3 and rest[0].upper() == "ORDER" and rest[1].upper() == "BY":
+        desc = len(rest) > 3 and rest[3].upper() in ("DESC", "ASC")
+        plan = LogicalSort(plan, [(rest[2], desc and rest[3].upper() == "DESC")])
+        rest = rest[4:] if desc else rest[3:]
+    if len(rest) in (2, 4) and rest[0].upper() == "LIMIT":
+        offset = 0
+        if len(rest) == 4:
+            if rest[2].upper() != "OFFSET":
+                raise ValueError(SELECT_USAGE)
+            offset = value(rest[3], int)
+        plan = LogicalLimit(plan, value(rest[1], int), offset)
+        rest = []
+    if rest:
+        raise ValueError(SELECT_USAGE)
+    return plan
+
+
+def parse_select(text: str):
+    """Plan for SELECT text ("SEL ..." or just the part after the verb)."""
+    args = text.split()
+    if args and args[0].upper() in ("SEL", "SELECT"):
+        args = args[1:]
+    return build_select(args)
+
+
+class PreparedSelect:
+    """A SELECT parsed once, executed many times with different values."""
+
+    def __init__(self, text: str):
+        args = text.split()
+        if args and args[0].upper() in ("SEL", "SELECT"):
+            args = args[1:]
+        self.text = text
+        self.params: List[Param] = []
+        self.template = build_select(args, self.params)
+
+    def bind(self, values: List[Any]):
+        """Logical plan with the values in place of the placeholders."""
+        if len(values) != len(self.params):
+            raise ValueError(f"Statement takes {len(self.params)} parameters, got {len(values)}")
+        return _bind(self.template, values)
+
+
+def _bind(node, values):
+    def v(x):
+        return values[x.index] if isinstance(x, Param) else x
+
+    if isinstance(node, LogicalScan):
+        return LogicalScan(node.table, [Predicate(p.col, p.op, v(p.value)) for p in node.predicates])
+    if isinstance(node, LogicalSort):
+        return LogicalSort(_bind(node.child, values), node.keys)
+    if isinstance(node, LogicalLimit):
+        limit, offset = v(node.limit), v(node.offset)
+        if not isinstance(limit, int) or not isinstance(offset, int):
+            raise ValueError("LIMIT and OFFSET parameters must be integers")
+        return LogicalLimit(_bind(node.child, values), limit, offset)
+    raise TypeError(f"Cannot bind {type(node).__name__}")
+
+
+# ----------------------------
+# Materialized view definitions (see matview.py)
+# ----------------------------
+VIEW_USAGE = ("Usage: CREATE MATERIALIZED VIEW <name> AS "
+              "SELECT col[, ...], COUNT(*|col) [AS a], SUM(col) [AS a] FROM <table> "
+              "[WHERE col [op] val [AND ...]] [GROUP BY col[, ...]] "
+              "| JOIN <t1> <t2> ON <k1> <k2>")
+
+_VIEW_SELECT = re.compile(r"^SELECT\s+(.+?)\s+FROM\s+(\w+)(?:\s+WHERE\s+(.+?))?"
+                          r"(?:\s+GROUP\s+BY\s+(.+))?$", re.IGNORECASE)
+_VIEW_AGG = re.compile(r"^(\w+)\s*\(\s*(\*|\w+)\s*\)(?:\s+AS\s+(\w+))?$", re.IGNORECASE)
+_CREATE_VIEW = re.compile(r"^CREATE\s+MATERIALIZED\s+VIEW\s+(\w+)\s+AS\s+(.+)$", re.IGNORECASE)
+
+
+def parse_view(name: str, query: str):
+    """AggregateView or JoinView for the query text of a view definition."""
+    args = query.split()
+    if len(args) == 6 and args[0].upper() == "JOIN" and args[3].upper() == "ON":
+        return matview.JoinView(name, args[1], args[2], args[4], args[5])
+
+    m = _VIEW_SELECT.match(" ".join(args))
+    if not m:
+        raise ValueError(VIEW_USAGE)
+    items, table, where, group = m.groups()
+    group_by = [c.strip() for c in group.split(",")] if group else []
+    aggs = []
+    for item in (i.strip() for i in items.split(",")):
+        agg = _VIEW_AGG.match(item)
+        if agg:
+            func, col, alias = agg.groups()
+            col = None if col == "*" else col
+            aggs.append((func.lower(), col, alias or (func.lower() if col is None else f"{func.lower()}_{col}")))
+        elif item not in group_by:
+            raise ValueError(f"Column '{item}' must appear in GROUP BY")
+    if not aggs:
+        raise ValueError("An aggregate view needs at least one COUNT or SUM")
+    preds = build_select([table, "WHERE"] + where.split()).predicates if where else []
+    return matview.AggregateView(name, table, group_by, aggs, preds)
+
+
+def parse_create_view(text: str) -> Tuple[str, str]:
+    """(name, query) of "CREATE MATERIALIZED VIEW <name> AS <query>"."""
+    m = _CREATE_VIEW.match(" ".join(text.split()))
+    if not m:
+        raise ValueError(VIEW_USAGE)
+    return m.group(1), m.group(2)
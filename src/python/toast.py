@@ -0,0 +1,137 @@
+import codecs
+import hashlib
+import struct
+import zlib
+from typing import Callable, Iterator, List, NamedTuple, Optional
+
+# ----------------------------
+# Out-of-line storage for large TEXT values (row layout)
+#
+# A row whose JSON does not fit a page moves its largest TEXT values, one
+# at a time, into overflow chains until it does. The row keeps a pointer
+# in the value's place:
+#
+#   {"__toast__": [first_page, stored_bytes, length, digest, codec]}
+#
+# length is the value's UTF-8 size and digest a BLAKE2b of it, so an
+# update that leaves the value as it was keeps the chain instead of
+# rewriting it. codec is "zlib" if compressing saved at least 1/8 of the
+# bytes, else "raw". Each chain page (little-endian):
+#
+#   "TST1" | u8 name_len | table name | u32 next page (0 = last)
+#   | u16 chunk_len | chunk bytes
+#
+# Rows are decoded with pointers left in place; Table.read_rows follows
+# only the ones in the columns it is asked for, so a scan that does not
+# project a large column never reads its chain. A chain lives as long as
+# a live row points at it: deletes and updates hand the pages of the
+# chains they drop to the free list once they commit, and loading a table
+# frees every chain page of that table that no live row reaches.
+# ----------------------------
+
+MAGIC = b"TST1"
+_NEXT = struct.Struct("<IH")
+MIN_SAVING = 8  # compress only if it saves at least 1/MIN_SAVING of the bytes
+
+
+class Pointer(NamedTuple):
+    first: int
+    size: int       # bytes stored in the chain
+    length: int     # bytes of the UTF-8 value
+    digest: str
+    codec: str      # "zlib" or "raw"
+
+    def to_json(self):
+        return {"__toast__": list(self)}
+
+    @classmethod
+    def from_json(cls, value) -> Optional['Pointer']:
+        if isinstance(value, dict) and "__toast__" in value:
+            return cls(*value["__toast__"])
+        return None
+
+
+def digest(raw: bytes) -> str:
+    return hashlib.blake2b(raw, digest_size=16).hexdigest()
+
+
+def same_value(ptr: Pointer, value: str) -> bool:
+    raw = value.encode('utf-8')
+    return len(raw) == ptr.length and digest(raw) == ptr.digest
+
+
+def _header(table: str) -> bytes:
+    name = table.encode('utf-8')
+    return MAGIC + bytes([len(name)]) + name
+
+
+def chunk_size(table: str, page_size: int) -> int:
+    return page_size - len(_header(table)) - _NEXT.size
+
+
+def is_toast(data: bytes) -> bool:
+    return data[:4] == MAGIC
+
+
+def parse_page(data: bytes):
+    """(table name, next page, chunk) of a chain page."""
+    n = data[4]
+    name = data[5:5 + n].decode('utf-8', 'replace')
+    next_page, size = _NEXT.unpack_from(data, 5 + n)
+    start = 5 + n + _NEXT.size
+    return name, next_page, data[start:start + size]
+
+
+def store(table: str, value: str, page_size: int, alloc: Callable[[], int],
+          write: Callable[[int, bytes], None], compress: bool = True) -> Pointer:
+    """Write value into a new chain; alloc() hands out page ids and
+    write(page_id, data) stages a page."""
+    raw = value.encode('utf-8')
+    data, codec = raw, "raw"
+    if compress:
+        packed = zlib.compress(raw, 1)
+        if len(packed) <= len(raw) - len(raw) // MIN_SAVING:
+            data, codec = packed, "zlib"
+    step = chunk_size(table, page_size)
+    chunks = [data[i:i + step] for i in range(0, len(data), step)] or [b""]
+    pages = [alloc() for _ in chunks]
+    header = _header(table)
+    for i, (page_id, chunk) in enumerate(zip(pages, chunks)):
+        next_page = pages[i + 1] if i + 1 < len(pages) else 0
+        write(page_id, header + _NEXT.pack(next_page, len(chunk)) + chunk)
+    return Pointer(pages[0], len(data), len(raw), digest(raw), codec)
+
+
+def chain(read: Callable[[int], bytes], first: int) -> Iterator[tuple]:
+    """(page id, chunk) of each page of the chain starting at first."""
+    page_id = first
+    while page_id:
+        data = read(page_id)
+        if not is_toast(data):
+            raise IOError(f"Broken overflow chain: page {page_id} is not a chain page")
+        _, next_page, chunk = parse_page(data)
+        yield page_id, chunk
+        page_id = next_page
+
+
+def chain_pages(read: Callable[[int], bytes], ptr: Pointer) -> List[int]:
+    return [page_id for page_id, _ in chain(read, ptr.first)]
+
+
+def stream(read: Callable[[int], bytes], ptr: Pointer) -> Iterator[str]:
+    """The value in pieces of about one page, reading its chain as it goes."""
+    text = codecs.getincrementaldecoder('utf-8')()
+    unzip = zlib.decompressobj() if ptr.codec == "zlib" else None
+    for _, chunk in chain(read, ptr.first):
+        if unzip is not None:
+            chunk = unzip.decompress(chunk)
+        piece = text.decode(chunk)
+        if piece:
+            yield piece
+    tail = text.decode(unzip.flush() if unzip is not None else b"", final=True)
+    if tail:
+        yield tail
+
+
+def load(read: Callable[[int], bytes], ptr: Pointer) -> str:
+    return "".join(stream(read, ptr))
@@ -0,0 +1,277 @@
+import heapq
+import threading
+from typing import Any, Callable, Dict, List, Optional
+
+import columnar
+from executor import (Database, Table, begin_read, begin_write, commit, commit_lsn,
+                      checkpoint_async, truncate_db_pages, db_pages)
+
+# ----------------------------
+# Online VACUUM
+#
+# Deletes leave free pages behind (Database.free_page) and columnar pages
+# with dead slots, but the db file never gets smaller. A Vacuum pass:
+#
+#   1. repacks sparse columnar pages: the live rows of up to `batch` of a
+#      table's part-empty pages, in primary key order, rewritten onto as
+#      few pages as hold them;
+#   2. moves the highest live pages of every table onto the lowest free
+#      pages, `batch` pages per transaction, until no free page lies below
+#      a live one. The rows of each batch go to the free pages in
+#      (table, primary key) order, so a table's rows end up dense and in
+#      index order at the front of the file;
+#   3. lowers next_page past the free pages now at the end and logs a
+#      truncate of the db file (waldb_truncate). The file shrinks once
+#      the background checkpoint copies past that record, which it never
+#      does while an older snapshot is still registered.
+#
+# Each batch is one small WAL transaction that rewrites the moved pages,
+# the catalog and nothing else, and updates the in-memory indexes once it
+# has committed, as any write does. Snapshot readers therefore see either
+# the old or the new placement and never wait. Writers interleave between
+# batches: every batch goes through `run`, which must serialize it with
+# the application's other writes (pesadbd passes Engine.write). `rate`
+# caps the bytes written per second by sleeping between batches.
+# ----------------------------
+
+BATCH = 64          # pages moved or repacked per transaction
+RATE = 16 << 20     # bytes written per second; 0 = unthrottled
+
+
+def _pk_order(table: Table, rows: List[Dict[str, Any]]) -> List[Dict[str, Any]]:
+    pk = table._pk_col
+    return sorted(rows, key=lambda r: r[pk]) if pk else rows
+
+
+class Vacuum:
+    """Compacts a database's pages and shrinks its file while it stays open."""
+
+    def __init__(self, db: Database, batch: int = BATCH, rate: int = RATE,
+                 run: Optional[Callable[[Callable[[], int]], int]] = None):
+        if db.readonly or db.replica:
+            raise PermissionError("Database is open read-only")
+        self.db = db
+        self.batch = batch
+        self.rate = rate
+        self.run_batch = run or (lambda fn: fn())
+        self.report: Dict[str, int] = {}
+        self.error: Optional[BaseException] = None
+        self._written = 0  # pages written by the last batch
+        self._stop = threading.Event()
+        self._thread: Optional[threading.Thread] = None
+
+    # ---- batches ----
+    def _commit(self, txn, stats: Dict[str, Any]) -> int:
+        """Commit a batch whose catalog is staged and install its stats;
+        returns the commit LSN, which the caller publishes as table.lsn
+        once the indexes match."""
+        commit(txn)
+        for name, new_stats in stats.items():
+            self.db.tables[name].stats = new_stats
+        return commit_lsn()
+
+    def _batch(self, fn: Callable[[], int]) -> int:
+        """Run one batch through run, then sleep off its writes outside it."""
+        self._written = 0
+        done = self.run_batch(fn)
+        if self.rate and self._written:
+            self._stop.wait(self._written * self.db.page_size / self.rate)
+        return done
+
+    def _repack(self, table: Table, sources: List[int]) -> int:
+        """Rewrite the live rows of sources onto fewer pages; returns the
+        pages freed (0 if they would not fit on fewer)."""
+        # Chosen before the batch began; a write since may have changed them
+        sources = [p for p in sources if p in table._pages and p != table._tail_page]
+        rows, home, widths, dead = [], {}, [], 0
+        for page_id in sources:
+            slots = table._page_slots(page_id)
+            live = [r for r in slots if r is not None]
+            widths.append(len(slots))
+            dead += len(slots) - len(live)
+            for row in live:
+                home[id(row)] = page_id
+            rows += live
+        rows = _pk_order(table, rows)
+
+        packed = []
+        while rows:
+            # Largest prefix that fits one page, by bisection over the row count
+            lo, hi = 1, min(len(rows), columnar.MAX_ROWS)
+            while lo < hi:
+                mid = (lo + hi + 1) // 2
+                if len(table._encode_page(rows[:mid])) <= self.db.page_size:
+                    lo = mid
+                else:
+                    hi = mid - 1
+            packed.append(rows[:lo])
+            rows = rows[lo:]
+        if len(packed) >= len(sources):
+            return 0
+
+        mark = self.db._write_mark()
+        wtxn = begin_write()
+        try:
+            targets = []
+            for page_rows in packed:
+                page_id = self.db.alloc_page()
+                table._write_bytes(wtxn, page_id, table._encode_page(page_rows))
+                targets.append(page_id)
+            for page_id, width in zip(sources, widths):
+                table._write_bytes(wtxn, page_id, table._encode_page([None] * width))
+            new_stats = table.stats.copy()
+            new_stats.live_pages += len(packed) - len(sources)
+            new_stats.dead_pages = max(0, new_stats.dead_pages - dead)
+            self.db._write_catalog(wtxn, {table.name: new_stats})
+        except Exception:
+            self.db._abort(wtxn, mark)
+            raise
+        lsn = self._commit(wtxn, {table.name: new_stats})
+
+        for page_id, page_rows in zip(targets, packed):
+            for row in page_rows:
+                table._apply_update(home[id(row)], page_id, row, row, False)
+        for page_id in sources:
+            table._release_page(page_id)
+        table.lsn = lsn
+        self._written = len(packed) + len(sources)
+        return len(sources) - len(packed)
+
+    def _move(self) -> int:
+        """Move up to batch of the highest live pages below them; returns
+        the pages moved."""
+        db = self.db
+        owners = {p: t for t in db.tables.values() for p in t._pages}
+        lows = heapq.nsmallest(self.batch, db._free_pages)
+        chosen = []
+        for page_id in sorted(owners, reverse=True):
+            if len(chosen) == len(lows) or lows[len(chosen)] >= page_id:
+                break
+            chosen.append(page_id)
+        if not chosen:
+            return 0
+
+        txn = begin_read()
+        moves = []
+        for page_id in chosen:
+            table = owners[page_id]
+            rows = _pk_order(table, [r for _, r in table.read_rows([page_id], txn)])
+            if rows:
+                moves.append((table, page_id, rows))
+        moves.sort(key=lambda m: (m[0].name,) + ((m[2][0][m[0]._pk_col],) if m[0]._pk_col else ()))
+        targets = lows[:len(moves)]
+
+        mark = db._write_mark()
+        wtxn = begin_write()
+        stats = {}
+        try:
+            for (table, page_id, rows), target in zip(moves, targets):
+                dead = table._store_move(wtxn, page_id, target, rows)
+                # Listed even when its stats stay the same: the commit bumps the
+                # table's version, which tells replicas to reload it
+                new_stats = stats.setdefault(table.name, table.stats.copy())
+                new_stats.dead_pages = max(0, new_stats.dead_pages - dead)
+            db._write_catalog(wtxn, stats)
+        except Exception:
+            db._abort(wtxn, mark)
+            raise
+        lsn = self._commit(wtxn, stats)
+
+        for _ in targets:
+            heapq.heappop(db._free_pages)
+        for (table, page_id, rows), target in zip(moves, targets):
+            table._apply_move(page_id, target, rows)
+        for table, _, _ in moves:
+            table.lsn = lsn
+        self._written = 2 * len(moves)
+        return len(moves)
+
+    def _shrink(self) -> int:
+        """Cut the free pages at the end of the file off; returns how many."""
+        db = self.db
+        free = set(db._free_pages)
+        top = db.next_page
+        while top - 1 in free:
+            top -= 1
+        cut = db.next_page - top
+        if cut:
+            mark = db._write_mark()
+            free = db._free_pages
+            db.next_page = top
+            db._free_pages = [p for p in free if p < top]
+            heapq.heapify(db._free_pages)
+            txn = begin_write()
+            try:
+                db._write_catalog(txn)
+            except Exception:
+                db._abort(txn, mark)
+                db._free_pages = free
+                raise
+            self._commit(txn, {})
+        if cut or db_pages() > top:
+            truncate_db_pages(top)
+        return cut
+
+    # ---- driver ----
+    def run(self) -> Dict[str, int]:
+        """One full pass; returns what it did."""
+        db = self.db
+        report = {"pages_before": db.next_page, "repacked": 0, "moved": 0, "truncated": 0}
+        for table in list(db.tables.values()):
+            if table.LAYOUT != "columnar":
+                continue
+            sparse = [p for p in table.page_ids()
+                      if p != table._tail_page and self._live_slots(table, p) < columnar.MAX_ROWS]
+            for i in range(0, len(sparse), self.batch):
+                if self._stop.is_set():
+                    return self._finish(report)
+                group = sparse[i:i + self.batch]
+                if len(group) > 1:
+                    report["repacked"] += self._batch(lambda: self._repack(table, group))
+        while not self._stop.is_set():
+            moved = self._batch(self._move)
+            if not moved:
+                break
+            report["moved"] += moved
+        if not self._stop.is_set():
+            report["truncated"] = self._batch(self._shrink)
+            checkpoint_async()
+        return self._finish(report)
+
+    def _finish(self, report: Dict[str, int]) -> Dict[str, int]:
+        report["pages_after"] = self.db.next_page
+        self.report = report
+        return report
+
+    @staticmethod
+    def _live_slots(table: Table, page_id: int) -> int:
+        return sum(1 for _ in table.read_rows([page_id]))
+
+    def start(self):
+        """Run a pass on a background thread; see report and error."""
+        if self._thread is not None:
+            return
+        self._stop.clear()
+        self._thread = threading.Thread(target=self._background, name="pesadb-vacuum", daemon=True)
+        self._thread.start()
+
+    def _background(self):
+        try:
+            self.run()
+        except Exception as e:
+            self.error = e
+
+    def stop(self):
+        """Stop after the current batch; what has committed stays."""
+        self._stop.set()
+        self.join()
+
+    def join(self):
+        if self._thread is not None:
+            self._thread.join()
+            self._thread = None
+
+
+def vacuum(db: Database, **kwargs) -> Dict[str, int]:
+    """Run one Vacuum pass in the calling thread."""
+    return Vacuum(db, **kwargs).run()
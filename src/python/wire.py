@@ -0,0 +1,214 @@
+import struct
+from typing import Any, Tuple
+
+# ----------------------------
+# pesadbd wire protocol
+#
+# Every message is a frame: a 9-byte header (payload length u32, request
+# id u32, opcode or status u8, all big-endian) followed by one encoded
+# value. Clients choose request ids and may send many frames before
+# reading any replies (pipelining). The server answers each connection's
+# requests in order, with the request id echoed and STATUS_OK or
+# STATUS_ERR in the opcode byte.
+#
+# Values are tagged: one tag byte, then the body. Result sets use TAG_ROWS:
+# the column names are sent once and each row is then just its values.
+# ----------------------------
+
+HEADER = struct.Struct("!IIB")
+MAX_FRAME = 64 << 20
+
+# Requests
+OP_PING = 0
+OP_QUERY = 1      # text: "SEL <table> [WHERE ...] [ORDER BY ...] [LIMIT ...]"
+OP_PREPARE = 2    # text with ? placeholders -> [stmt_id, param_count]
+OP_EXECUTE = 3    # [stmt_id, [params...]] -> rows
+OP_CLOSE = 4      # stmt_id
+OP_INSERT = 5     # [table, [row, ...]] -> [None or error text per row]
+OP_DELETE = 6     # [table, key_col, key_val]
+OP_UPDATE = 7     # [table, key_col, key_val, {col: val}]
+OP_EXPLAIN = 8    # text -> plan text
+OP_WAL_READ = 9   # [offset, max_bytes] -> [WAL bytes, commit LSN] (replica feed)
+OP_STATUS = 10    # -> {role, commit_lsn[, replay_lsn, primary_lsn]}
+OP_VACUUM = 11    # -> {pages_before, pages_after, moved, repacked, truncated}
+
+# Replies
+STATUS_OK = 0
+STATUS_ERR = 1    # [error class name, message]
+
+TAG_NONE = b"N"
+TAG_TRUE = b"T"
+TAG_FALSE = b"F"
+TAG_INT = b"i"    # int64
+TAG_FLOAT = b"f"  # IEEE double
+TAG_STR = b"s"    # u32 length + UTF-8
+TAG_LIST = b"l"   # u32 count + values
+TAG_MAP = b"m"    # u32 count + (str, value) pairs
+TAG_ROWS = b"r"   # u32 ncols + names, u32 nrows + values row-major
+TAG_BYTES = b"b"  # u32 length + raw bytes
+
+_U32 = struct.Struct("!I")
+_I64 = struct.Struct("!q")
+_F64 = struct.Struct("!d")
+
+
+class ProtocolError(Exception):
+    pass
+
+
+def _put_str(out: bytearray, s: str):
+    b = s.encode("utf-8")
+    out += _U32.pack(len(b))
+    out += b
+
+
+def _put(out: bytearray, v: Any):
+    if v is None:
+        out += TAG_NONE
+    elif v is True:
+        out += TAG_TRUE
+    elif v is False:
+        out += TAG_FALSE
+    elif isinstance(v, int):
+        out += TAG_INT
+        out += _I64.pack(v)
+    elif isinstance(v, float):
+        out += TAG_FLOAT
+        out += _F64.pack(v)
+    elif isinstance(v, str):
+        out += TAG_STR
+        _put_str(out, v)
+    elif isinstance(v, (bytes, bytearray)):
+        out += TAG_BYTES
+        out += _U32.pack(len(v))
+        out += v
+    elif isinstance(v, (list, tuple)):
+        if v and all(isinstance(r, dict) for r in v) and _same_keys(v):
+            cols = list(v[0])
+            out += TAG_ROWS
+            out += _U32.pack(len(cols))
+            for c in cols:
+                _put_str(out, c)
+            out += _U32.pack(len(v))
+            for row in v:
+                for c in cols:
+                    _put(out, row[c])
+        else:
+            out += TAG_LIST
+            out += _U32.pack(len(v))
+            for x in v:
+                _put(out, x)
+    elif isinstance(v, dict):
+        out += TAG_MAP
+        out += _U32.pack(len(v))
+        for k, x in v.items():
+            _put_str(out, str(k))
+            _put(out, x)
+    else:
+        raise ProtocolError(f"Cannot encode {type(v).__name__}")
+
+
+def _same_keys(rows) -> bool:
+    keys = rows[0].keys()
+    return all(r.keys() == keys for r in rows)
+
+
+def encode(v: Any) -> bytes:
+    out = bytearray()
+    _put(out, v)
+    return bytes(out)
+
+
+def _get_str(buf: memoryview, pos: int) -> Tuple[str, int]:
+    (n,) = _U32.unpack_from(buf, pos)
+    pos += 4
+    return bytes(buf[pos:pos + n]).decode("utf-8"), pos + n
+
+
+def _get(buf: memoryview, pos: int) -> Tuple[Any, int]:
+    tag = bytes(buf[pos:pos + 1])
+    pos += 1
+    if tag == TAG_NONE:
+        return None, pos
+    if tag == TAG_TRUE:
+        return True, pos
+    if tag == TAG_FALSE:
+        return False, pos
+    if tag == TAG_INT:
+        return _I64.unpack_from(buf, pos)[0], pos + 8
+    if tag == TAG_FLOAT:
+        return _F64.unpack_from(buf, pos)[0], pos + 8
+    if tag == TAG_STR:
+        return _get_str(buf, pos)
+    if tag == TAG_BYTES:
+        (n,) = _U32.unpack_from(buf, pos)
+        pos += 4
+        return bytes(buf[pos:pos + n]), pos + n
+    if tag == TAG_LIST:
+        (n,) = _U32.unpack_from(buf, pos)
+        pos += 4
+        items = []
+        for _ in range(n):
+            x, pos = _get(buf, pos)
+            items.append(x)
+        return items, pos
+    if tag == TAG_MAP:
+        (n,) = _U32.unpack_from(buf, pos)
+        pos += 4
+        d = {}
+        for _ in range(n):
+            k, pos = _get_str(buf, pos)
+            d[k], pos = _get(buf, pos)
+        return d, pos
+    if tag == TAG_ROWS:
+        (ncols,) = _U32.unpack_from(buf, pos)
+        pos += 4
+        cols = []
+        for _ in range(ncols):
+            c, pos = _get_str(buf, pos)
+            cols.append(c)
+        (nrows,) = _U32.unpack_from(buf, pos)
+        pos += 4
+        rows = []
+        for _ in range(nrows):
+            row = {}
+            for c in cols:
+                row[c], pos = _get(buf, pos)
+            rows.append(row)
+        return rows, pos
+    raise ProtocolError(f"Unknown value tag {tag!r}")
+
+
+def decode(payload: bytes) -> Any:
+    try:
+        v, pos = _get(memoryview(payload), 0)
+    except struct.error as e:
+        raise ProtocolError(f"Truncated value: {e}")
+    except ValueError as e:  # UnicodeDecodeError: a string that is not UTF-8
+        raise ProtocolError(f"Malformed value: {e}")
+    except RecursionError:
+        raise ProtocolError("Value nested too deeply")
+    if pos != len(payload):
+        raise ProtocolError("Trailing bytes after value")
+    return v
+
+
+def frame(req_id: int, op: int, value: Any) -> bytes:
+    payload = encode(value)
+    return HEADER.pack(len(payload), req_id, op) + payload
+
+
+def _read_exact(rfile, n: int) -> bytes:
+    data = rfile.read(n)
+    if len(data) < n:
+        raise EOFError("connection closed")
+    return data
+
+
+def read_frame(rfile) -> Tuple[int, int, Any]:
+    """Block for the next frame on a buffered reader (e.g. sock.makefile("rb"));
+    returns (request id, op/status, value)."""
+    length, req_id, op = HEADER.unpack(_read_exact(rfile, HEADER.size))
+    if length > MAX_FRAME:
+        raise ProtocolError(f"Frame of {length} bytes exceeds {MAX_FRAME}")
+    return req_id, op, decode(_read_exact(rfile, length))